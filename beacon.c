@@ -0,0 +1,208 @@
+/*
+ *  Beacon timing and device clock analyzer
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+
+#include <math.h>
+#include <string.h>
+
+#include "beacon.h"
+
+/* Beacons use delimiter type 0 */
+#define BCN_DT_BEACON		0
+/* Invalid beacon transmission offset */
+#define BCN_BTO_INVALID		0x8000
+/* Periods are trusted to detect missed beacons past this many samples */
+#define BCN_MIN_SAMPLES		8
+
+static void stat_add(struct bcn_stat *s, double v)
+{
+	double d = v - s->mean;
+
+	if (!s->n || v < s->min)
+		s->min = v;
+	if (!s->n || v > s->max)
+		s->max = v;
+	s->n++;
+	s->mean += d / s->n;
+	s->m2 += d * (v - s->mean);
+}
+
+static double stat_stddev(const struct bcn_stat *s)
+{
+	return s->n > 1 ? sqrt(s->m2 / (s->n - 1)) : 0;
+}
+
+static void fit_add(struct bcn_fit *f, double x, double y)
+{
+	double dx, dy;
+
+	if (!f->n) {
+		f->x0 = x;
+		f->y0 = y;
+	}
+	x -= f->x0;
+	y -= f->y0;
+
+	f->n++;
+	dx = x - f->mean_x;
+	dy = y - f->mean_y;
+	f->mean_x += dx / f->n;
+	f->mean_y += dy / f->n;
+	f->sxx += dx * (x - f->mean_x);
+	f->syy += dy * (y - f->mean_y);
+	f->sxy += dx * (y - f->mean_y);
+}
+
+static double fit_slope(const struct bcn_fit *f)
+{
+	return f->sxx > 0 ? f->sxy / f->sxx : 0;
+}
+
+/* Standard deviation of the residuals, in y units */
+static double fit_residual(const struct bcn_fit *f)
+{
+	double sse;
+
+	if (f->n < 3 || f->sxx <= 0)
+		return 0;
+
+	sse = f->syy - f->sxy * f->sxy / f->sxx;
+
+	return sse > 0 ? sqrt(sse / (f->n - 2)) : 0;
+}
+
+void bcn_analyzer_init(struct bcn_analyzer *a)
+{
+	memset(a, 0, sizeof(*a));
+}
+
+static void bcn_add_beacon(struct bcn_snid_stats *s, const struct sniff_record *rec)
+{
+	u_int32_t delta;
+	double mean;
+	int i;
+
+	if (s->beacons) {
+		/* 32-bit timestamps wrap around every 171 seconds */
+		delta = rec->bts - s->last_bts;
+		s->ntb += delta;
+
+		mean = s->period.mean;
+		if (s->period.n >= BCN_MIN_SAMPLES && delta > 1.5 * mean)
+			s->missed += (u_int64_t)(delta / mean + 0.5) - 1;
+		else if (delta)
+			stat_add(&s->period, delta);
+	}
+	s->last_bts = rec->bts;
+	s->beacons++;
+
+	for (i = 0; i < BCN_NUM_BTO; i++) {
+		if (rec->bto[i] != BCN_BTO_INVALID)
+			stat_add(&s->bto[i], (int16_t)rec->bto[i]);
+	}
+
+	fit_add(&s->clock, rec->host_time, s->ntb);
+}
+
+void bcn_analyzer_add(struct bcn_analyzer *a, const struct sniff_record *rec)
+{
+	a->records++;
+
+	/* A device reset restarts its clock, so does the fit */
+	if (a->clock.n && rec->systime < a->last_systime) {
+		a->clock_resets++;
+		memset(&a->clock, 0, sizeof(a->clock));
+	}
+	a->last_systime = rec->systime;
+	fit_add(&a->clock, rec->host_time, rec->systime);
+
+	/* Every record has a decoded beacon area, zeroed unless the frame is a beacon */
+	if (rec->del_type == BCN_DT_BEACON && rec->bcn_del_type == BCN_DT_BEACON)
+		bcn_add_beacon(&a->snid[rec->bcn_snid & (BCN_NUM_SNID - 1)], rec);
+}
+
+void bcn_analyzer_report(struct bcn_analyzer *a, FILE *out)
+{
+	const double us_per_tick = 1e6 / BCN_NTB_HZ;
+	struct bcn_snid_stats *s;
+	double rate;
+	int i, j;
+
+	fprintf(out, "Records: %llu\n", (unsigned long long)a->records);
+	fprintf(out, "Device clock: %.3f ticks/s, residual %.1f ticks, %llu reset(s)\n",
+		fit_slope(&a->clock) * 1e6, fit_residual(&a->clock),
+		(unsigned long long)a->clock_resets);
+
+	fprintf(out, "SNID Beacons    Missed  Period (ms)  Jitter (us) Min (ms)  Max (ms)  NTB drift (ppm)\n");
+	for (i = 0; i < BCN_NUM_SNID; i++) {
+		s = &a->snid[i];
+		if (!s->beacons)
+			continue;
+
+		rate = fit_slope(&s->clock) * 1e6;
+		fprintf(out, "%4x %10llu %7llu %12.4f %12.2f %9.4f %9.4f %10.2f\n", i,
+			(unsigned long long)s->beacons, (unsigned long long)s->missed,
+			s->period.mean * us_per_tick / 1000,
+			stat_stddev(&s->period) * us_per_tick,
+			s->period.min * us_per_tick / 1000,
+			s->period.max * us_per_tick / 1000,
+			s->clock.n > 2 ? (rate / BCN_NTB_HZ - 1) * 1e6 : 0);
+
+		for (j = 0; j < BCN_NUM_BTO; j++) {
+			if (!s->bto[j].n)
+				continue;
+			fprintf(out, "     BTO%d: mean %.1f us, stddev %.2f us, min %.1f us, max %.1f us\n", j,
+				s->bto[j].mean * us_per_tick, stat_stddev(&s->bto[j]) * us_per_tick,
+				s->bto[j].min * us_per_tick, s->bto[j].max * us_per_tick);
+		}
+	}
+}
@@ -0,0 +1,156 @@
+/*
+ *  Beacon timing and device clock analyzer
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+
+#ifndef __BEACON_H__
+#define __BEACON_H__
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "sniffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BCN_NUM_SNID		16
+#define BCN_NUM_BTO		4
+#define BCN_NTB_HZ		25000000	/* network time base frequency */
+
+/**
+ * bcn_stat - running mean, variance and range of a series (Welford)
+ */
+struct bcn_stat {
+	u_int64_t	n;
+	double		mean;
+	double		m2;
+	double		min;
+	double		max;
+};
+
+/**
+ * bcn_fit - running least squares fit of y = a + b * x
+ * @x0, @y0:	first sample, subtracted from every sample to keep precision
+ */
+struct bcn_fit {
+	u_int64_t	n;
+	double		x0;
+	double		y0;
+	double		mean_x;
+	double		mean_y;
+	double		sxx;
+	double		syy;
+	double		sxy;
+};
+
+/**
+ * bcn_snid_stats - beacon statistics of one network
+ * @beacons:	number of beacons received
+ * @missed:	number of beacons missing from the received sequence
+ * @last_bts:	last beacon timestamp
+ * @ntb:	unwrapped beacon timestamp
+ * @period:	beacon period (NTB ticks)
+ * @bto:	beacon transmission offsets (NTB ticks)
+ * @clock:	host time (us) to unwrapped beacon timestamp fit
+ */
+struct bcn_snid_stats {
+	u_int64_t	beacons;
+	u_int64_t	missed;
+	u_int32_t	last_bts;
+	u_int64_t	ntb;
+	struct bcn_stat	period;
+	struct bcn_stat	bto[BCN_NUM_BTO];
+	struct bcn_fit	clock;
+};
+
+/**
+ * bcn_analyzer - streaming beacon and clock analyzer, constant size
+ * @records:	number of records analyzed
+ * @clock_resets: number of times the device system time went backwards
+ * @last_systime: last device system time
+ * @clock:	host time (us) to device system time fit
+ * @snid:	per network statistics
+ */
+struct bcn_analyzer {
+	u_int64_t		records;
+	u_int64_t		clock_resets;
+	u_int64_t		last_systime;
+	struct bcn_fit		clock;
+	struct bcn_snid_stats	snid[BCN_NUM_SNID];
+};
+
+/**
+ * bcn_analyzer_init - reset an analyzer
+ * @a:		analyzer
+ */
+extern void bcn_analyzer_init(struct bcn_analyzer *a);
+
+/**
+ * bcn_analyzer_add - account a sniffer record
+ * @a:		analyzer
+ * @rec:	decoded sniffer indication
+ */
+extern void bcn_analyzer_add(struct bcn_analyzer *a, const struct sniff_record *rec);
+
+/**
+ * bcn_analyzer_report - print the statistics gathered so far
+ * @a:		analyzer
+ * @out:	output stream
+ */
+extern void bcn_analyzer_report(struct bcn_analyzer *a, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BEACON_H__ */
@@ -0,0 +1,169 @@
+/*
+ *  Sniffer capture loop
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+#include <sys/types.h>
+#ifndef __CYGWIN__
+#include <net/ethernet.h>
+#endif
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "faifa.h"
+#include "faifa_compat.h"
+#include "faifa_priv.h"
+#include "frame.h"
+#include "homeplug_av.h"
+#include "sniffer.h"
+
+extern FILE *err_stream;
+extern FILE *out_stream;
+
+static volatile sig_atomic_t capture_stopped;
+
+/**
+ * sniffer_stop - make sniffer_capture return, may be called from a signal handler
+ */
+void sniffer_stop(void)
+{
+	capture_stopped = 1;
+}
+
+static int sniffer_set_mode(faifa_t *faifa, u_int8_t control)
+{
+	struct sniffer_request req;
+
+	memset(&req, 0, sizeof(req));
+	req.control = control;
+
+	return hpav_send_mme(faifa, HPAV_MMTYPE_SNIFFER_REQ, faifa->dst_addr, &req, sizeof(req));
+}
+
+/**
+ * sniffer_capture - enable the sniffer mode and store every indication
+ * into a ring file until sniffer_stop is called
+ * @faifa:	private handle
+ * @path:	ring file path
+ * @capacity:	number of records of the ring file
+ * @return
+ *	0 on success, -1 on error
+ */
+int sniffer_capture(faifa_t *faifa, const char *path, u_int32_t capacity)
+{
+	struct bpf_program prog;
+	struct pcap_pkthdr *pcap_header;
+	const u_char *pcap_data;
+	struct pcap_stat stats;
+	struct sniff_record rec;
+	sniff_ring_t *ring;
+	u_int8_t *payload;
+	u_int16_t mmtype;
+	int n, ret = -1;
+
+	ring = sniff_ring_create(path, capacity);
+	if (!ring) {
+		faifa_set_error(faifa, "%s: %s", path, strerror(errno));
+		return -1;
+	}
+
+	/* Let the kernel drop everything but HomePlug AV frames */
+	if (pcap_compile(faifa->pcap, &prog, "ether proto 0x88e1", 1, PCAP_NETMASK_UNKNOWN) == 0) {
+		if (pcap_setfilter(faifa->pcap, &prog) < 0)
+			faifa_printf(err_stream, "pcap_setfilter: %s\n", pcap_geterr(faifa->pcap));
+		pcap_freecode(&prog);
+	}
+
+	if (sniffer_set_mode(faifa, HPAV_SC_ENABLE) < 0)
+		goto out_close;
+
+	faifa_printf(out_stream, "Capturing sniffer indications into %s, %u records\n",
+		path, capacity);
+
+	/*
+	 * Keep this loop free of any formatting or system call besides the
+	 * capture itself: records are decoded straight from the capture
+	 * buffer into the mapped ring.
+	 */
+	while (!capture_stopped) {
+		n = pcap_next_ex(faifa->pcap, &pcap_header, &pcap_data);
+		if (n < 0) {
+			faifa_set_error(faifa, "pcap_next_ex: %s", pcap_geterr(faifa->pcap));
+			goto out_disable;
+		}
+		if (n == 0)
+			continue;
+
+		n = hpav_parse_mme((void *)pcap_data, pcap_header->caplen, &mmtype, &payload);
+		if (mmtype != HPAV_MMTYPE_SNIFFER_IND)
+			continue;
+
+		rec.host_time = (u_int64_t)pcap_header->ts.tv_sec * 1000000 + pcap_header->ts.tv_usec;
+		if (sniff_decode(&rec, payload, n) < 0)
+			continue;
+
+		sniff_ring_put(ring, &rec);
+	}
+	ret = 0;
+
+out_disable:
+	sniffer_set_mode(faifa, HPAV_SC_DISABLE);
+	if (pcap_stats(faifa->pcap, &stats) == 0)
+		sniff_ring_set_dropped(ring, stats.ps_drop);
+	faifa_printf(out_stream, "%llu indications captured, %llu dropped\n",
+		(unsigned long long)sniff_ring_info(ring)->head,
+		(unsigned long long)sniff_ring_info(ring)->dropped);
+out_close:
+	sniff_ring_close(ring);
+	return ret;
+}
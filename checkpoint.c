@@ -0,0 +1,259 @@
+/*
+ *  Check point report reassembly
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+
+#include <sys/types.h>
+#ifndef __CYGWIN__
+#include <net/ethernet.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "faifa.h"
+#include "faifa_compat.h"
+#include "faifa_priv.h"
+#include "frame.h"
+#include "homeplug_av.h"
+#include "endian.h"
+
+extern FILE *err_stream;
+extern FILE *out_stream;
+
+#define CP_RPT_TIMEOUT		1000	/* ms without a new part before asking again */
+#define CP_RPT_RETRIES		5	/* CP_RPT_REQ attempts */
+#define CP_RPT_MAX_LENGTH	(1 << 20)	/* sanity limit on the buffer length */
+#define CP_RPT_MAX_PARTS	256
+
+/**
+ * cp_session - check point buffer being reassembled
+ * @session_id:	session the parts belong to
+ * @length:	buffer length, 0 until the first part is received
+ * @num_parts:	number of parts of the buffer
+ * @done:	number of distinct parts received
+ * @received:	bitmap of the received parts
+ * @buf:	buffer, @length bytes
+ */
+struct cp_session {
+	u_int16_t	session_id;
+	u_int32_t	length;
+	unsigned int	num_parts;
+	unsigned int	done;
+	u_int8_t	received[CP_RPT_MAX_PARTS / 8];
+	u_int8_t	*buf;
+};
+
+static void cp_session_reset(struct cp_session *s)
+{
+	free(s->buf);
+	s->buf = NULL;
+	s->length = 0;
+	s->num_parts = 0;
+	s->done = 0;
+	memset(s->received, 0, sizeof(s->received));
+}
+
+/**
+ * cp_session_add - place a CP_RPT_IND part into the buffer
+ * @return
+ *	1 when the buffer is complete, 0 otherwise, -1 on error
+ */
+static int cp_session_add(faifa_t *faifa, struct cp_session *s, struct check_points_indicate *mm, int len)
+{
+	u_int32_t length = STORE32_LE(mm->length);
+	u_int16_t data_length = STORE16_LE(mm->data_length);
+	u_int16_t data_offset = STORE16_LE(mm->data_offset);
+	unsigned int part = mm->cur_part;
+
+	if (STORE16_LE(mm->session_id) != s->session_id)
+		return 0;
+
+	if (mm->mstatus != SUCCESS) {
+		faifa_set_error(faifa, "Check point report failed, status 0x%02x", mm->mstatus);
+		return -1;
+	}
+
+	if (!mm->num_parts || part >= mm->num_parts || !length || length > CP_RPT_MAX_LENGTH ||
+	    (u_int32_t)data_offset + data_length > length || len < (int)(sizeof(*mm) + data_length)) {
+		if (faifa->verbose)
+			faifa_printf(err_stream, "Ignoring malformed part %u/%u\n", part, mm->num_parts);
+		return 0;
+	}
+
+	/* The buffer changed under us: start over with the new layout */
+	if (s->buf && (s->length != length || s->num_parts != mm->num_parts))
+		cp_session_reset(s);
+
+	if (!s->buf) {
+		s->buf = calloc(1, length);
+		if (!s->buf) {
+			faifa_set_error(faifa, "Cannot allocate memory");
+			return -1;
+		}
+		s->length = length;
+		s->num_parts = mm->num_parts;
+	}
+
+	if (!(s->received[part / 8] & (1 << (part % 8)))) {
+		memcpy(s->buf + data_offset, mm->data, data_length);
+		s->received[part / 8] |= 1 << (part % 8);
+		s->done++;
+	}
+
+	return s->done == s->num_parts;
+}
+
+static void cp_dump_missing(struct cp_session *s)
+{
+	unsigned int i;
+
+	faifa_printf(err_stream, "Missing parts:");
+	for (i = 0; i < s->num_parts; i++) {
+		if (!(s->received[i / 8] & (1 << (i % 8))))
+			faifa_printf(err_stream, " %u", i);
+	}
+	faifa_printf(err_stream, "\n");
+}
+
+static int cp_request(faifa_t *faifa, struct cp_session *s, int clear)
+{
+	struct check_points_request req;
+
+	req.session_id = STORE16_LE(s->session_id);
+	req.clr_flag = clear ? 0x01 : 0x00;
+
+	return hpav_send_mme(faifa, HPAV_MMTYPE_CP_RPT_REQ, faifa->dst_addr, &req, sizeof(req));
+}
+
+/**
+ * hpav_read_check_points - retrieve the check point buffer into a file
+ * @faifa:	private handle
+ * @path:	output file path
+ * @clear:	clear the check points once they are read
+ *
+ * Parts may arrive in any order. When some are still missing after
+ * CP_RPT_TIMEOUT, the report is requested again within the same session
+ * and the parts already received are ignored.
+ * @return
+ *	0 on success, -1 on error
+ */
+int hpav_read_check_points(faifa_t *faifa, const char *path, int clear)
+{
+	struct cp_session s;
+	u_int8_t frame[ETHER_MAX_LEN];
+	u_int8_t *payload;
+	u_int16_t mmtype;
+	u_int64_t deadline;
+	int tries = 0, n, ret = -1, fd;
+
+	memset(&s, 0, sizeof(s));
+	srandom(getpid());
+	s.session_id = (u_int16_t)random();
+
+	do {
+		if (tries) {
+			if (s.buf && faifa->verbose)
+				cp_dump_missing(&s);
+			faifa_printf(err_stream, "Requesting the check point report again\n");
+		}
+		/* Only clear once the whole buffer made it */
+		if (cp_request(faifa, &s, 0) < 0)
+			goto out;
+
+		deadline = faifa_clock_ms() + CP_RPT_TIMEOUT;
+		while (faifa_clock_ms() < deadline) {
+			n = hpav_recv_mme(faifa, frame, sizeof(frame), &mmtype, &payload, NULL);
+			if (n < 0)
+				goto out;
+			if (mmtype != HPAV_MMTYPE_CP_RPT_IND || n < (int)sizeof(struct check_points_indicate))
+				continue;
+
+			ret = cp_session_add(faifa, &s, (struct check_points_indicate *)payload, n);
+			if (ret < 0)
+				goto out;
+			if (ret)
+				goto complete;
+			ret = -1;
+			deadline = faifa_clock_ms() + CP_RPT_TIMEOUT;
+		}
+	} while (++tries < CP_RPT_RETRIES);
+
+	faifa_set_error(faifa, "Incomplete check point report (%u/%u parts)", s.done, s.num_parts);
+	goto out;
+
+complete:
+	ret = -1;
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		faifa_set_error(faifa, "%s: %s", path, strerror(errno));
+		goto out;
+	}
+	if (write(fd, s.buf, s.length) != (ssize_t)s.length) {
+		faifa_set_error(faifa, "%s: %s", path, strerror(errno));
+		close(fd);
+		goto out;
+	}
+	close(fd);
+
+	faifa_printf(out_stream, "Wrote %u bytes (%u parts) to %s\n", s.length, s.num_parts, path);
+
+	if (clear && cp_request(faifa, &s, 1) < 0)
+		goto out;
+	ret = 0;
+out:
+	cp_session_reset(&s);
+	return ret;
+}
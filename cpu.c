@@ -0,0 +1,126 @@
+/*
+ *  CPU feature detection
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+
+#include <pthread.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+
+/* Missing from older compilers */
+#ifndef bit_AVX2
+#define bit_AVX2	(1 << 5)
+#endif
+#ifndef bit_BMI2
+#define bit_BMI2	(1 << 8)
+#endif
+#ifndef bit_AVX512F
+#define bit_AVX512F	(1 << 16)
+#endif
+#ifndef bit_SHA
+#define bit_SHA		(1 << 29)
+#endif
+#endif
+
+#include "cpu.h"
+
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+static unsigned int cpu_flags;
+
+static void cpu_detect(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int xcr0_lo, xcr0_hi;
+	int ymm = 0, zmm = 0;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return;
+
+	if (ecx & bit_SSSE3)
+		cpu_flags |= CPU_F_SSSE3;
+	if (ecx & bit_SSE4_1)
+		cpu_flags |= CPU_F_SSE41;
+	if (ecx & bit_PCLMUL)
+		cpu_flags |= CPU_F_PCLMUL;
+
+	/* AVX registers are only usable if the OS saves them on context switches */
+	if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)) {
+		__asm__ volatile ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+		ymm = (xcr0_lo & 0x6) == 0x6;
+		zmm = (xcr0_lo & 0xe6) == 0xe6;
+	}
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	if ((ebx & bit_AVX2) && ymm)
+		cpu_flags |= CPU_F_AVX2;
+	if (ebx & bit_BMI2)
+		cpu_flags |= CPU_F_BMI2;
+	if (ebx & bit_SHA)
+		cpu_flags |= CPU_F_SHA;
+	if ((ebx & bit_AVX512F) && zmm)
+		cpu_flags |= CPU_F_AVX512F;
+#endif
+}
+
+/**
+ * cpu_features - return the CPU_F_* features of the running CPU
+ */
+unsigned int cpu_features(void)
+{
+	pthread_once(&cpu_once, cpu_detect);
+
+	return cpu_flags;
+}
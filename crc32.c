@@ -0,0 +1,379 @@
+/*
+ *  CRC-32 (IEEE 802.3) checksums
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define CRC32_HAVE_PCLMUL
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#include "crc32.h"
+#include "cpu.h"
+
+static const uint32_t crc_32_tab[256] = { /* CRC polynomial 0xedb88320 */
+0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
+0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
+0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
+0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
+0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
+0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
+0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
+0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
+0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
+0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
+0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
+0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
+0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
+0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
+0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
+0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
+0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
+0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
+0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
+0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
+0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
+0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
+0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
+0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
+0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
+0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
+0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
+0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
+0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
+0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
+0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
+0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
+0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+};
+
+
+/* crc_32_tab extended for slice-by-8, crc_slice_tab[0] is crc_32_tab */
+static uint32_t crc_slice_tab[8][256];
+
+typedef uint32_t (*crc32_fn)(uint32_t crc, const uint8_t *buf, size_t len);
+
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+static crc32_fn crc32_impl;
+
+static uint32_t crc32_byte(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	for ( ; len; --len, ++buf)
+		crc = crc_32_tab[(crc ^ *buf) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+/**
+ * crc32_slice8 - process 8 bytes per iteration
+ *
+ * Each table lookup accounts for one byte at a different distance from
+ * the end of the 8-byte block, so the eight lookups are independent.
+ */
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	uint32_t lo, hi;
+
+	for ( ; len >= 8; len -= 8, buf += 8) {
+		lo = crc ^ (buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24);
+		hi = buf[4] | buf[5] << 8 | buf[6] << 16 | (uint32_t)buf[7] << 24;
+
+		crc = crc_slice_tab[7][lo & 0xff] ^
+		      crc_slice_tab[6][(lo >> 8) & 0xff] ^
+		      crc_slice_tab[5][(lo >> 16) & 0xff] ^
+		      crc_slice_tab[4][lo >> 24] ^
+		      crc_slice_tab[3][hi & 0xff] ^
+		      crc_slice_tab[2][(hi >> 8) & 0xff] ^
+		      crc_slice_tab[1][(hi >> 16) & 0xff] ^
+		      crc_slice_tab[0][hi >> 24];
+	}
+
+	return crc32_byte(crc, buf, len);
+}
+
+#ifdef CRC32_HAVE_PCLMUL
+/*
+ * Folding constants for the bit-reflected polynomial, from "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction"
+ * (Intel, 2009): x^(4*128+32), x^(4*128-32), x^(128+32), x^(128-32),
+ * x^64 mod P(x), then P(x) and its Barrett constant.
+ */
+static const uint64_t crc_k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+static const uint64_t crc_k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0ULL, 0x00ccaa009eULL };
+static const uint64_t crc_k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124ULL, 0x0000000000ULL };
+static const uint64_t crc_poly[2] __attribute__((aligned(16))) = { 0x01db710641ULL, 0x01f7011641ULL };
+
+/**
+ * crc32_pclmul_fold - fold four 128-bit lanes in parallel
+ * @len:	at least 64 and a multiple of 16
+ */
+__attribute__((target("sse4.1,pclmul")))
+static uint32_t crc32_pclmul_fold(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)crc_k1k2);
+	buf += 64;
+	len -= 64;
+
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		buf += 64;
+		len -= 64;
+	}
+
+	/* Fold the four lanes into one */
+	x0 = _mm_load_si128((const __m128i *)crc_k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* Remaining 16-byte blocks */
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)buf);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		buf += 16;
+		len -= 16;
+	}
+
+	/* 128 to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i *)crc_k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)crc_poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	size_t bulk;
+
+	if (len >= 64) {
+		bulk = len & ~(size_t)15;
+		crc = crc32_pclmul_fold(crc, buf, bulk);
+		buf += bulk;
+		len -= bulk;
+	}
+
+	return crc32_slice8(crc, buf, len);
+}
+#endif
+
+static void crc32_setup(void)
+{
+	unsigned int i, k;
+	uint32_t crc;
+
+	for (i = 0; i < 256; i++)
+		crc_slice_tab[0][i] = crc_32_tab[i];
+	for (k = 1; k < 8; k++) {
+		for (i = 0; i < 256; i++) {
+			crc = crc_slice_tab[k - 1][i];
+			crc_slice_tab[k][i] = (crc >> 8) ^ crc_32_tab[crc & 0xff];
+		}
+	}
+
+	crc32_impl = crc32_slice8;
+#ifdef CRC32_HAVE_PCLMUL
+	if ((cpu_features() & (CPU_F_SSE41 | CPU_F_PCLMUL)) == (CPU_F_SSE41 | CPU_F_PCLMUL))
+		crc32_impl = crc32_pclmul;
+#endif
+}
+
+/**
+ * crc32_set_impl - force an implementation
+ * @return
+ *	0 on success, -1 if @impl is not supported by this CPU
+ */
+int crc32_set_impl(enum crc32_impl impl)
+{
+	pthread_once(&crc32_once, crc32_setup);
+
+	switch (impl) {
+	case CRC32_IMPL_BYTE:
+		crc32_impl = crc32_byte;
+		return 0;
+	case CRC32_IMPL_SLICE8:
+		crc32_impl = crc32_slice8;
+		return 0;
+	case CRC32_IMPL_PCLMUL:
+#ifdef CRC32_HAVE_PCLMUL
+		if ((cpu_features() & (CPU_F_SSE41 | CPU_F_PCLMUL)) == (CPU_F_SSE41 | CPU_F_PCLMUL)) {
+			crc32_impl = crc32_pclmul;
+			return 0;
+		}
+#endif
+		return -1;
+	}
+
+	return -1;
+}
+
+const char *crc32_impl_name(enum crc32_impl impl)
+{
+	switch (impl) {
+	case CRC32_IMPL_BYTE:
+		return "byte";
+	case CRC32_IMPL_SLICE8:
+		return "slice-by-8";
+	case CRC32_IMPL_PCLMUL:
+		return "pclmul";
+	}
+
+	return NULL;
+}
+
+void crc32_init(struct crc32_ctx *ctx)
+{
+	pthread_once(&crc32_once, crc32_setup);
+	ctx->crc = 0xffffffff;
+}
+
+void crc32_update(struct crc32_ctx *ctx, const void *buf, size_t len)
+{
+	ctx->crc = crc32_impl(ctx->crc, buf, len);
+}
+
+uint32_t crc32_final(struct crc32_ctx *ctx)
+{
+	return ctx->crc ^ 0xffffffff;
+}
+
+/**
+ * crc32_raw - register without the final inversion
+ *
+ * This is the checksum the Intellon MMEs carry (WR_MOD, RD_MOD, ST_MAC,
+ * SET_SDRAM): preset to 0xffffffff but not inverted at the end.
+ */
+uint32_t crc32_raw(struct crc32_ctx *ctx)
+{
+	return ctx->crc;
+}
+
+/**
+ * crc32buf - one-shot checksum of a buffer, as sent in the Intellon MMEs
+ *
+ * Returns crc32_raw(), the same value as faifa always computed, and not
+ * the standard CRC-32: use crc32_final() for that.
+ */
+uint32_t crc32buf(const void *buf, size_t len)
+{
+	struct crc32_ctx ctx;
+
+	crc32_init(&ctx);
+	crc32_update(&ctx, buf, len);
+
+	return crc32_raw(&ctx);
+}
@@ -0,0 +1,149 @@
+/*
+ *  CRC-32 implementations benchmark
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc32.h"
+
+#define BENCH_TOTAL	(256 << 20)	/* bytes checksummed per measurement */
+
+/* Keeps the measured loops from being optimized out */
+static volatile uint32_t bench_sink;
+
+static const size_t bench_sizes[] = { 64, 1024, 1518, 64 << 10, 1 << 20 };
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: crc32_bench [options]\n"
+			"-t:	megabytes checksummed per measurement (default: 256)\n"
+			"-h:	this help\n");
+}
+
+int main(int argc, char **argv)
+{
+	size_t total = BENCH_TOTAL, size, done, i;
+	unsigned int s, impl;
+	uint8_t *buf;
+	uint32_t ref, crc;
+	double start, elapsed, base;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "t:h")) > 0) {
+		switch (opt) {
+		case 't':
+			total = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'h':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	buf = malloc(bench_sizes[sizeof(bench_sizes) / sizeof(bench_sizes[0]) - 1]);
+	if (!buf) {
+		perror("malloc");
+		return 1;
+	}
+	srand(time(NULL));
+	for (i = 0; i < bench_sizes[sizeof(bench_sizes) / sizeof(bench_sizes[0]) - 1]; i++)
+		buf[i] = rand();
+
+	fprintf(stdout, "%-8s %-12s %10s %8s\n", "Size", "Method", "MB/s", "Speedup");
+	for (s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+		size = bench_sizes[s];
+		crc32_set_impl(CRC32_IMPL_BYTE);
+		ref = crc32buf(buf, size);
+		base = 0;
+
+		for (impl = CRC32_IMPL_BYTE; impl <= CRC32_IMPL_PCLMUL; impl++) {
+			if (crc32_set_impl(impl) < 0) {
+				fprintf(stdout, "%-8zu %-12s %10s\n", size, crc32_impl_name(impl), "n/a");
+				continue;
+			}
+
+			crc = crc32buf(buf, size);
+			if (crc != ref) {
+				fprintf(stderr, "%s: 0x%08x instead of 0x%08x for %zu bytes\n",
+					crc32_impl_name(impl), crc, ref, size);
+				ret = 1;
+			}
+
+			start = now();
+			for (done = 0; done < total; done += size)
+				crc ^= crc32buf(buf, size);
+			elapsed = now() - start;
+			bench_sink = crc;
+
+			if (impl == CRC32_IMPL_BYTE)
+				base = elapsed;
+			fprintf(stdout, "%-8zu %-12s %10.1f %7.1fx\n", size, crc32_impl_name(impl),
+				done / elapsed / (1 << 20), base / elapsed);
+		}
+	}
+
+	free(buf);
+	return ret;
+}
@@ -51,11 +51,16 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "crypto.h"
+#include "keycache.h"
 #include "sha2.h"
 
 #define HASH_SIZ	SHA256_DIGEST_LENGTH
+#define BATCH_CHUNK	256	/* passphrases hashed together by a thread */
+#define BATCH_PER_THREAD 64	/* minimum passphrases worth a thread */
+#define BATCH_MAX_THREADS 64
 
 unsigned char hash_value[HASH_SIZ];
 
@@ -63,6 +68,28 @@ u_int8_t dak_salt[SALT_SIZ] = {0x08, 0x85, 0x6D, 0xAF, 0x7C, 0xF5, 0x81, 0x85};
 u_int8_t nmk_salt[SALT_SIZ] = {0x08, 0x85, 0x6D, 0xAF, 0x7C, 0xF5, 0x81, 0x86};
 
 
+/**
+ * salt_secret - concatenate a secret of known length and a salt
+ * @secret:	salted secret to fill
+ * @isecret:	initialisation secret
+ * @len:	length of @isecret, at most MAX_SECRET_SIZ
+ * @isalt:	salt to append, may be NULL
+ */
+static void salt_secret(struct salted_secret *secret, const unsigned char *isecret,
+			size_t len, const unsigned char *isalt)
+{
+	memset(secret->value, 0, sizeof(secret->value));
+
+	if (isecret)
+		memcpy(secret->value, isecret, len);
+	secret->len = (u_int8_t)len;
+
+	if (isalt) {
+		memcpy(&secret->value[secret->len], isalt, SALT_SIZ);
+		secret->len += SALT_SIZ;
+	}
+}
+
 /**
  * init_salted_secret - initialise a secret using a salt
  * @secret:	secret to initialise will be modified
@@ -71,75 +98,187 @@ u_int8_t nmk_salt[SALT_SIZ] = {0x08, 0x85, 0x6D, 0xAF, 0x7C, 0xF5, 0x81, 0x86};
  */
 void init_salted_secret(struct salted_secret *secret, const unsigned char *isecret, const unsigned char *isalt)
 {
-	unsigned char l = ' ';
-
-	secret->len = 0;
-	memset(secret->value, 0, sizeof(secret->value));
+	size_t l = ' ';
 
 	if (isecret) {
-		l = (unsigned char)strlen((char *)isecret);
+		l = strlen((char *)isecret);
 		if (l > MAX_SECRET_SIZ)
 			l = MAX_SECRET_SIZ;
-
-		memcpy(secret->value, isecret, l);
 	}
 
+	/* Without a salt the secret is a 16 bytes NMK */
 	if (!isalt)
 		l = 16;
 
-	secret->len = (unsigned char) (secret->len + l);
+	salt_secret(secret, isecret, l, isalt);
+}
 
-	if (isalt) {
-		memcpy(&secret->value[secret->len], (unsigned char*)isalt, SALT_SIZ);
-		secret->len += SALT_SIZ;
+int hpav_derive_key(const u_int8_t *secret, size_t len, const unsigned char *salt,
+		    u_int8_t *key, size_t keylen)
+{
+	SHA256_CTX context;
+	struct salted_secret salted;
+	unsigned char digest[HASH_SIZ];
+
+	if (!key || keylen > HASH_SIZ || len > MAX_SECRET_SIZ)
+		return -1;
+
+	if (!keycache_lookup(secret, len, salt, digest)) {
+		memcpy(key, digest, keylen);
+		return 0;
 	}
+
+	salt_secret(&salted, secret, len, salt);
+
+	SHA256_Init(&context);
+	SHA256_Update(&context, salted.value, salted.len);
+	SHA256_Final(digest, &context);
+
+	/* Do it 998 times as the standard requires it
+	 * or only 4 times if we use the NID */
+	SHA256_Iterate(digest, salt ? 999 : 4);
+
+	keycache_store(secret, len, salt, digest);
+	memcpy(key, digest, keylen);
+
+	return 0;
+}
+
+int gen_dak(const char *password, size_t len, u_int8_t *key, size_t keylen)
+{
+	return hpav_derive_key((const u_int8_t *)password, len, dak_salt, key, keylen);
+}
+
+int gen_nmk(const char *password, size_t len, u_int8_t *key, size_t keylen)
+{
+	return hpav_derive_key((const u_int8_t *)password, len, nmk_salt, key, keylen);
+}
+
+int gen_nid(const u_int8_t *nmk, size_t len, u_int8_t *nid, size_t nidlen)
+{
+	return hpav_derive_key(nmk, len, NULL, nid, nidlen);
 }
 
 /**
  * hash_hpav - hash a secret with a salt as HomePlug AV requires it
  * @isecret:	initialisation secret
  * @salt:	salt to initialise the secret with
+ *
+ * Returns a static buffer, use hpav_derive_key() from several threads.
  */
 const unsigned char* hash_hpav(const unsigned char* isecret, const unsigned char *salt)
 {
-	SHA256_CTX context;
+	size_t len = 16;
+
+	if (salt)
+		len = isecret ? strnlen((const char *)isecret, MAX_SECRET_SIZ) : ' ';
+
+	hpav_derive_key(isecret, len, salt, hash_value, sizeof(hash_value));
+
+	return hash_value;
+}
+
+int gen_passphrase(const char *password, u_int8_t *key, const unsigned char *salt)
+{
+	size_t len = 16;
+
+	/* Never read past the end of the password, nor past MAX_SECRET_SIZ */
+	if (salt)
+		len = strnlen(password, MAX_SECRET_SIZ);
+
+	return hpav_derive_key((const u_int8_t *)password, len, salt, key, 16);
+}
+
+struct batch_job {
+	const char		**passwords;
+	int			n;
+	const unsigned char	*salt;
+	u_int8_t		*keys;
+};
+
+static void *gen_passphrase_job(void *arg)
+{
+	struct batch_job *job = arg;
+	uint8_t digests[BATCH_CHUNK][HASH_SIZ];
+	int misses[BATCH_CHUNK];
 	struct salted_secret secret;
-	int i, max;
+	SHA256_CTX context;
+	const u_int8_t *pw;
+	size_t len;
+	int i, j, count, n;
 
-	/* Null salt is the NetworkID */
-	if (!salt)
-		max = 4;
-	else
-		max = 999;
+	for (i = 0; i < job->n; i += count) {
+		count = job->n - i < BATCH_CHUNK ? job->n - i : BATCH_CHUNK;
 
-	SHA256_Init(&context);
-	memset(hash_value, 0, sizeof(hash_value));
+		/* Only derive the keys missing from the cache */
+		for (j = 0, n = 0; j < count; j++) {
+			pw = (const u_int8_t *)job->passwords[i + j];
+			len = job->salt ? strnlen((const char *)pw, MAX_SECRET_SIZ) : 16;
+			if (!keycache_lookup(pw, len, job->salt, digests[n])) {
+				memcpy(job->keys + (i + j) * 16, digests[n], 16);
+				continue;
+			}
+			init_salted_secret(&secret, pw, job->salt);
+			SHA256_Init(&context);
+			SHA256_Update(&context, secret.value, secret.len);
+			SHA256_Final(digests[n], &context);
+			misses[n++] = i + j;
+		}
 
-	init_salted_secret(&secret, isecret, salt);
-	SHA256_Update(&context, secret.value, secret.len);
-	SHA256_Final(hash_value, &context);
+		/* Same number of rounds as hash_hpav() */
+		SHA256_Iterate_Batch(digests, n, job->salt ? 999 : 4);
 
-	/* Do it 998 times as the standard requires it
-	* or only 4 times if we use the NID */
-	for(i = 0; i < max; i++) {
-		SHA256_Init(&context);
-		SHA256_Update(&context, hash_value, HASH_SIZ);
-		SHA256_Final(hash_value, &context);
+		for (j = 0; j < n; j++) {
+			pw = (const u_int8_t *)job->passwords[misses[j]];
+			len = job->salt ? strnlen((const char *)pw, MAX_SECRET_SIZ) : 16;
+			keycache_store(pw, len, job->salt, digests[j]);
+			memcpy(job->keys + misses[j] * 16, digests[j], 16);
+		}
 	}
 
-	return hash_value;
+	return NULL;
 }
 
-int gen_passphrase(const char *password, u_int8_t *key, const unsigned char *salt)
+int gen_passphrase_batch(const char **passwords, int n, const unsigned char *salt, u_int8_t *keys)
 {
-	u_int8_t password_cpy[MAX_SECRET_SIZ + 1];
-	const unsigned char *password_hash;
+	struct batch_job jobs[BATCH_MAX_THREADS];
+	pthread_t threads[BATCH_MAX_THREADS];
+	long cpus;
+	int num_threads, i, first, started;
+
+	if (n <= 0)
+		return 0;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	num_threads = n / BATCH_PER_THREAD;
+	if (num_threads > cpus)
+		num_threads = cpus;
+	if (num_threads > BATCH_MAX_THREADS)
+		num_threads = BATCH_MAX_THREADS;
+	if (num_threads < 1)
+		num_threads = 1;
+
+	for (i = 0, first = 0; i < num_threads; i++) {
+		jobs[i].passwords = passwords + first;
+		jobs[i].n = n / num_threads + (i < n % num_threads);
+		jobs[i].salt = salt;
+		jobs[i].keys = keys + first * 16;
+		first += jobs[i].n;
+	}
+
+	/* The calling thread takes the first share */
+	for (started = 1; started < num_threads; started++) {
+		if (pthread_create(&threads[started], NULL, gen_passphrase_job, &jobs[started]))
+			break;
+	}
+	gen_passphrase_job(&jobs[0]);
 
-	/* Use a local variable to store the input password */
-	memcpy(password_cpy, password, MAX_SECRET_SIZ);
+	for (i = 1; i < started; i++)
+		pthread_join(threads[i], NULL);
 
-	password_hash = hash_hpav(password_cpy, salt);
-	memcpy(key, password_hash, 16);
+	/* Threads that could not be created: do their share here */
+	for (i = started; i < num_threads; i++)
+		gen_passphrase_job(&jobs[i]);
 
 	return 0;
 }
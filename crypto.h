@@ -53,6 +53,7 @@
 #define __CRYPTO_H__
 
 #include <sys/types.h>
+#include <stddef.h>
 
 #define MAX_SECRET_SIZ	64
 #define SALT_SIZ	8
@@ -83,14 +84,79 @@ struct sha256_ctx {
 };
 
 
+/**
+ * hpav_derive_key - derive a key from a secret, reentrant
+ * @secret:	secret, need not be NUL terminated
+ * @len:	length of @secret, at most MAX_SECRET_SIZ
+ * @salt:	salt type (NMK or DAK), NULL for the 4 rounds NID variant
+ * @key:	buffer receiving the key
+ * @keylen:	bytes of key to store, at most 32
+ *
+ * Uses no global state, so threads may derive keys concurrently.
+ * @return
+ *	0 on success, -1 on invalid lengths
+ */
+extern int hpav_derive_key(const u_int8_t *secret, size_t len, const unsigned char *salt,
+			   u_int8_t *key, size_t keylen);
+
+/**
+ * gen_dak - derive a DAK from a device password, reentrant
+ * @password:	device password
+ * @len:	length of @password
+ * @key:	resulting key
+ * @keylen:	bytes of key to store, 16 for a DAK
+ * @return
+ *	0 on success, -1 on invalid lengths
+ */
+extern int gen_dak(const char *password, size_t len, u_int8_t *key, size_t keylen);
+
+/**
+ * gen_nmk - derive a NMK from a network password, reentrant
+ * @password:	network password
+ * @len:	length of @password
+ * @key:	resulting key
+ * @keylen:	bytes of key to store, 16 for a NMK
+ * @return
+ *	0 on success, -1 on invalid lengths
+ */
+extern int gen_nmk(const char *password, size_t len, u_int8_t *key, size_t keylen);
+
+/**
+ * gen_nid - derive the network identifier hash of a NMK, reentrant
+ * @nmk:	network membership key
+ * @len:	length of @nmk, 16 for a NMK
+ * @nid:	resulting hash
+ * @nidlen:	bytes of hash to store
+ * @return
+ *	0 on success, -1 on invalid lengths
+ */
+extern int gen_nid(const u_int8_t *nmk, size_t len, u_int8_t *nid, size_t nidlen);
+
 /**
  * gen_passphrase - create a hash from a user input passphrase
  * @password:	user input password
  * @key:	resulting key
  * @salt:	salt type (NMK, DAK or NID)
+ *
+ * The password is read up to MAX_SECRET_SIZ bytes. Without a salt it
+ * is taken as a 16 bytes NMK.
  * @return
  *	0 on success, -1 on failure
  */
 extern int gen_passphrase(const char *password, u_int8_t *key, const unsigned char *salt);
 
+/**
+ * gen_passphrase_batch - create the keys of many passphrases at once
+ * @passwords:	user input passwords
+ * @n:		number of passwords
+ * @keys:	resulting keys, 16 bytes per password
+ * @salt:	salt type (NMK, DAK or NID)
+ *
+ * Gives the same keys as gen_passphrase(), hashing several passphrases
+ * per SIMD vector and spreading large batches over all online CPUs.
+ * @return
+ *	0 on success
+ */
+extern int gen_passphrase_batch(const char **passwords, int n, const unsigned char *salt, u_int8_t *keys);
+
 #endif /* __CRYPTO_H__ */
@@ -0,0 +1,321 @@
+/*
+ *  Station index keyed by MAC address and (SNID, TEI)
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+#include <sys/types.h>
+#include <string.h>
+
+#include "faifa.h"
+#include "faifa_compat.h"
+#include "faifa_priv.h"
+#include "device.h"
+
+extern FILE *out_stream;
+
+/*
+ * Stations live in a fixed array; two open-addressing tables with linear
+ * probing map the MAC address and the (SNID, TEI) pair to an array index
+ * (stored as index + 1, 0 marking an empty slot). Entries are removed with
+ * backward shift deletion so that no tombstones are needed.
+ */
+#define DEV_SLOTS	(2 * HPAV_DEVICE_MAX)
+#define DEV_MASK	(DEV_SLOTS - 1)
+
+static struct hpav_device devices[HPAV_DEVICE_MAX];
+static u_int8_t dev_used[HPAV_DEVICE_MAX];
+static u_int16_t mac_slots[DEV_SLOTS];
+static u_int16_t tei_slots[DEV_SLOTS];
+static u_int16_t free_ids[HPAV_DEVICE_MAX];
+static int num_free = -1;
+static u_int64_t next_expire;
+
+static unsigned int hash_mac(const u_int8_t *macaddr)
+{
+	u_int32_t h = 2166136261U;
+	int i;
+
+	for (i = 0; i < ETHER_ADDR_LEN; i++)
+		h = (h ^ macaddr[i]) * 16777619U;
+
+	return (h ^ (h >> 16)) & DEV_MASK;
+}
+
+static unsigned int hash_tei(u_int8_t snid, u_int8_t tei)
+{
+	u_int32_t key = ((snid & 0x0F) << 8) | tei;
+
+	return ((key * 2654435761U) >> 16) & DEV_MASK;
+}
+
+static unsigned int dev_hash(u_int16_t *table, struct hpav_device *dev)
+{
+	if (table == mac_slots)
+		return hash_mac(dev->macaddr);
+
+	return hash_tei(dev->snid, dev->tei);
+}
+
+static void slot_insert(u_int16_t *table, int id)
+{
+	unsigned int i = dev_hash(table, &devices[id]);
+
+	while (table[i])
+		i = (i + 1) & DEV_MASK;
+	table[i] = id + 1;
+}
+
+static void slot_remove(u_int16_t *table, int id)
+{
+	unsigned int i = dev_hash(table, &devices[id]), j, h;
+
+	while (table[i] != id + 1)
+		i = (i + 1) & DEV_MASK;
+
+	/* Move back every following entry whose probe sequence covers the hole */
+	for (j = (i + 1) & DEV_MASK; table[j]; j = (j + 1) & DEV_MASK) {
+		h = dev_hash(table, &devices[table[j] - 1]);
+		if (((j - h) & DEV_MASK) >= ((j - i) & DEV_MASK)) {
+			table[i] = table[j];
+			i = j;
+		}
+	}
+	table[i] = 0;
+}
+
+static struct hpav_device *lookup_mac(u_int8_t *macaddr)
+{
+	unsigned int i = hash_mac(macaddr);
+	struct hpav_device *dev;
+
+	for (; mac_slots[i]; i = (i + 1) & DEV_MASK) {
+		dev = &devices[mac_slots[i] - 1];
+		if (!memcmp(dev->macaddr, macaddr, ETHER_ADDR_LEN))
+			return dev;
+	}
+
+	return NULL;
+}
+
+static struct hpav_device *lookup_tei(u_int8_t snid, u_int8_t tei)
+{
+	unsigned int i = hash_tei(snid, tei);
+	struct hpav_device *dev;
+
+	for (; tei_slots[i]; i = (i + 1) & DEV_MASK) {
+		dev = &devices[tei_slots[i] - 1];
+		if (dev->tei == tei && dev->snid == (snid & 0x0F))
+			return dev;
+	}
+
+	return NULL;
+}
+
+static void device_remove(int id)
+{
+	if (devices[id].tei)
+		slot_remove(tei_slots, id);
+	slot_remove(mac_slots, id);
+	dev_used[id] = 0;
+	free_ids[num_free++] = id;
+}
+
+/**
+ * device_expire - forget the stations which were not reported recently
+ * @now:	current time (ms)
+ */
+static void device_expire(u_int64_t now)
+{
+	int i;
+
+	for (i = 0; i < HPAV_DEVICE_MAX; i++) {
+		if (dev_used[i] && now - devices[i].last_seen > HPAV_DEVICE_AGING)
+			device_remove(i);
+	}
+	next_expire = now + HPAV_DEVICE_AGING / 10;
+}
+
+static int device_alloc(u_int64_t now)
+{
+	int i;
+
+	if (num_free < 0) {
+		for (i = 0; i < HPAV_DEVICE_MAX; i++)
+			free_ids[i] = HPAV_DEVICE_MAX - 1 - i;
+		num_free = HPAV_DEVICE_MAX;
+	}
+
+	if (!num_free)
+		device_expire(now);
+	if (!num_free)
+		return -1;
+
+	return free_ids[--num_free];
+}
+
+static int is_fresh(struct hpav_device *dev)
+{
+	return faifa_clock_ms() - dev->last_seen <= HPAV_DEVICE_AGING;
+}
+
+/**
+ * hpav_device_update - record a station seen in a management message
+ * @macaddr:	station MAC address
+ * @snid:	short network ID, -1 if unknown
+ * @tei:	station TEI in this network, -1 if unknown
+ * @return
+ *	the station entry, NULL if the index is full
+ */
+struct hpav_device *hpav_device_update(u_int8_t *macaddr, int snid, int tei)
+{
+	u_int64_t now = faifa_clock_ms();
+	struct hpav_device *dev, *other;
+	int id;
+
+	if (now >= next_expire)
+		device_expire(now);
+
+	dev = lookup_mac(macaddr);
+	if (!dev) {
+		id = device_alloc(now);
+		if (id < 0)
+			return NULL;
+		dev = &devices[id];
+		memset(dev, 0, sizeof(*dev));
+		memcpy(dev->macaddr, macaddr, ETHER_ADDR_LEN);
+		dev_used[id] = 1;
+		slot_insert(mac_slots, id);
+	}
+	id = dev - devices;
+
+	if (snid >= 0 && tei >= 0 && (dev->snid != (snid & 0x0F) || dev->tei != tei)) {
+		if (dev->tei)
+			slot_remove(tei_slots, id);
+		/* The TEI may still be held by a station which left the network */
+		other = tei ? lookup_tei(snid, tei) : NULL;
+		if (other) {
+			slot_remove(tei_slots, other - devices);
+			other->tei = 0;
+		}
+		dev->snid = snid & 0x0F;
+		dev->tei = tei;
+		if (dev->tei)
+			slot_insert(tei_slots, id);
+	}
+	dev->last_seen = now;
+
+	return dev;
+}
+
+/**
+ * hpav_device_set_sw_version - record the software version of a station
+ * @macaddr:	station MAC address
+ * @version:	version string, not necessarily NUL terminated
+ * @len:	maximum length of the version string
+ */
+void hpav_device_set_sw_version(u_int8_t *macaddr, const char *version, int len)
+{
+	struct hpav_device *dev = hpav_device_update(macaddr, -1, -1);
+	int i;
+
+	if (!dev)
+		return;
+
+	for (i = 0; i < len && i < (int)sizeof(dev->sw_version) - 1 && version[i]; i++)
+		dev->sw_version[i] = version[i];
+	dev->sw_version[i] = '\0';
+}
+
+/**
+ * hpav_device_find_mac - look up a station by MAC address
+ * @macaddr:	station MAC address
+ */
+struct hpav_device *hpav_device_find_mac(u_int8_t *macaddr)
+{
+	struct hpav_device *dev = lookup_mac(macaddr);
+
+	return (dev && is_fresh(dev)) ? dev : NULL;
+}
+
+/**
+ * hpav_device_find_tei - look up a station by TEI
+ * @snid:	short network ID
+ * @tei:	station TEI
+ */
+struct hpav_device *hpav_device_find_tei(u_int8_t snid, u_int8_t tei)
+{
+	struct hpav_device *dev;
+
+	if (!tei)
+		return NULL;
+
+	dev = lookup_tei(snid, tei);
+
+	return (dev && is_fresh(dev)) ? dev : NULL;
+}
+
+/**
+ * dump_device_tei - annotate a TEI with the station MAC and software version
+ * @snid:	short network ID
+ * @tei:	station TEI
+ */
+void dump_device_tei(u_int8_t snid, u_int8_t tei)
+{
+	struct hpav_device *dev = hpav_device_find_tei(snid, tei);
+
+	if (!dev)
+		return;
+
+	faifa_printf(out_stream, " (");
+	dump_hex(dev->macaddr, ETHER_ADDR_LEN, ":");
+	if (dev->sw_version[0])
+		faifa_printf(out_stream, ", %s", dev->sw_version);
+	faifa_printf(out_stream, ")");
+}
@@ -53,24 +53,38 @@
 #define __HPAV_DEVICE_H__
 
 #include <stdio.h>
+#include <sys/types.h>
 #include "homeplug_av.h"
 
 extern int dump_hex(void *buf, int len, char *sep);
 
+/* Maximum number of stations kept in the index */
+#define HPAV_DEVICE_MAX		512
+/* Stations not heard of during this time (ms) are forgotten */
+#define HPAV_DEVICE_AGING	(5 * 60 * 1000)
+
 /**
  * hpav_device - structure which contains useful device informations
- * @name:	name of the device
  * @macaddr:	MAC address of the device
+ * @snid:	short network ID of the network the device belongs to
+ * @tei:	TEI of the device in this network, 0 if unknown
  * @role:	role of the device in the HomePlug AV network
- * @sw_version:	version of the software running on it
- * @next:	pointer to a hpav_device structure
+ * @sw_version:	version of the software running on it, empty if unknown
+ * @last_seen:	last time the device was reported (ms)
  */
 struct hpav_device {
-	char 		*name; 		/* Device name, if any */
 	u_int8_t	macaddr[6];	/* MAC address of the device */
+	u_int8_t	snid;		/* Short network ID */
+	u_int8_t	tei;		/* Terminal equipment ID */
 	enum sta_role	role;		/* Device role in the network */
-	char		*sw_version;	/* Software version of the device */
-	struct		hpav_device *next;
+	char		sw_version[65];	/* Software version of the device */
+	u_int64_t	last_seen;	/* Last time the device was reported */
 };
 
+extern struct hpav_device *hpav_device_update(u_int8_t *macaddr, int snid, int tei);
+extern void hpav_device_set_sw_version(u_int8_t *macaddr, const char *version, int len);
+extern struct hpav_device *hpav_device_find_mac(u_int8_t *macaddr);
+extern struct hpav_device *hpav_device_find_tei(u_int8_t snid, u_int8_t tei);
+extern void dump_device_tei(u_int8_t snid, u_int8_t tei);
+
 #endif /* __HPAV_DEVICE_H__ */
@@ -66,6 +66,7 @@
 #include "faifa_compat.h"
 #include "faifa_priv.h"
 #include "homeplug_av.h"
+#include "mme.h"
 
 void faifa_set_error(faifa_t *faifa, char *format, ...)
 {
@@ -111,6 +112,32 @@ char *faifa_error(faifa_t *faifa)
 }
 
 
+#ifndef __CYGWIN__
+/*
+ * pcap_open_live() with immediate mode: frames are handed out as they
+ * arrive, not once a buffer block fills or the read timeout fires.
+ */
+static pcap_t *faifa_open_immediate(char *name, int snaplen, char *errbuf)
+{
+	pcap_t *p;
+
+	p = pcap_create(name, errbuf);
+	if (p == NULL)
+		return NULL;
+
+	if (pcap_set_snaplen(p, snaplen) || pcap_set_promisc(p, 1) ||
+	    pcap_set_timeout(p, 100) || pcap_set_immediate_mode(p, 1) ||
+	    pcap_activate(p) < 0) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", pcap_geterr(p));
+		pcap_close(p);
+		return NULL;
+	}
+
+	return p;
+}
+#endif
+
+
 int faifa_open(faifa_t *faifa, char *name)
 {
 	char pcap_errbuf[PCAP_ERRBUF_SIZE];
@@ -128,7 +155,10 @@ int faifa_open(faifa_t *faifa, char *name)
 	}
 
 	/* Use open_live on Unixes */
-	faifa->pcap = pcap_open_live(name, pcap_snaplen, 1, 100, pcap_errbuf);
+	if (faifa->immediate)
+		faifa->pcap = faifa_open_immediate(name, pcap_snaplen, pcap_errbuf);
+	else
+		faifa->pcap = pcap_open_live(name, pcap_snaplen, 1, 100, pcap_errbuf);
 #else
 	pcap_if_t *alldevs;
 	pcap_if_t *d;
@@ -243,6 +273,54 @@ int faifa_send(faifa_t *faifa, void *buf, int len)
 }
 
 
+int faifa_sendv(faifa_t *faifa, const void *hdr, size_t hdrlen, const u_int8_t *oui,
+		const struct iovec *iov, int iovcnt)
+{
+#ifdef __linux__
+	ssize_t n;
+
+	/* libpcap injects with send() on its bound packet socket, so can we */
+	n = mme_sendv(pcap_fileno(faifa->pcap), NULL, 0, hdr, hdrlen, oui,
+		      iov, iovcnt, ETH_ZLEN);
+	if (n < 0) {
+		faifa_set_error(faifa, "sendmsg: %s", strerror(errno));
+		return -1;
+	}
+
+	return n;
+#else
+	u_int8_t frame_buf[ETHER_MAX_LEN];
+	size_t n = hdrlen;
+	int i;
+
+	/* No gather write through pcap: build the frame in place */
+	if (hdrlen > sizeof(frame_buf) - 3) {
+		faifa_set_error(faifa, "MME too long");
+		return -1;
+	}
+	memcpy(frame_buf, hdr, hdrlen);
+	if (oui) {
+		memcpy(frame_buf + n, oui, 3);
+		n += 3;
+	}
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > sizeof(frame_buf) - n) {
+			faifa_set_error(faifa, "MME too long");
+			return -1;
+		}
+		memcpy(frame_buf + n, iov[i].iov_base, iov[i].iov_len);
+		n += iov[i].iov_len;
+	}
+	if (n < ETH_ZLEN) {
+		memset(frame_buf + n, 0, ETH_ZLEN - n);
+		n = ETH_ZLEN;
+	}
+
+	return faifa_send(faifa, frame_buf, n);
+#endif
+}
+
+
 typedef struct faifa_loop_data {
 	faifa_t *faifa;
 	faifa_loop_handler_t handler;
@@ -267,6 +345,11 @@ int faifa_loop(faifa_t *faifa, faifa_loop_handler_t handler, void *user)
 	return n;
 }
 
+void faifa_breakloop(faifa_t *faifa)
+{
+	pcap_breakloop(faifa->pcap);
+}
+
 
 int faifa_close(faifa_t *faifa)
 {
@@ -360,3 +443,8 @@ void faifa_set_verbose(faifa_t *faifa, int verbose)
 {
 	faifa->verbose = verbose;
 }
+
+void faifa_set_immediate(faifa_t *faifa, int immediate)
+{
+	faifa->immediate = immediate;
+}
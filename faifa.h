@@ -53,6 +53,7 @@
 #define __FAIFA_H__
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #define FAIFA_VERSION_MAJOR 0
 #define FAIFA_VERSION_MINOR 1
@@ -117,6 +118,20 @@ extern int faifa_close(faifa_t *faifa);
  */
 extern int faifa_send(faifa_t *faifa, void *buf, int len);
 
+/**
+ * faifa_sendv - send a MME without copying its payload
+ * @faifa: private handle
+ * @hdr: Ethernet and MM headers, up to the OUI
+ * @hdrlen: length of @hdr
+ * @oui: vendor OUI (3 bytes), NULL if @hdr holds it or for public MMEs
+ * @iov: payload pieces
+ * @iovcnt: number of @iov entries, at most 8
+ * @return
+ *	number of bytes sent on success, -1 on error
+ */
+extern int faifa_sendv(faifa_t *faifa, const void *hdr, size_t hdrlen, const u_int8_t *oui,
+		       const struct iovec *iov, int iovcnt);
+
 /**
  * faifa_recv - receive raw ethernet frame
  * @faifa: private handle
@@ -142,6 +157,12 @@ typedef void (*faifa_loop_handler_t)(faifa_t *faifa, void *buf, int len, void *u
  */
 extern int faifa_loop(faifa_t *faifa, faifa_loop_handler_t handler, void *user);
 
+/**
+ * faifa_breakloop - make faifa_loop return, may be called from another thread
+ * @faifa: private handle
+ */
+extern void faifa_breakloop(faifa_t *faifa);
+
 
 extern int faifa_sprint_hex(char *str, void *buf, int len, char *sep);
 
@@ -170,6 +191,16 @@ extern void faifa_set_dst_addr(faifa_t *faifa, const u_int8_t *addr);
  */
 extern void faifa_set_verbose(faifa_t *faifa, int verbose);
 
+/**
+ * faifa_set_immediate - deliver frames as soon as they arrive
+ * @faifa: private handle
+ * @immediate: non zero to open the capture in immediate mode
+ *
+ * Must be called before faifa_open. Without it, the capture may hold
+ * frames back until its buffer fills or its 100 ms timeout fires.
+ */
+extern void faifa_set_immediate(faifa_t *faifa, int immediate);
+
 static inline int faifa_is_zero_ether_addr(const u_int8_t *addr)
 {
 	return !(addr[0] | addr[1] | addr[2] | addr[3] | addr[4] | addr[5]);
@@ -0,0 +1,819 @@
+/*
+ *  End-to-end MME load generator and latency benchmark
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <net/ethernet.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "faifa.h"
+#include "faifa_compat.h"
+#include "faifa_priv.h"
+#include "frame.h"
+#include "homeplug_av.h"
+#include "endian.h"
+
+#ifndef GIT_REV
+#define GIT_REV "unknown"
+#endif
+
+extern FILE *err_stream;
+extern FILE *out_stream;
+
+#define BENCH_MAX_WINDOW	65536
+#define BENCH_WINDOW		64	/* default requests in flight */
+#define BENCH_DURATION		10	/* default seconds of load */
+#define BENCH_TIMEOUT		500	/* default ms before a request counts as lost */
+#define BENCH_MEM_SPAN		(1 << 20)	/* SDRAM range read by the rdmem MMEs */
+#define BENCH_PIB_SPAN		(16 << 10)	/* PIB range read by the rdmod MMEs */
+#define BENCH_CHUNK		1024
+
+struct bench;
+
+/**
+ * bench_op - MME the benchmark can send
+ * @name:	name used in the mix and the reports
+ * @mmtype:	request MM type, the confirm is @mmtype + 1
+ * @fill:	writes the request payload and its matching key, returns its length
+ * @key:	extracts the matching key of a confirm, NULL if confirms have none
+ */
+struct bench_op {
+	const char	*name;
+	u_int16_t	mmtype;
+	int		(*fill)(struct bench *b, unsigned int station, u_int8_t *payload,
+				u_int32_t *key);
+	int		(*key)(const u_int8_t *payload, int len, u_int32_t *key);
+};
+
+/**
+ * bench_slot - request in flight
+ * @op:		index of its operation, -1 when the slot is free
+ * @station:	index of the station it went to
+ * @key:	value its confirm echoes, for the operations that have one
+ * @sent:	time it was sent, in ns
+ */
+struct bench_slot {
+	int		op;
+	unsigned int	station;
+	u_int32_t	key;
+	u_int64_t	sent;
+};
+
+/**
+ * bench_lat - latencies of the completed requests of an operation
+ * @us:		latencies in us
+ * @count:	number of @us
+ * @alloc:	entries allocated at @us
+ */
+struct bench_lat {
+	u_int32_t	*us;
+	size_t		count;
+	size_t		alloc;
+};
+
+/**
+ * bench - benchmark state, shared by the sender and the receiver
+ * @lock:	protects the slots and the counters
+ * @cond:	signaled when a slot gets free
+ * @base:	MAC address of the first station
+ * @num_stations: stations the requests are spread over
+ * @weights:	weight of each operation in the mix
+ * @total_weight: sum of @weights
+ * @rate:	offered requests per second, 0 for a closed loop
+ * @window:	most requests in flight
+ * @timeout:	ns before a request counts as lost
+ * @slots:	requests in flight
+ * @in_flight:	used @slots
+ * @sent:	requests sent
+ * @timeouts:	requests that got no confirm in time
+ * @unmatched:	confirms matching no request in flight (late or stray)
+ * @overflow:	open loop requests not sent because the window was full
+ * @errors:	requests that could not be sent
+ * @lat:	latencies of each operation
+ * @seq:	requests built so far, spreads them over stations and addresses
+ * @seed:	state of the operation picker
+ * @stop:	tells the receiver to exit, or the sender that the receiver failed
+ */
+struct bench {
+	faifa_t			*faifa;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	u_int8_t		base[ETHER_ADDR_LEN];
+	unsigned int		num_stations;
+	unsigned int		*weights;
+	unsigned int		total_weight;
+	double			rate;
+	unsigned int		window;
+	u_int64_t		timeout;
+	struct bench_slot	*slots;
+	unsigned int		in_flight;
+	u_int64_t		sent;
+	u_int64_t		timeouts;
+	u_int64_t		unmatched;
+	u_int64_t		overflow;
+	u_int64_t		errors;
+	struct bench_lat	*lat;
+	unsigned int		seq;
+	unsigned int		seed;
+	volatile int		stop;
+};
+
+static void bench_station_mac(struct bench *b, unsigned int station, u_int8_t *mac)
+{
+	u_int64_t m = 0;
+	int i;
+
+	for (i = 0; i < ETHER_ADDR_LEN; i++)
+		m = (m << 8) | b->base[i];
+	m += station;
+	for (i = ETHER_ADDR_LEN - 1; i >= 0; i--, m >>= 8)
+		mac[i] = m;
+}
+
+static int bench_fill_none(struct bench *b, unsigned int station, u_int8_t *payload,
+			   u_int32_t *key)
+{
+	return 0;
+}
+
+/* Statistics of the link to the next station */
+static int bench_fill_stats(struct bench *b, unsigned int station, u_int8_t *payload,
+			    u_int32_t *key)
+{
+	struct link_statistics_request *req = (struct link_statistics_request *)payload;
+
+	memset(req, 0, sizeof(*req));
+	req->direction = HPAV_SD_BOTH;
+	bench_station_mac(b, station + 1, req->macaddr);
+
+	return sizeof(*req);
+}
+
+static int bench_fill_rdmem(struct bench *b, unsigned int station, u_int8_t *payload,
+			    u_int32_t *key)
+{
+	struct read_mac_memory_request *req = (struct read_mac_memory_request *)payload;
+
+	*key = (b->seq * BENCH_CHUNK) % BENCH_MEM_SPAN;
+	req->address = STORE32_LE(*key);
+	req->length = STORE32_LE(BENCH_CHUNK);
+
+	return sizeof(*req);
+}
+
+static int bench_key_rdmem(const u_int8_t *payload, int len, u_int32_t *key)
+{
+	const struct read_mac_memory_confirm *cnf = (const struct read_mac_memory_confirm *)payload;
+
+	if (len < (int)sizeof(*cnf))
+		return -1;
+	*key = STORE32_LE(cnf->address);
+
+	return 0;
+}
+
+static int bench_fill_rdmod(struct bench *b, unsigned int station, u_int8_t *payload,
+			    u_int32_t *key)
+{
+	struct read_mod_data_request *req = (struct read_mod_data_request *)payload;
+
+	*key = (b->seq * BENCH_CHUNK) % BENCH_PIB_SPAN;
+	memset(req, 0, sizeof(*req));
+	req->module_id = PIB;
+	req->length = STORE16_LE(BENCH_CHUNK);
+	req->offset = STORE32_LE(*key);
+
+	return sizeof(*req);
+}
+
+static int bench_key_rdmod(const u_int8_t *payload, int len, u_int32_t *key)
+{
+	const struct read_mod_data_confirm *cnf = (const struct read_mod_data_confirm *)payload;
+
+	if (len < (int)sizeof(*cnf))
+		return -1;
+	*key = STORE32_LE(cnf->offset);
+
+	return 0;
+}
+
+static const struct bench_op bench_ops[] = {
+	{ "sw", HPAV_MMTYPE_GET_SW_REQ, bench_fill_none, NULL },
+	{ "nw", HPAV_MMTYPE_NW_INFO_REQ, bench_fill_none, NULL },
+	{ "stats", HPAV_MMTYPE_LNK_STATS_REQ, bench_fill_stats, NULL },
+	{ "rdmem", HPAV_MMTYPE_RD_MEM_REQ, bench_fill_rdmem, bench_key_rdmem },
+	{ "rdmod", HPAV_MMTYPE_RD_MOD_REQ, bench_fill_rdmod, bench_key_rdmod },
+};
+
+#define BENCH_NUM_OPS	(sizeof(bench_ops) / sizeof(bench_ops[0]))
+
+static u_int64_t bench_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * bench_parse_mix - parse a "name=weight,..." operation mix
+ * @return
+ *	0 on success, -1 on error
+ */
+static int bench_parse_mix(struct bench *b, const char *mix)
+{
+	char *dup, *tok, *save, *eq, *end;
+	unsigned long w;
+	unsigned int i;
+	int ret = -1;
+
+	dup = strdup(mix);
+	if (!dup)
+		return -1;
+
+	memset(b->weights, 0, BENCH_NUM_OPS * sizeof(*b->weights));
+	for (tok = strtok_r(dup, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		w = 1;
+		eq = strchr(tok, '=');
+		if (eq) {
+			*eq++ = '\0';
+			w = strtoul(eq, &end, 0);
+			if (*end || !w || w > 1000) {
+				fprintf(stderr, "invalid weight: %s\n", eq);
+				goto out;
+			}
+		}
+		for (i = 0; i < BENCH_NUM_OPS; i++)
+			if (!strcmp(bench_ops[i].name, tok))
+				break;
+		if (i == BENCH_NUM_OPS) {
+			fprintf(stderr, "unknown MME: %s\n", tok);
+			goto out;
+		}
+		b->weights[i] += w;
+	}
+
+	b->total_weight = 0;
+	for (i = 0; i < BENCH_NUM_OPS; i++)
+		b->total_weight += b->weights[i];
+	if (b->total_weight)
+		ret = 0;
+out:
+	free(dup);
+	return ret;
+}
+
+static int bench_pick_op(struct bench *b)
+{
+	unsigned int r = rand_r(&b->seed) % b->total_weight;
+	unsigned int i;
+
+	for (i = 0; r >= b->weights[i]; i++)
+		r -= b->weights[i];
+
+	return i;
+}
+
+static void bench_record(struct bench *b, int op, u_int64_t ns)
+{
+	struct bench_lat *l = &b->lat[op];
+	u_int32_t *us;
+
+	if (l->count == l->alloc) {
+		l->alloc = l->alloc ? l->alloc * 2 : 4096;
+		us = realloc(l->us, l->alloc * sizeof(*us));
+		if (!us) {
+			l->alloc = l->count;
+			return;
+		}
+		l->us = us;
+	}
+	l->us[l->count++] = ns / 1000;
+}
+
+/* Called with the lock held */
+static void bench_release(struct bench *b, struct bench_slot *s)
+{
+	s->op = -1;
+	b->in_flight--;
+	pthread_cond_signal(&b->cond);
+}
+
+static void bench_expire(struct bench *b, u_int64_t now)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->window; i++) {
+		if (b->slots[i].op >= 0 && now - b->slots[i].sent > b->timeout) {
+			bench_release(b, &b->slots[i]);
+			b->timeouts++;
+		}
+	}
+}
+
+/*
+ * MMEs carry no transaction ID: a confirm completes the oldest request
+ * of its type sent to the station it comes from, with the same address
+ * or offset for the reads. With a single station, the source address is
+ * not checked, so that the Intellon local address can be used.
+ */
+static void bench_complete(struct bench *b, u_int16_t mmtype, const u_int8_t *sa,
+			   const u_int8_t *payload, int len, u_int64_t now)
+{
+	struct bench_slot *s, *oldest = NULL;
+	u_int64_t station = 0, base = 0, mac = 0;
+	u_int32_t key = 0;
+	int has_key = 0;
+	unsigned int i;
+
+	for (i = 0; i < ETHER_ADDR_LEN; i++) {
+		base = (base << 8) | b->base[i];
+		mac = (mac << 8) | sa[i];
+	}
+	if (b->num_stations > 1) {
+		station = mac - base;
+		if (mac < base || station >= b->num_stations) {
+			b->unmatched++;
+			return;
+		}
+	}
+
+	for (i = 0; i < b->window; i++) {
+		s = &b->slots[i];
+		if (s->op < 0 || bench_ops[s->op].mmtype + 1 != mmtype ||
+		    (b->num_stations > 1 && s->station != station))
+			continue;
+		if (bench_ops[s->op].key && !has_key) {
+			if (bench_ops[s->op].key(payload, len, &key))
+				break;
+			has_key = 1;
+		}
+		if (has_key && s->key != key)
+			continue;
+		if (!oldest || s->sent < oldest->sent)
+			oldest = s;
+	}
+
+	if (!oldest) {
+		b->unmatched++;
+		return;
+	}
+
+	bench_record(b, oldest->op, now - oldest->sent);
+	bench_release(b, oldest);
+}
+
+static void *bench_receiver(void *arg)
+{
+	struct bench *b = arg;
+	u_int8_t frame[ETHER_MAX_LEN];
+	u_int8_t sa[ETHER_ADDR_LEN];
+	u_int8_t *payload;
+	u_int16_t mmtype;
+	u_int64_t now;
+	int n;
+
+	while (!b->stop) {
+		n = hpav_recv_mme(b->faifa, frame, sizeof(frame), &mmtype, &payload, sa);
+		now = bench_clock_ns();
+		if (n < 0) {
+			fprintf(stderr, "%s\n", faifa_error(b->faifa));
+			/* Nothing completes requests anymore, do not let the sender wait */
+			pthread_mutex_lock(&b->lock);
+			b->stop = 1;
+			pthread_cond_broadcast(&b->cond);
+			pthread_mutex_unlock(&b->lock);
+			break;
+		}
+
+		/* Late confirms must not complete requests that already timed out */
+		pthread_mutex_lock(&b->lock);
+		bench_expire(b, now);
+		if (n > 0 && (mmtype & 3) == 1)
+			bench_complete(b, mmtype, sa, payload, n, now);
+		pthread_mutex_unlock(&b->lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * bench_send - send one request of the mix
+ * @wait:	wait for a free slot (closed loop) rather than give up
+ */
+static void bench_send(struct bench *b, int wait)
+{
+	u_int8_t payload[ETH_DATA_LEN];
+	u_int8_t da[ETHER_ADDR_LEN];
+	struct bench_slot *s = NULL;
+	unsigned int station, i;
+	u_int32_t key = 0;
+	int op, len;
+
+	pthread_mutex_lock(&b->lock);
+	while (b->in_flight == b->window) {
+		if (!wait || b->stop) {
+			b->overflow += !b->stop;
+			pthread_mutex_unlock(&b->lock);
+			return;
+		}
+		pthread_cond_wait(&b->cond, &b->lock);
+	}
+	for (i = 0; i < b->window; i++) {
+		if (b->slots[i].op < 0) {
+			s = &b->slots[i];
+			break;
+		}
+	}
+
+	op = bench_pick_op(b);
+	station = b->seq % b->num_stations;
+	len = bench_ops[op].fill(b, station, payload, &key);
+	b->seq++;
+
+	s->op = op;
+	s->station = station;
+	s->key = key;
+	s->sent = bench_clock_ns();
+	b->in_flight++;
+	b->sent++;
+	pthread_mutex_unlock(&b->lock);
+
+	bench_station_mac(b, station, da);
+	if (hpav_send_mme(b->faifa, bench_ops[op].mmtype, da, payload, len) < 0) {
+		pthread_mutex_lock(&b->lock);
+		if (s->op == op) {
+			bench_release(b, s);
+			b->errors++;
+		}
+		pthread_mutex_unlock(&b->lock);
+	}
+}
+
+static void bench_run(struct bench *b, u_int64_t duration)
+{
+	u_int64_t start, end, next, interval = 0, now;
+	struct timespec ts;
+
+	start = bench_clock_ns();
+	end = start + duration;
+	if (b->rate > 0)
+		interval = 1e9 / b->rate;
+
+	next = start;
+	while (!b->stop && (now = bench_clock_ns()) < end) {
+		if (!interval) {
+			bench_send(b, 1);
+			continue;
+		}
+
+		/* Catch up with the schedule, then sleep until the next request is due */
+		while (!b->stop && next <= now) {
+			bench_send(b, 0);
+			next += interval;
+		}
+		ts.tv_sec = next / 1000000000;
+		ts.tv_nsec = next % 1000000000;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+
+	/* Let the last requests complete or time out */
+	pthread_mutex_lock(&b->lock);
+	while (b->in_flight && !b->stop)
+		pthread_cond_wait(&b->cond, &b->lock);
+	pthread_mutex_unlock(&b->lock);
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	u_int32_t x = *(const u_int32_t *)a, y = *(const u_int32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * bench_summary - latency distribution of a set of samples
+ */
+struct bench_summary {
+	size_t		count;
+	double		mean;
+	u_int32_t	p50;
+	u_int32_t	p99;
+	u_int32_t	p999;
+	u_int32_t	max;
+};
+
+static u_int32_t bench_percentile(const u_int32_t *us, size_t count, double p)
+{
+	size_t i = (size_t)(p * count);
+
+	return i < count ? us[i] : us[count - 1];
+}
+
+/* Sorts @us in place */
+static void bench_summarize(u_int32_t *us, size_t count, struct bench_summary *sum)
+{
+	double total = 0;
+	size_t i;
+
+	memset(sum, 0, sizeof(*sum));
+	sum->count = count;
+	if (!count)
+		return;
+
+	qsort(us, count, sizeof(*us), bench_cmp);
+	for (i = 0; i < count; i++)
+		total += us[i];
+	sum->mean = total / count;
+	sum->p50 = bench_percentile(us, count, 0.50);
+	sum->p99 = bench_percentile(us, count, 0.99);
+	sum->p999 = bench_percentile(us, count, 0.999);
+	sum->max = us[count - 1];
+}
+
+static double bench_cpu_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	return ru.ru_utime.tv_sec * 1e6 + ru.ru_utime.tv_usec +
+	       ru.ru_stime.tv_sec * 1e6 + ru.ru_stime.tv_usec;
+}
+
+static void bench_report(struct bench *b, const char *iface, double seconds, double cpu_us,
+			 int json)
+{
+	struct bench_summary sum, op_sum[BENCH_NUM_OPS];
+	const char *sep = "";
+	u_int32_t *all;
+	size_t count = 0;
+	unsigned int i;
+	double tps, cpu;
+
+	for (i = 0; i < BENCH_NUM_OPS; i++)
+		count += b->lat[i].count;
+	all = malloc((count ? count : 1) * sizeof(*all));
+	if (!all) {
+		perror("malloc");
+		return;
+	}
+	count = 0;
+	for (i = 0; i < BENCH_NUM_OPS; i++) {
+		memcpy(all + count, b->lat[i].us, b->lat[i].count * sizeof(*all));
+		count += b->lat[i].count;
+		bench_summarize(b->lat[i].us, b->lat[i].count, &op_sum[i]);
+	}
+	bench_summarize(all, count, &sum);
+	free(all);
+
+	tps = sum.count / seconds;
+	cpu = sum.count ? cpu_us / sum.count : 0;
+
+	if (json) {
+		printf("{\"version\":\"%s\",\"interface\":\"%s\",\"mode\":\"%s\","
+		       "\"capture\":\"immediate\","
+		       "\"offered_rate\":%.0f,\"window\":%u,\"stations\":%u,\"duration_s\":%.3f,"
+		       "\"sent\":%" PRIu64 ",\"completed\":%zu,\"timeouts\":%" PRIu64 ","
+		       "\"unmatched\":%" PRIu64 ",\"overflow\":%" PRIu64 ",\"errors\":%" PRIu64 ","
+		       "\"throughput_tps\":%.1f,\"cpu_us_per_txn\":%.2f,"
+		       "\"latency_us\":{\"mean\":%.1f,\"p50\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u},"
+		       "\"ops\":[",
+		       GIT_REV, iface, b->rate > 0 ? "open" : "closed",
+		       b->rate, b->window, b->num_stations, seconds,
+		       b->sent, sum.count, b->timeouts, b->unmatched, b->overflow, b->errors,
+		       tps, cpu, sum.mean, sum.p50, sum.p99, sum.p999, sum.max);
+		for (i = 0; i < BENCH_NUM_OPS; i++) {
+			if (!b->weights[i])
+				continue;
+			printf("%s{\"name\":\"%s\",\"completed\":%zu,\"p50\":%u,\"p99\":%u,\"p999\":%u}",
+			       sep, bench_ops[i].name,
+			       op_sum[i].count, op_sum[i].p50, op_sum[i].p99, op_sum[i].p999);
+			sep = ",";
+		}
+		printf("]}\n");
+		return;
+	}
+
+	printf("%s loop, immediate-mode capture, %u stations, %.1f s: %" PRIu64 " sent, %zu completed, %" PRIu64 " timeouts, "
+	       "%" PRIu64 " unmatched, %" PRIu64 " overflows, %" PRIu64 " errors\n",
+	       b->rate > 0 ? "open" : "closed", b->num_stations, seconds,
+	       b->sent, sum.count, b->timeouts, b->unmatched, b->overflow, b->errors);
+	printf("%.1f transactions/s, %.2f us CPU per transaction\n", tps, cpu);
+	printf("%-8s %10s %8s %8s %8s %8s %8s\n", "MME", "completed", "mean", "p50", "p99", "p999", "max");
+	for (i = 0; i < BENCH_NUM_OPS; i++) {
+		if (!b->weights[i])
+			continue;
+		printf("%-8s %10zu %8.0f %8u %8u %8u %8u\n", bench_ops[i].name, op_sum[i].count,
+		       op_sum[i].mean, op_sum[i].p50, op_sum[i].p99, op_sum[i].p999, op_sum[i].max);
+	}
+	printf("%-8s %10zu %8.0f %8u %8u %8u %8u\n", "all", sum.count,
+	       sum.mean, sum.p50, sum.p99, sum.p999, sum.max);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: faifa-bench [options] -i interface\n"
+			"-i:	network interface\n"
+			"-a:	MAC address of the (first) station (default 00:b0:52:00:00:01)\n"
+			"-n:	stations to spread the requests over, with consecutive MAC addresses (default 1)\n"
+			"-m:	MME mix as name[=weight],... of sw, nw, stats, rdmem, rdmod (default sw)\n"
+			"-r:	offered requests per second, 0 for a closed loop (default 0)\n"
+			"-w:	most requests in flight (default %d)\n"
+			"-d:	seconds of load (default %d)\n"
+			"-t:	ms before a request counts as lost (default %d)\n"
+			"-S:	random seed of the mix (default 1)\n"
+			"-j:	JSON report\n"
+			"-h:	this help\n",
+			BENCH_WINDOW, BENCH_DURATION, BENCH_TIMEOUT);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int weights[BENCH_NUM_OPS];
+	struct bench_lat lat[BENCH_NUM_OPS];
+	const char *mix = "sw";
+	char *iface = NULL;
+	unsigned int duration = BENCH_DURATION, timeout = BENCH_TIMEOUT, i;
+	double start, elapsed, cpu;
+	pthread_t receiver;
+	struct bench b;
+	int opt, json = 0, ret = 1;
+
+	memset(&b, 0, sizeof(b));
+	memset(lat, 0, sizeof(lat));
+	b.weights = weights;
+	b.lat = lat;
+	b.num_stations = 1;
+	b.window = BENCH_WINDOW;
+	b.seed = 1;
+	memcpy(b.base, "\x00\xb0\x52\x00\x00\x01", ETHER_ADDR_LEN);
+
+	out_stream = stdout;
+	err_stream = stderr;
+
+	b.faifa = faifa_init();
+	if (!b.faifa) {
+		fprintf(stderr, "Can't initialize Faifa library\n");
+		return 1;
+	}
+
+	while ((opt = getopt(argc, argv, "i:a:n:m:r:w:d:t:S:jh")) > 0) {
+		switch (opt) {
+		case 'i':
+			iface = optarg;
+			break;
+		case 'a':
+			if (faifa_parse_mac_addr(b.faifa, optarg, b.base)) {
+				fprintf(stderr, "invalid MAC address: %s\n", optarg);
+				goto out_free;
+			}
+			break;
+		case 'n':
+			b.num_stations = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			mix = optarg;
+			break;
+		case 'r':
+			b.rate = strtod(optarg, NULL);
+			break;
+		case 'w':
+			b.window = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			duration = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			timeout = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			b.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 'h':
+		default:
+			usage();
+			goto out_free;
+		}
+	}
+
+	if (!iface || !b.num_stations || !b.window || b.window > BENCH_MAX_WINDOW ||
+	    !duration || !timeout || b.rate < 0) {
+		usage();
+		goto out_free;
+	}
+	if (bench_parse_mix(&b, mix))
+		goto out_free;
+	b.timeout = timeout * 1000000ULL;
+
+	b.slots = malloc(b.window * sizeof(*b.slots));
+	if (!b.slots) {
+		perror("malloc");
+		goto out_free;
+	}
+	for (i = 0; i < b.window; i++)
+		b.slots[i].op = -1;
+
+	/* Latencies must not include up to 100 ms of capture buffering */
+	faifa_set_immediate(b.faifa, 1);
+	if (faifa_open(b.faifa, iface) == -1) {
+		fprintf(stderr, "%s\n", faifa_error(b.faifa));
+		goto out_slots;
+	}
+
+	pthread_mutex_init(&b.lock, NULL);
+	pthread_cond_init(&b.cond, NULL);
+	if (pthread_create(&receiver, NULL, bench_receiver, &b)) {
+		fprintf(stderr, "Can't create the receive thread\n");
+		goto out_close;
+	}
+
+	cpu = bench_cpu_us();
+	start = bench_clock_ns() / 1e9;
+	bench_run(&b, duration * 1000000000ULL);
+	elapsed = bench_clock_ns() / 1e9 - start;
+	cpu = bench_cpu_us() - cpu;
+
+	/* Already set if the receiver failed, report what was measured anyway */
+	ret = b.stop ? 1 : 0;
+	b.stop = 1;
+	pthread_join(receiver, NULL);
+
+	bench_report(&b, iface, elapsed, cpu, json);
+
+out_close:
+	faifa_close(b.faifa);
+	pthread_cond_destroy(&b.cond);
+	pthread_mutex_destroy(&b.lock);
+out_slots:
+	free(b.slots);
+	for (i = 0; i < BENCH_NUM_OPS; i++)
+		free(lat[i].us);
+out_free:
+	faifa_free(b.faifa);
+	return ret;
+}
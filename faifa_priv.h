@@ -54,6 +54,7 @@
 
 #include <sys/socket.h>
 #include <net/if.h>
+#include <time.h>
 #include <pcap.h>
 #ifdef DARWIN
 #include <sys/ioctl.h>
@@ -82,10 +83,25 @@ struct faifa {
 	char error[256];
 	u_int8_t dst_addr[ETHER_ADDR_LEN];
 	int verbose;
+	int immediate;
 };
 
 extern void faifa_set_error(faifa_t *faifa, char *format, ...);
 
+/**
+ * faifa_clock_ms - monotonic clock, used for timeouts and rates
+ * @return
+ *	milliseconds elapsed since an arbitrary point
+ */
+static inline u_int64_t faifa_clock_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (u_int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,677 @@
+/*
+ *  faifad - daemon keeping the interface open, serving MMEs over a Unix socket
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <net/ethernet.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+
+#include "faifa.h"
+#include "faifa_compat.h"
+#include "faifa_priv.h"
+#include "frame.h"
+#include "homeplug_av.h"
+#include "faifad.h"
+
+extern FILE *err_stream;
+extern FILE *out_stream;
+
+#define FAIFAD_MAX_CLIENTS	64
+#define FAIFAD_MAX_PENDING	256	/* requests in flight over all clients */
+#define FAIFAD_DEF_TIMEOUT	1000	/* default ms to wait for a confirm */
+#define FAIFAD_RX_BURST		64	/* frames read per capture wakeup */
+
+/**
+ * faifad_pending - request waiting for its confirm
+ * @fd:		client socket, -1 when the entry is free
+ * @id:		request ID
+ * @mmtype:	expected confirm MM type
+ * @da:		station the request went to, all zeros for any
+ * @seq:	order of the request, the oldest one matches first
+ * @deadline:	time the request times out, in ms
+ */
+struct faifad_pending {
+	int		fd;
+	u_int32_t	id;
+	u_int16_t	mmtype;
+	u_int8_t	da[ETHER_ADDR_LEN];
+	u_int64_t	seq;
+	u_int64_t	deadline;
+};
+
+struct faifad {
+	faifa_t			*faifa;
+	int			listen_fd;
+	int			pcap_fd;
+	int			clients[FAIFAD_MAX_CLIENTS];
+	int			num_clients;
+	struct faifad_pending	pending[FAIFAD_MAX_PENDING];
+	u_int64_t		seq;
+	unsigned int		timeout;
+	u_int8_t		frame[ETHER_MAX_LEN];
+	u_int8_t		reply[sizeof(struct faifad_reply) + FAIFAD_MAX_PARAMS + FAIFAD_MAX_TEXT];
+};
+
+static const u_int8_t faifad_local_mac[ETHER_ADDR_LEN] = { 0x00, 0xB0, 0x52, 0x00, 0x00, 0x01 };
+static const u_int8_t faifad_bcast_mac[ETHER_ADDR_LEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+static volatile sig_atomic_t faifad_stop;
+
+static void faifad_signal(int sig)
+{
+	faifad_stop = 1;
+}
+
+/* Replies are dropped rather than blocking the daemon on a slow client */
+static void faifad_send_reply(struct faifad *d, int fd, u_int32_t id, u_int8_t status,
+			      u_int16_t mmtype, const u_int8_t *sa,
+			      const u_int8_t *payload, int len, const char *text, int text_len)
+{
+	struct faifad_reply *rep = (struct faifad_reply *)d->reply;
+
+	memset(rep, 0, sizeof(*rep));
+	rep->magic = FAIFAD_MAGIC;
+	rep->status = status;
+	rep->mmtype = mmtype;
+	rep->id = id;
+	if (sa)
+		memcpy(rep->sa, sa, ETHER_ADDR_LEN);
+	rep->len = len;
+	rep->text_len = text_len;
+	if (len)
+		memcpy(rep->data, payload, len);
+	if (text_len)
+		memmove(rep->data + len, text, text_len);
+
+	if (send(fd, rep, sizeof(*rep) + len + text_len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0 &&
+	    errno != EAGAIN && errno != EPIPE)
+		fprintf(stderr, "send: %s\n", strerror(errno));
+}
+
+/**
+ * faifad_decode - decode a received frame as faifa prints it
+ * @text:	receives the text, cut at @size bytes
+ * @return
+ *	length of the text
+ */
+static int faifad_decode(struct faifad *d, u_int8_t *frame, int len, char *text, size_t size)
+{
+	FILE *saved = out_stream, *fp;
+	long n;
+
+	fp = fmemopen(text, size, "w");
+	if (!fp)
+		return 0;
+
+	out_stream = fp;
+	do_receive_frame(d->faifa, frame, len, NULL);
+	out_stream = saved;
+
+	fflush(fp);
+	n = ftell(fp);
+	fclose(fp);
+
+	if (n < 0)
+		return 0;
+	return n < (long)size ? n : (long)size;
+}
+
+/*
+ * MMEs carry no transaction ID: a confirm answers the oldest request
+ * waiting for its MM type from the station it comes from. Requests to
+ * the Intellon local or broadcast address accept any station.
+ */
+static void faifad_confirm(struct faifad *d, u_int8_t *frame, int frame_len, u_int16_t mmtype,
+			   const u_int8_t *payload, int len, const u_int8_t *sa)
+{
+	struct faifad_reply *rep = (struct faifad_reply *)d->reply;
+	struct faifad_pending *p, *oldest = NULL;
+	char *text;
+	int text_len, i;
+
+	for (i = 0; i < FAIFAD_MAX_PENDING; i++) {
+		p = &d->pending[i];
+		if (p->fd < 0 || p->mmtype != mmtype)
+			continue;
+		if (!faifa_is_zero_ether_addr(p->da) && memcmp(p->da, sa, ETHER_ADDR_LEN))
+			continue;
+		if (!oldest || p->seq < oldest->seq)
+			oldest = p;
+	}
+	if (!oldest)
+		return;
+
+	if (len > FAIFAD_MAX_PARAMS)
+		len = FAIFAD_MAX_PARAMS;
+
+	/* Decode straight into the reply buffer, past the payload */
+	text = (char *)rep->data + len;
+	text_len = faifad_decode(d, frame, frame_len, text, FAIFAD_MAX_TEXT);
+
+	faifad_send_reply(d, oldest->fd, oldest->id, FAIFAD_OK, mmtype, sa,
+			  payload, len, text, text_len);
+	oldest->fd = -1;
+}
+
+static void faifad_recv_frames(struct faifad *d)
+{
+	u_int8_t sa[ETHER_ADDR_LEN];
+	u_int8_t *payload;
+	u_int16_t mmtype;
+	int i, n;
+
+	for (i = 0; i < FAIFAD_RX_BURST; i++) {
+		n = hpav_recv_mme(d->faifa, d->frame, sizeof(d->frame), &mmtype, &payload, sa);
+		if (n < 0) {
+			fprintf(stderr, "%s\n", faifa_error(d->faifa));
+			return;
+		}
+		if (!mmtype)
+			return;
+		if ((mmtype & 3) == 1)
+			faifad_confirm(d, d->frame, (payload - d->frame) + n, mmtype, payload, n, sa);
+	}
+}
+
+static void faifad_request(struct faifad *d, int fd, const u_int8_t *msg, ssize_t n)
+{
+	const struct faifad_request *req = (const struct faifad_request *)msg;
+	struct faifad_pending *p = NULL;
+	u_int8_t *da = NULL;
+	u_int32_t id = 0;
+	int i;
+
+	if (n >= (ssize_t)sizeof(*req))
+		id = req->id;
+	if (n < (ssize_t)sizeof(*req) || req->magic != FAIFAD_MAGIC ||
+	    req->len > FAIFAD_MAX_PARAMS || n != (ssize_t)(sizeof(*req) + req->len)) {
+		faifad_send_reply(d, fd, id, FAIFAD_INVALID, 0, NULL, NULL, 0, NULL, 0);
+		return;
+	}
+
+	for (i = 0; i < FAIFAD_MAX_PENDING; i++) {
+		if (d->pending[i].fd < 0) {
+			p = &d->pending[i];
+			break;
+		}
+	}
+	if (!p) {
+		faifad_send_reply(d, fd, id, FAIFAD_BUSY, 0, NULL, NULL, 0, NULL, 0);
+		return;
+	}
+
+	if (!faifa_is_zero_ether_addr(req->da))
+		da = (u_int8_t *)req->da;
+	if (hpav_send_mme(d->faifa, req->mmtype, da, req->params, req->len) < 0) {
+		fprintf(stderr, "%s\n", faifa_error(d->faifa));
+		faifad_send_reply(d, fd, id, FAIFAD_SEND, 0, NULL, NULL, 0, NULL, 0);
+		return;
+	}
+
+	p->fd = fd;
+	p->id = id;
+	p->mmtype = req->mmtype + 1;
+	memset(p->da, 0, ETHER_ADDR_LEN);
+	if (da && memcmp(da, faifad_local_mac, ETHER_ADDR_LEN) &&
+	    memcmp(da, faifad_bcast_mac, ETHER_ADDR_LEN))
+		memcpy(p->da, da, ETHER_ADDR_LEN);
+	p->seq = d->seq++;
+	p->deadline = faifa_clock_ms() + (req->timeout ? req->timeout : d->timeout);
+}
+
+static void faifad_drop_client(struct faifad *d, int c)
+{
+	int fd = d->clients[c], i;
+
+	for (i = 0; i < FAIFAD_MAX_PENDING; i++)
+		if (d->pending[i].fd == fd)
+			d->pending[i].fd = -1;
+
+	close(fd);
+	d->clients[c] = d->clients[--d->num_clients];
+}
+
+static void faifad_client(struct faifad *d, int c)
+{
+	u_int8_t msg[sizeof(struct faifad_request) + FAIFAD_MAX_PARAMS + 1];
+	ssize_t n;
+
+	for (;;) {
+		n = recv(d->clients[c], msg, sizeof(msg), MSG_DONTWAIT);
+		if (n > 0) {
+			faifad_request(d, d->clients[c], msg, n);
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		faifad_drop_client(d, c);
+		return;
+	}
+}
+
+static void faifad_accept(struct faifad *d)
+{
+	int fd;
+
+	while ((fd = accept(d->listen_fd, NULL, NULL)) >= 0) {
+		if (d->num_clients == FAIFAD_MAX_CLIENTS) {
+			close(fd);
+			continue;
+		}
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		d->clients[d->num_clients++] = fd;
+	}
+}
+
+/* Returns the ms until the next deadline, -1 if nothing is pending */
+static int faifad_expire(struct faifad *d)
+{
+	u_int64_t now = faifa_clock_ms(), next = 0;
+	struct faifad_pending *p;
+	int i;
+
+	for (i = 0; i < FAIFAD_MAX_PENDING; i++) {
+		p = &d->pending[i];
+		if (p->fd < 0)
+			continue;
+		if (p->deadline <= now) {
+			faifad_send_reply(d, p->fd, p->id, FAIFAD_TIMEOUT, p->mmtype, NULL,
+					  NULL, 0, NULL, 0);
+			p->fd = -1;
+		} else if (!next || p->deadline < next) {
+			next = p->deadline;
+		}
+	}
+
+	return next ? (int)(next - now) : -1;
+}
+
+static int faifad_loop(struct faifad *d)
+{
+	struct pollfd pfd[2 + FAIFAD_MAX_CLIENTS];
+	int i, n, timeout;
+
+	while (!faifad_stop) {
+		timeout = faifad_expire(d);
+
+		pfd[0].fd = d->pcap_fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = d->listen_fd;
+		pfd[1].events = POLLIN;
+		for (i = 0; i < d->num_clients; i++) {
+			pfd[2 + i].fd = d->clients[i];
+			pfd[2 + i].events = POLLIN;
+		}
+		n = d->num_clients;
+
+		if (poll(pfd, 2 + n, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return -1;
+		}
+
+		if (pfd[0].revents)
+			faifad_recv_frames(d);
+		/* Backwards, dropping a client moves the last one in its place */
+		for (i = n - 1; i >= 0; i--)
+			if (pfd[2 + i].revents)
+				faifad_client(d, i);
+		if (pfd[1].revents)
+			faifad_accept(d);
+	}
+
+	return 0;
+}
+
+static int faifad_listen(const char *path, mode_t mode)
+{
+	struct sockaddr_un sun;
+	struct stat st;
+	int fd;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return -1;
+	}
+
+	/* Only remove a stale socket, never another file */
+	if (!lstat(path, &st)) {
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "%s: exists and is not a socket\n", path);
+			return -1;
+		}
+		unlink(path);
+	}
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+	    chmod(path, mode) < 0 || listen(fd, 16) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int faifad_parse_hex(const char *str, u_int8_t *buf, int size)
+{
+	unsigned int byte;
+	int n = 0;
+
+	while (*str) {
+		if (*str == ':' || *str == ' ') {
+			str++;
+			continue;
+		}
+		if (n == size || sscanf(str, "%2x", &byte) != 1 || !str[1])
+			return -1;
+		buf[n++] = byte;
+		str += 2;
+	}
+
+	return n;
+}
+
+/**
+ * faifad_query - client side: send one request and print its reply
+ * @return
+ *	0 when a confirm came back, 1 otherwise
+ */
+static int faifad_query(const char *path, u_int16_t mmtype, const u_int8_t *da,
+			const char *params, unsigned int timeout, int raw)
+{
+	u_int8_t msg[sizeof(struct faifad_request) + FAIFAD_MAX_PARAMS];
+	u_int8_t buf[sizeof(struct faifad_reply) + FAIFAD_MAX_PARAMS + FAIFAD_MAX_TEXT];
+	struct faifad_request *req = (struct faifad_request *)msg;
+	struct faifad_reply *rep = (struct faifad_reply *)buf;
+	struct sockaddr_un sun;
+	int fd, n, ret = 1;
+
+	memset(req, 0, sizeof(*req));
+	req->magic = FAIFAD_MAGIC;
+	req->mmtype = mmtype;
+	req->id = getpid();
+	memcpy(req->da, da, ETHER_ADDR_LEN);
+	req->timeout = timeout;
+	if (params) {
+		n = faifad_parse_hex(params, req->params, FAIFAD_MAX_PARAMS);
+		if (n < 0) {
+			fprintf(stderr, "invalid parameters: %s\n", params);
+			return 1;
+		}
+		req->len = n;
+	}
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return 1;
+	}
+	fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (fd < 0) {
+		perror("socket");
+		return 1;
+	}
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		goto out;
+	}
+
+	if (send(fd, msg, sizeof(*req) + req->len, MSG_NOSIGNAL) < 0) {
+		perror("send");
+		goto out;
+	}
+	n = recv(fd, buf, sizeof(buf), 0);
+	if (n < (int)sizeof(*rep) || rep->magic != FAIFAD_MAGIC ||
+	    n < (int)(sizeof(*rep) + rep->len + rep->text_len)) {
+		fprintf(stderr, "invalid reply\n");
+		goto out;
+	}
+
+	switch (rep->status) {
+	case FAIFAD_OK:
+		break;
+	case FAIFAD_TIMEOUT:
+		fprintf(stderr, "No answer to MME 0x%04x\n", mmtype);
+		goto out;
+	case FAIFAD_BUSY:
+		fprintf(stderr, "Too many requests in flight\n");
+		goto out;
+	case FAIFAD_SEND:
+		fprintf(stderr, "Cannot send MME 0x%04x\n", mmtype);
+		goto out;
+	default:
+		fprintf(stderr, "Invalid request\n");
+		goto out;
+	}
+
+	if (raw) {
+		for (n = 0; n < rep->len; n++)
+			printf("%02x", rep->data[n]);
+		printf("\n");
+	} else {
+		fwrite(rep->data + rep->len, 1, rep->text_len, stdout);
+	}
+	ret = 0;
+out:
+	close(fd);
+	return ret;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: faifad [options] -i interface\n"
+			"       faifad [options] -c mmtype [-a address] [-p params]\n"
+			"-i:	network interface to serve\n"
+			"-s:	socket path (default $%s or %s)\n"
+			"-m:	socket permissions, octal (default 0660)\n"
+			"-t:	ms to wait for a confirm (default %d)\n"
+			"-D:	detach and run in the background\n"
+			"-c:	client: send this MM type (hex) through the daemon and print the confirm\n"
+			"-a:	client: destination MAC address (default: Intellon local address)\n"
+			"-p:	client: MME payload as hex bytes\n"
+			"-x:	client: print the confirm payload in hex rather than decoded\n"
+			"-h:	this help\n",
+			FAIFAD_SOCKET_ENV, FAIFAD_SOCKET, FAIFAD_DEF_TIMEOUT);
+}
+
+int main(int argc, char **argv)
+{
+	static struct faifad d;
+	char *iface = NULL;
+	const char *path, *params = NULL, *mac = NULL;
+	u_int8_t da[ETHER_ADDR_LEN] = { 0 };
+	unsigned long mmtype = 0;
+	mode_t mode = 0660;
+	int opt, client = 0, raw = 0, detach = 0, ret = 1, i;
+	char errbuf[PCAP_ERRBUF_SIZE];
+	struct sigaction sa;
+
+	path = getenv(FAIFAD_SOCKET_ENV);
+	if (!path)
+		path = FAIFAD_SOCKET;
+	d.timeout = FAIFAD_DEF_TIMEOUT;
+
+	while ((opt = getopt(argc, argv, "i:s:m:t:Dc:a:p:xh")) > 0) {
+		switch (opt) {
+		case 'i':
+			iface = optarg;
+			break;
+		case 's':
+			path = optarg;
+			break;
+		case 'm':
+			mode = strtoul(optarg, NULL, 8);
+			break;
+		case 't':
+			d.timeout = strtoul(optarg, NULL, 0);
+			break;
+		case 'D':
+			detach = 1;
+			break;
+		case 'c':
+			client = 1;
+			mmtype = strtoul(optarg, NULL, 16);
+			break;
+		case 'a':
+			mac = optarg;
+			break;
+		case 'p':
+			params = optarg;
+			break;
+		case 'x':
+			raw = 1;
+			break;
+		case 'h':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	out_stream = stdout;
+	err_stream = stderr;
+
+	if (client) {
+		if (!mmtype || mmtype > 0xFFFF || d.timeout > 0xFFFF ||
+		    (mac && sscanf(mac, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+				   &da[0], &da[1], &da[2], &da[3], &da[4], &da[5]) != 6)) {
+			usage();
+			return 1;
+		}
+		return faifad_query(path, mmtype, da, params, d.timeout, raw);
+	}
+
+	if (!iface || !d.timeout) {
+		usage();
+		return 1;
+	}
+
+	/* Pay for the root check, device lookup and capture setup once */
+	d.faifa = faifa_init();
+	if (!d.faifa) {
+		fprintf(stderr, "Can't initialize Faifa library\n");
+		return 1;
+	}
+	/* Confirms wake the poll loop as they arrive, not every 100 ms */
+	faifa_set_immediate(d.faifa, 1);
+	if (faifa_open(d.faifa, iface) == -1) {
+		fprintf(stderr, "%s\n", faifa_error(d.faifa));
+		goto out_free;
+	}
+	if (pcap_setnonblock(d.faifa->pcap, 1, errbuf) < 0) {
+		fprintf(stderr, "pcap_setnonblock: %s\n", errbuf);
+		goto out_close;
+	}
+	d.pcap_fd = pcap_get_selectable_fd(d.faifa->pcap);
+	if (d.pcap_fd < 0) {
+		fprintf(stderr, "%s: no selectable capture descriptor\n", iface);
+		goto out_close;
+	}
+
+	for (i = 0; i < FAIFAD_MAX_PENDING; i++)
+		d.pending[i].fd = -1;
+
+	d.listen_fd = faifad_listen(path, mode);
+	if (d.listen_fd < 0)
+		goto out_close;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = faifad_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (detach && daemon(0, 0) < 0) {
+		perror("daemon");
+		goto out_listen;
+	}
+
+	ret = faifad_loop(&d) ? 1 : 0;
+
+	while (d.num_clients)
+		faifad_drop_client(&d, 0);
+out_listen:
+	close(d.listen_fd);
+	unlink(path);
+out_close:
+	faifa_close(d.faifa);
+out_free:
+	faifa_free(d.faifa);
+	return ret;
+}
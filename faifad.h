@@ -0,0 +1,125 @@
+/*
+ *  faifad Unix socket protocol
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+
+#ifndef __FAIFAD_H__
+#define __FAIFAD_H__
+
+#include <sys/types.h>
+
+/* Default socket path, clients may override it with FAIFAD_SOCKET_ENV */
+#define FAIFAD_SOCKET		"/var/run/faifad.sock"
+#define FAIFAD_SOCKET_ENV	"FAIFAD_SOCKET"
+
+#define FAIFAD_MAGIC		0xFAD1
+#define FAIFAD_MAX_PARAMS	1490	/* largest MME payload after the OUI */
+#define FAIFAD_MAX_TEXT		32768	/* decoded confirms are cut beyond */
+
+/*
+ * The socket is SOCK_SEQPACKET: each request and each reply is one
+ * message. Fields are in host byte order, the socket being local.
+ * Requests of a connection may be pipelined, replies come back in
+ * completion order and carry the request ID.
+ */
+
+/**
+ * faifad_request - send a MME and wait for its confirm
+ * @magic:	FAIFAD_MAGIC
+ * @mmtype:	request MM type, the daemon waits for @mmtype + 1
+ * @id:		echoed in the reply
+ * @da:		destination MAC address, all zeros for the Intellon local address
+ * @timeout:	ms to wait for the confirm, 0 for the daemon default
+ * @len:	bytes of @params
+ * @params:	MME payload, after the OUI for vendor MMEs
+ */
+struct faifad_request {
+	u_int16_t	magic;
+	u_int16_t	mmtype;
+	u_int32_t	id;
+	u_int8_t	da[6];
+	u_int16_t	timeout;
+	u_int16_t	len;
+	u_int8_t	params[0];
+} __attribute__((__packed__));
+
+enum faifad_status {
+	FAIFAD_OK	= 0x00,
+	FAIFAD_TIMEOUT	= 0x01,	/* no confirm in time */
+	FAIFAD_INVALID	= 0x02,	/* malformed request */
+	FAIFAD_SEND	= 0x03,	/* the MME could not be sent */
+	FAIFAD_BUSY	= 0x04,	/* too many requests in flight */
+};
+
+/**
+ * faifad_reply - confirm of a request
+ * @magic:	FAIFAD_MAGIC
+ * @status:	enum faifad_status
+ * @mmtype:	confirm MM type
+ * @id:		ID of the request
+ * @sa:		MAC address of the station that answered
+ * @len:	bytes of confirm payload at the start of @data
+ * @text_len:	bytes of decoded confirm following the payload, not NUL terminated
+ * @data:	confirm payload, then its decoded text
+ */
+struct faifad_reply {
+	u_int16_t	magic;
+	u_int8_t	status;
+	u_int8_t	reserved;
+	u_int16_t	mmtype;
+	u_int32_t	id;
+	u_int8_t	sa[6];
+	u_int16_t	len;
+	u_int16_t	text_len;
+	u_int8_t	data[0];
+} __attribute__((__packed__));
+
+#endif /* __FAIFAD_H__ */
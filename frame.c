@@ -59,8 +59,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <signal.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <time.h>
 
 #include "faifa.h"
 #include "faifa_compat.h"
@@ -74,11 +76,16 @@
 #include "endian.h"
 #include "crypto.h"
 #include "crc32.h"
+#include "tonemap.h"
+#include "device.h"
 
 FILE *err_stream;
 FILE *out_stream;
 FILE *in_stream;
 
+/* Tone map history, Tone Map Confirms are recorded there when set */
+tm_hist_t *tm_history;
+
 /* Constants */
 static u_int8_t hpav_intellon_oui[3] = { 0x00, 0xB0, 0x52};
 static u_int8_t hpav_intellon_macaddr[ETHER_ADDR_LEN] = { 0x00, 0xB0, 0x52, 0x00, 0x00, 0x01 };
@@ -195,11 +202,28 @@ static const char *int6x00_device_id_str(u_int8_t device_id)
 	}
 }
 
-static int hpav_dump_get_device_sw_version_confirm(void *buf, int len, struct ether_header *UNUSED(hdr))
+/**
+ * dump_peer_tei - annotate a TEI reported by a station, which belongs
+ * to the same network as this station
+ * @hdr:	Ethernet header of the reporting frame
+ * @tei:	TEI to annotate
+ */
+static void dump_peer_tei(struct ether_header *hdr, u_int8_t tei)
+{
+	struct hpav_device *dev = hpav_device_find_mac(hdr->ether_shost);
+
+	if (dev)
+		dump_device_tei(dev->snid, tei);
+}
+
+static int hpav_dump_get_device_sw_version_confirm(void *buf, int len, struct ether_header *hdr)
 {
 	int avail = len;
 	struct get_device_sw_version_confirm *mm = buf;
 
+	if (!mm->mstatus)
+		hpav_device_set_sw_version(hdr->ether_shost, (char *)mm->version, mm->version_length);
+
 	faifa_printf(out_stream, "Status: %s\n", mm->mstatus ? "Failure" : "Success");
 	faifa_printf(out_stream, "Device ID: %s, Version: %s, upgradeable: %hhd\n",
 		int6x00_device_id_str(mm->device_id),
@@ -405,6 +429,7 @@ static int hpav_dump_cc_discover_list_confirm(void *buf, int len, struct ether_h
 	faifa_printf(out_stream, "Number of Stations: %d\n", sta->count);
 	avail -= sizeof(*sta);
 	for (i = 0; i < sta->count; i++) {
+		hpav_device_update(sta->infos[i].macaddr, sta->infos[i].snid, sta->infos[i].tei);
 		dump_cc_sta_info(&(sta->infos[i]));
 		avail -= sizeof(sta->infos[i]);
 	}
@@ -533,10 +558,8 @@ static int hpav_init_write_data_request(void *buf, int len, void *UNUSED(buffer)
 	int avail = len;
 	struct write_mod_data_request *mm = buf;
 	char filename[256];
-	char *buffer;
-	FILE *fp;
-	short unsigned int size;
-	uint32_t crc32;
+	FILE *fp = NULL;
+	long size;
 	int ret;
 
 	faifa_printf(out_stream, "Module ID? ");
@@ -548,42 +571,36 @@ static int hpav_init_write_data_request(void *buf, int len, void *UNUSED(buffer)
 	if (ret < 0)
 		return ret;
 	faifa_printf(out_stream, "Firmware file? ");
-	ret = fscanf(in_stream, "%s", (char *)filename);
+	ret = fscanf(in_stream, "%255s", (char *)filename);
 	if (ret < 0)
 		return ret;
 	fp = fopen(filename, "rb");
 	if (!fp) {
 		faifa_printf(err_stream, "Cannot open: %s\n", filename);
-		avail = -1;
-		goto out;
+		return -1;
 	}
 	fseek(fp, 0, SEEK_END);
 	size = ftell(fp);
-	if (size > 1024) {
-		faifa_printf(out_stream, "Invalid file size > 1024\n");
-		avail = -1;
+	/* A single MME carries at most one chunk, whole images go through -W */
+	if (size <= 0 || size > 1024) {
+		faifa_printf(err_stream, "Invalid file size %ld, use faifa -W to upload whole images\n", size);
+		ret = -1;
 		goto out;
 	}
 	fseek(fp, 0, SEEK_SET);
 	mm->length = size;
-	buffer = malloc(size);
-	if (!buffer) {
-		faifa_printf(err_stream, "Cannot allocate memory\n");
-		avail = -1;
+	if (fread(mm->data, size, 1, fp) != 1) {
+		faifa_printf(err_stream, "Cannot read: %s\n", filename);
+		ret = -1;
 		goto out;
 	}
-	ret = fread(buffer, size, 1, fp);
-	if (ret < size)
-		return ret;
 	/* Compute crc on the file */
-	crc32 = crc32buf(buffer, size);
-	memcpy(&(mm->data), buffer, size);
-	mm->checksum = crc32;
+	mm->checksum = crc32buf(mm->data, size);
+	avail -= sizeof(*mm) + size;
+	ret = len - avail;
 out:
-	if (fp)
-		fclose(fp);
-	avail -= sizeof(*mm);
-	return (len - avail);
+	fclose(fp);
+	return ret;
 }
 
 static int hpav_dump_write_mod_data_confirm(void *buf, int len, struct ether_header *UNUSED(hdr))
@@ -591,7 +608,7 @@ static int hpav_dump_write_mod_data_confirm(void *buf, int len, struct ether_hea
 	int avail = len;
 	struct write_mod_data_confirm *mm =(struct write_mod_data_confirm *)buf;
 
-	switch((short unsigned int)(mm->module_id)) {
+	switch(mm->mstatus) {
 	case SUCCESS:
 		faifa_printf(out_stream, "Status: Success\n");
 		break;
@@ -659,7 +676,7 @@ static int hpav_dump_read_mod_data_confirm(void *buf, int len, struct ether_head
 	faifa_printf(out_stream, "Offset: 0x%08x\n", mm->offset);
 	faifa_printf(out_stream, "Checksum: 0x%08x\n", mm->checksum);
 	faifa_printf(out_stream, "Data:\n");
-	dump_hex(mm->data + mm->offset, (unsigned int)(mm->length), " ");
+	dump_hex(mm->data, (unsigned int)(mm->length), " ");
 
 	avail -= sizeof(*mm);
 
@@ -835,6 +852,9 @@ static int hpav_dump_get_enet_phy_settings_confirm(void *buf, int len, struct et
 	return (len - avail);
 }
 
+/* Peer of the last Tone Map Characteristics Request sent */
+static u_int8_t tm_peer[ETHER_ADDR_LEN];
+
 static int hpav_init_get_tone_map_charac_request(void *buf, int len, void *UNUSED(user))
 {
 	int avail = len;
@@ -850,6 +870,8 @@ static int hpav_init_get_tone_map_charac_request(void *buf, int len, void *UNUSE
 		return ret;
 
 	memcpy(mm->macaddr, macaddr, ETHER_ADDR_LEN);
+	/* The confirm does not carry the peer address */
+	memcpy(tm_peer, macaddr, ETHER_ADDR_LEN);
 
 	faifa_printf(out_stream, "Tone map slot?\n0 -> slot 0\n1 -> slot 1 ...\n");
 	ret = fscanf(in_stream, "%2hhx", &(mm->tmslot));
@@ -950,6 +972,10 @@ static int hpav_dump_get_tone_map_charac_confirm(void *buf, int len, struct ethe
 
 	faifa_printf(out_stream, "Modulation statistics\n");
 	dump_modulation_stats(&stats);
+
+	if (tm_history && tm_hist_append(tm_history, tm_peer, mm->tmslot, time(NULL),
+					 (u_int8_t *)mm->carriers, mm->tm_num_act_carrier))
+		faifa_printf(err_stream, "Cannot record tone map\n");
 out:
 	avail -= sizeof(*mm);
 
@@ -1073,7 +1099,7 @@ static void dump_rx_link_stats(struct rx_link_stats *rx)
 	}
 }
 
-static int hpav_dump_link_stats_confirm(void *buf, int len, struct ether_header *UNUSED(hdr))
+static int hpav_dump_link_stats_confirm(void *buf, int len, struct ether_header *hdr)
 {
 	int avail = len;
 	struct link_statistics_confirm *mm = buf;
@@ -1101,7 +1127,9 @@ static int hpav_dump_link_stats_confirm(void *buf, int len, struct ether_header
 	}
 
 	faifa_printf(out_stream, "Link ID: %02hhx\n", mm->link_id);
-	faifa_printf(out_stream, "TEI: %02hhx\n", mm->tei);
+	faifa_printf(out_stream, "TEI: %02hhx", mm->tei);
+	dump_peer_tei(hdr, mm->tei);
+	faifa_printf(out_stream, "\n");
 
 	switch (mm->direction) {
 	case HPAV_SD_TX:
@@ -1224,8 +1252,11 @@ static void dump_hpav_frame_ctl(struct hpav_fc *fc)
 	faifa_printf(out_stream, "Delimiter type: %1hhx\n", fc->del_type);
 	faifa_printf(out_stream, "Access: %s\n", fc->access ? "Yes" : "No");
 	faifa_printf(out_stream, "SNID: %1hhx\n", fc->snid);
-	faifa_printf(out_stream, "STEI: %02hhx\n", fc->stei);
-	faifa_printf(out_stream, "DTEI: %02hhx\n", fc->dtei);
+	faifa_printf(out_stream, "STEI: %02hhx", fc->stei);
+	dump_device_tei(fc->snid, fc->stei);
+	faifa_printf(out_stream, "\nDTEI: %02hhx", fc->dtei);
+	dump_device_tei(fc->snid, fc->dtei);
+	faifa_printf(out_stream, "\n");
 	faifa_printf(out_stream, "Link ID: %02hhx\n", fc->lid);
 	faifa_printf(out_stream, "Contention free session: %s\n", fc->cfs ? "Yes" : "No");
 	faifa_printf(out_stream, "Beacon detect flag: %s\n", fc->bdf ? "Yes" : "No");
@@ -1320,12 +1351,20 @@ char *get_sta_role_str(u_int8_t sta_role)
 	return NULL;
 }
 
-static int hpav_dump_network_info_confirm(void *buf, int len, struct ether_header *UNUSED(hdr))
+static int hpav_dump_network_info_confirm(void *buf, int len, struct ether_header *hdr)
 {
 	int avail = len;
 	struct network_info_confirm *mm = buf;
+	struct hpav_device *dev;
 	int i;
 
+	dev = hpav_device_update(hdr->ether_shost, mm->snid, mm->tei);
+	if (dev)
+		dev->role = mm->sta_role;
+	dev = hpav_device_update(mm->cco_macaddr, mm->snid, mm->cco_tei);
+	if (dev)
+		dev->role = HPAV_SR_CCO;
+
 	faifa_printf(out_stream, "Network ID (NID): "); dump_hex(&(mm->nid), sizeof(mm->nid), " ");
 	faifa_printf(out_stream, "\n");
 	faifa_printf(out_stream, "Short Network ID (SNID): 0x%02hx\n", mm->snid);
@@ -1340,6 +1379,7 @@ static int hpav_dump_network_info_confirm(void *buf, int len, struct ether_heade
 		faifa_printf(out_stream, "Station MAC       TEI  Bridge MAC        TX   RX  \n");
 		faifa_printf(out_stream, "----------------- ---- ----------------- ---- ----\n");
 		for (i = 0; i < mm->num_stas; i++) {
+			hpav_device_update(mm->stas[i].sta_macaddr, mm->snid, mm->stas[i].sta_tei);
 			dump_hex(mm->stas[i].sta_macaddr, sizeof(mm->stas[i].sta_macaddr), ":");
 			faifa_printf(out_stream, " 0x%02hx ", mm->stas[i].sta_tei);
 			dump_hex(mm->stas[i].bridge_macaddr, sizeof(mm->stas[i].bridge_macaddr), ":");
@@ -1371,9 +1411,14 @@ static int hpav_dump_check_points_indicate(void *buf, int len, struct ether_head
 	faifa_printf(out_stream, "Current part: %d\n", mm->cur_part);
 	faifa_printf(out_stream, "Data length: %d (0x%04hx)\n", mm->data_length, mm->data_length);
 	faifa_printf(out_stream, "Data offset: 0x%04hx\n", mm->data_offset);
-	/* FIXME: we should probably move the offset */
-	//dump_hex(mm->data + mm->data_offset, (unsigned int)(mm->data_length), " ");
 	avail -= sizeof(*mm);
+	/* Part data goes at data_offset in the reassembled buffer, see checkpoint.c */
+	if (avail >= mm->data_length) {
+		faifa_printf(out_stream, "Data:\n");
+		dump_hex(mm->data, (unsigned int)(mm->data_length), " ");
+		faifa_printf(out_stream, "\n");
+		avail -= mm->data_length;
+	}
 
 	return (len - avail);
 }
@@ -1741,7 +1786,7 @@ static int hpav_dump_cm_get_key_confirm(void *buf, int len, struct ether_header
 	return (len - avail);
 }
 
-static int hpav_dump_cm_bridge_infos_confirm(void *buf, int len, struct ether_header *UNUSED(hdr))
+static int hpav_dump_cm_bridge_infos_confirm(void *buf, int len, struct ether_header *hdr)
 {
 	int avail = len;
 	struct cm_brigde_infos_confirm *mm = buf;
@@ -1750,7 +1795,9 @@ static int hpav_dump_cm_bridge_infos_confirm(void *buf, int len, struct ether_he
 	if (mm->bsf) {
 		int i;
 
-		faifa_printf(out_stream, "Bridge TEI: %02hhx\n", mm->bridge_infos.btei);
+		faifa_printf(out_stream, "Bridge TEI: %02hhx", mm->bridge_infos.btei);
+		dump_peer_tei(hdr, mm->bridge_infos.btei);
+		faifa_printf(out_stream, "\n");
 		faifa_printf(out_stream, "Number of destination addresses: %d\n", mm->bridge_infos.nbda);
 		for (i = 0; i < mm->bridge_infos.nbda; i++) {
 			faifa_printf(out_stream, "Bridged destination address %d - ", i);
@@ -1794,14 +1841,19 @@ static void dump_cm_net_info(struct cm_net_info *net_info)
 	faifa_printf(out_stream, "Number of neighbors: %d\n", net_info->num_cord);
 }
 
-static int hpav_dump_cm_get_network_infos_confirm(void *buf, int len, struct ether_header *UNUSED(hdr))
+static int hpav_dump_cm_get_network_infos_confirm(void *buf, int len, struct ether_header *hdr)
 {
 	int avail = len;
 	struct cm_get_network_infos_confirm *mm = buf;
+	struct hpav_device *dev;
 	int i;
 
 	avail -= sizeof(*mm);
 	for (i = 0; i < mm->net.count; i++) {
+		/* The sender is a member of each of the reported networks */
+		dev = hpav_device_update(hdr->ether_shost, mm->net.infos[i].snid, mm->net.infos[i].tei);
+		if (dev)
+			dev->role = mm->net.infos[i].sta_role;
 		dump_cm_net_info(&(mm->net.infos[i]));
 		avail -= sizeof(mm->net.infos[i]);
 	}
@@ -2370,29 +2422,21 @@ static const char *hpav_get_mmver_str(u_int8_t mmver)
 }
 
 /**
- * hpav_do_frame - prepare and send a HomePlug AV frame to the network
+ * hpav_init_frame - initialize the Ethernet and HomePlug AV MME headers
  * @frame_buf:	data buffer
  * @frame_len:	data buffer length
- * @mmtype:	MM type to send
- * @da:		destination MAC address
+ * @mmtype:	MM type of the frame
+ * @da:		destination MAC address (NULL for the Intellon address)
  * @sa:		source MAC address
- * @user:	user buffer
+ * @return:	number of bytes set in buffer, the payload starts there
  */
-static int hpav_do_frame(void *frame_buf, int frame_len, u_int16_t mmtype, u_int8_t *da, u_int8_t *sa, void *user)
+int hpav_init_frame(void *frame_buf, int frame_len, u_int16_t mmtype, u_int8_t *da, u_int8_t *sa)
 {
-	int i, n;
+	int n;
 	struct hpav_frame *frame;
 	u_int8_t *frame_ptr = frame_buf;
 
-	/* Lookup for the index from the mmtype */
-	i = hpav_mmtype2index(mmtype);
-	if (i < 0) {
-		faifa_printf(err_stream, "Invalid MM Type %04hx\n", mmtype);
-		return -1;
-	}
-
-	/* Zero-fill the frame */
-	bzero(frame_buf, frame_len);
+	memset(frame_buf, 0, sizeof(struct ether_header) + sizeof(*frame));
 
 	/* Check the destination MAC address */
 	if (da == NULL || faifa_is_zero_ether_addr(da))
@@ -2400,7 +2444,6 @@ static int hpav_do_frame(void *frame_buf, int frame_len, u_int16_t mmtype, u_int
 
 	/* Set the ethernet frame header */
 	n = ether_init_header(frame_ptr, frame_len, da, sa, ETHERTYPE_HOMEPLUG_AV);
-	frame_len -= n;
 	frame_ptr += n;
 
 	frame = (struct hpav_frame *)frame_ptr;
@@ -2414,6 +2457,161 @@ static int hpav_do_frame(void *frame_buf, int frame_len, u_int16_t mmtype, u_int
 		frame->header.mmver = HPAV_VERSION_1_1;
 		n += sizeof(frame->payload.pub);
 	}
+	frame_ptr += n;
+
+	return (frame_ptr - (u_int8_t *)frame_buf);
+}
+
+/**
+ * hpav_send_mmev - send a HomePlug AV MME gathered from several buffers
+ * @faifa:	private handle
+ * @mmtype:	MM type to send
+ * @da:		destination MAC address (NULL for the Intellon address)
+ * @iov:	MME payload pieces, sent without being copied
+ * @iovcnt:	number of @iov entries
+ * @return:	number of bytes sent on success, -1 on error
+ */
+int hpav_send_mmev(faifa_t *faifa, u_int16_t mmtype, u_int8_t *da,
+		   const struct iovec *iov, int iovcnt)
+{
+	u_int8_t hdr[sizeof(struct ether_header) + sizeof(struct hpav_frame)];
+	size_t len = 0;
+	int i, n;
+
+	n = hpav_init_frame(hdr, sizeof(hdr), mmtype, da, NULL);
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (n + len > ETH_FRAME_LEN) {
+		faifa_set_error(faifa, "MME payload too long: %zu", len);
+		return -1;
+	}
+
+	return faifa_sendv(faifa, hdr, n, NULL, iov, iovcnt);
+}
+
+/**
+ * hpav_send_mme - send a HomePlug AV MME with a prepared payload
+ * @faifa:	private handle
+ * @mmtype:	MM type to send
+ * @da:		destination MAC address (NULL for the Intellon address)
+ * @payload:	MME payload
+ * @len:	MME payload length
+ * @return:	number of bytes sent on success, -1 on error
+ */
+int hpav_send_mme(faifa_t *faifa, u_int16_t mmtype, u_int8_t *da, const void *payload, int len)
+{
+	struct iovec iov;
+
+	if (len < 0) {
+		faifa_set_error(faifa, "MME payload too long: %d", len);
+		return -1;
+	}
+
+	iov.iov_base = (void *)payload;
+	iov.iov_len = len;
+
+	return hpav_send_mmev(faifa, mmtype, da, &iov, 1);
+}
+
+/**
+ * hpav_parse_mme - locate the MME in a received Ethernet frame
+ * @buf:	Ethernet frame
+ * @len:	Ethernet frame length
+ * @mmtype:	MM type of the MME, 0 if the frame is not a HomePlug AV MME
+ * @payload:	set to the MME payload (past the OUI for vendor MMEs)
+ * @return:	payload length, 0 if the frame is not a HomePlug AV MME
+ */
+int hpav_parse_mme(void *buf, int len, u_int16_t *mmtype, u_int8_t **payload)
+{
+	struct ether_header *eth_header = buf;
+	u_int8_t *frame_ptr = buf;
+	struct hpav_frame *frame;
+	u_int16_t eth_type;
+	int n = len;
+
+	*mmtype = 0;
+	if (n < (int)(sizeof(*eth_header) + sizeof(*frame)))
+		return 0;
+
+	frame_ptr += sizeof(*eth_header);
+	n -= sizeof(*eth_header);
+	eth_type = ntohs(eth_header->ether_type);
+	if (eth_type == ETHERTYPE_8021Q) {
+		eth_type = ntohs(*(u_int16_t *)(frame_ptr + 2));
+		frame_ptr += 4;
+		n -= 4;
+	}
+
+	if (eth_type != ETHERTYPE_HOMEPLUG_AV || n < (int)sizeof(*frame))
+		return 0;
+
+	frame = (struct hpav_frame *)frame_ptr;
+	*mmtype = STORE16_LE(frame->header.mmtype);
+	if ((*mmtype & HPAV_MM_CATEGORY_MASK) == HPAV_MM_VENDOR_SPEC) {
+		*payload = frame->payload.vendor.data;
+		n -= sizeof(frame->header) + sizeof(frame->payload.vendor);
+	} else {
+		*payload = frame->payload.pub.data;
+		n -= sizeof(frame->header) + sizeof(frame->payload.pub);
+	}
+
+	return n;
+}
+
+/**
+ * hpav_recv_mme - receive the next HomePlug AV MME
+ * @faifa:	private handle
+ * @buf:	receive buffer, holds the whole Ethernet frame
+ * @len:	receive buffer length
+ * @mmtype:	MM type of the received MME, 0 if none
+ * @payload:	set to the MME payload (past the OUI for vendor MMEs)
+ * @sa:		source MAC address of the MME (may be NULL)
+ * @return:	payload length, 0 if the capture timeout expired or the frame
+ *		is not a HomePlug AV MME, -1 on error
+ */
+int hpav_recv_mme(faifa_t *faifa, void *buf, int len, u_int16_t *mmtype, u_int8_t **payload, u_int8_t *sa)
+{
+	struct ether_header *eth_header = buf;
+	int n;
+
+	*mmtype = 0;
+	n = faifa_recv(faifa, buf, len);
+	if (n <= 0)
+		return n;
+
+	n = hpav_parse_mme(buf, n, mmtype, payload);
+	if (n > 0 && sa)
+		memcpy(sa, eth_header->ether_shost, ETHER_ADDR_LEN);
+
+	return n;
+}
+
+/**
+ * hpav_do_frame - prepare and send a HomePlug AV frame to the network
+ * @frame_buf:	data buffer
+ * @frame_len:	data buffer length
+ * @mmtype:	MM type to send
+ * @da:		destination MAC address
+ * @sa:		source MAC address
+ * @user:	user buffer
+ */
+static int hpav_do_frame(void *frame_buf, int frame_len, u_int16_t mmtype, u_int8_t *da, u_int8_t *sa, void *user)
+{
+	int i, n;
+	u_int8_t *frame_ptr = frame_buf;
+
+	/* Lookup for the index from the mmtype */
+	i = hpav_mmtype2index(mmtype);
+	if (i < 0) {
+		faifa_printf(err_stream, "Invalid MM Type %04hx\n", mmtype);
+		return -1;
+	}
+
+	/* Zero-fill the frame */
+	bzero(frame_buf, frame_len);
+
+	/* Set the ethernet and MME headers */
+	n = hpav_init_frame(frame_ptr, frame_len, mmtype, da, sa);
 	frame_len -= n;
 	frame_ptr += n;
 
@@ -2678,6 +2876,16 @@ static int ask_for_frame(u_int16_t *mmtype)
 }
 
 
+static volatile sig_atomic_t menu_stopped;
+
+/**
+ * menu_stop - make menu return, may be called from a signal handler
+ */
+void menu_stop(void)
+{
+	menu_stopped = 1;
+}
+
 /**
  * menu - show a menu of the available to send mmtypes
  */
@@ -2685,21 +2893,30 @@ void menu(faifa_t *faifa)
 {
 	pthread_t receive_thread;
 	u_int16_t mmtype = 0;
+	sigset_t mask, saved;
+
+	/* Signals must interrupt the prompt, not the receiving thread */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, &saved);
 
 	/* Create a receiving thread */
 	if (pthread_create(&receive_thread, NULL, (void *)receive_loop, faifa)) {
 		perror("error creating thread");
 		abort();
 	}
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
 	faifa_printf(out_stream, "Started receive thread\n");
 
 	/* Keep asking the user for a mmtype to send */
-	while (ask_for_frame(&mmtype)) {
+	while (!menu_stopped && ask_for_frame(&mmtype) > 0) {
 		do_frame(faifa, mmtype, faifa->dst_addr, NULL, NULL);
 		sleep(1);
 	}
 
 	/* Rejoin the receiving thread */
+	faifa_breakloop(faifa);
 	if (pthread_join(receive_thread, NULL)) {
 		perror("error joining thread");
 		abort();
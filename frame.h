@@ -50,6 +50,12 @@
  */
 
 int ether_init_header(void *buf, int len, u_int8_t *da, u_int8_t *sa, u_int16_t ethertype);
+int hpav_init_frame(void *frame_buf, int frame_len, u_int16_t mmtype, u_int8_t *da, u_int8_t *sa);
+int hpav_send_mme(faifa_t *faifa, u_int16_t mmtype, u_int8_t *da, const void *payload, int len);
+int hpav_send_mmev(faifa_t *faifa, u_int16_t mmtype, u_int8_t *da,
+		   const struct iovec *iov, int iovcnt);
+int hpav_parse_mme(void *buf, int len, u_int16_t *mmtype, u_int8_t **payload);
+int hpav_recv_mme(faifa_t *faifa, void *buf, int len, u_int16_t *mmtype, u_int8_t **payload, u_int8_t *sa);
 int set_init_callback(u_int16_t mmtype, int (*callback)(void *buf, int len, void *user));
 int set_dump_callback(u_int16_t mmtype, int (*callback)(void *buf, int len, struct ether_header *hdr));
 void do_receive_frame(faifa_t *faifa, void *buf, int len, void *UNUSED(user));
@@ -46,6 +46,8 @@
 #include <unistd.h>
 #include <signal.h>
 #include <string.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netpacket/packet.h>
@@ -54,7 +56,9 @@
 #include <net/if.h>
 
 #include "homeplug_av.h"
+#include "mme.h"
 #include "crypto.h"
+#include "keycache.h"
 
 struct context {
 	int sock_fd;
@@ -62,49 +66,26 @@ struct context {
 };
 
 static int send_pkt(struct context *ctx, const uint8_t *to,
-			const void *hdr, size_t hdrlen,
+			const void *hdr, size_t hdrlen, const uint8_t *oui,
 			const void *payload, size_t payload_len)
 {
 	struct sockaddr_ll ll;
-	struct msghdr msg;
-	struct iovec iov[3];
-	size_t total_len;
-	uint8_t padding[64];
-	int ret;
-
-	memset(&msg, 0, sizeof(msg));
-	msg.msg_iov = iov;
-	total_len = 0;
-
-	iov[msg.msg_iovlen].iov_base = (void *)hdr;
-	iov[msg.msg_iovlen].iov_len = hdrlen;
-	total_len += hdrlen;
-	msg.msg_iovlen = 1;
-
-	if (payload_len) {
-		iov[msg.msg_iovlen].iov_base = (void *)payload;
-		iov[msg.msg_iovlen].iov_len = payload_len;
-		total_len += payload_len;
-		msg.msg_iovlen++;
-	}
-
-	if (total_len < 64) {
-		memset(padding, 0, sizeof(padding));
-		iov[msg.msg_iovlen].iov_base = (void *)padding;
-		iov[msg.msg_iovlen].iov_len = 64 - total_len;
-		msg.msg_iovlen++;
-	}
+	struct iovec iov;
+	ssize_t ret;
 
 	memset(&ll, 0, sizeof(ll));
 	ll.sll_family = AF_PACKET;
 	ll.sll_ifindex = ctx->if_index;
 	ll.sll_protocol = htons(ETHERTYPE_HOMEPLUG_AV);
-
+	ll.sll_halen = ETH_ALEN;
 	memcpy(ll.sll_addr, to, ETH_ALEN);
-	msg.msg_name = &ll;
-	msg.msg_namelen = sizeof(ll);
 
-	ret = sendmsg(ctx->sock_fd, &msg, 0);
+	iov.iov_base = (void *)payload;
+	iov.iov_len = payload_len;
+
+	/* The kernel adds the Ethernet header, pad the rest to ETH_ZLEN */
+	ret = mme_sendv(ctx->sock_fd, (struct sockaddr *)&ll, sizeof(ll),
+			hdr, hdrlen, oui, &iov, 1, ETH_ZLEN - ETH_HLEN);
 	if (ret < 0) {
 		if (errno != EAGAIN)
 			perror("sendmsg");
@@ -114,25 +95,17 @@ static int send_pkt(struct context *ctx, const uint8_t *to,
 	return 0;
 }
 
-struct homeplug_av_vendor_hdr {
-	uint8_t mmver;
-	uint16_t mmtype;
-	uint8_t oui[3];
-} __attribute__((__packed__));
+static const uint8_t qca_oui[3] = { 0x00, 0xB0, 0x52 };
 
 static int send_vendor_pkt(struct context *ctx, const uint8_t *to,
 				uint16_t mmtype, const void *payload, size_t payload_len)
 {
-	struct homeplug_av_vendor_hdr hdr;
+	struct hpav_frame_header hdr;
 
-	memset(&hdr, 0, sizeof(hdr));
 	hdr.mmver = 0;
 	hdr.mmtype = mmtype;
-	hdr.oui[0] = 0x00;
-	hdr.oui[1] = 0xB0;
-	hdr.oui[2] = 0x52;
 
-	return send_pkt(ctx, to, &hdr, sizeof(hdr), payload, payload_len);
+	return send_pkt(ctx, to, &hdr, sizeof(hdr), qca_oui, payload, payload_len);
 }
 
 static int init_socket(struct context *ctx, const char *iface)
@@ -167,27 +140,36 @@ out_close:
 
 static uint8_t bcast_hpav_mac[ETH_ALEN] = { 0x00, 0xB0, 0x52, 0x00, 0x00, 0x01 };
 
-static int send_key(struct context *ctx, const char *npw,
-			const char *dpw, const uint8_t mac[ETH_ALEN])
+static void fill_key_req(struct set_encryption_key_request *key_req,
+			 const uint8_t *nmk, const uint8_t *dak,
+			 const uint8_t mac[ETH_ALEN])
 {
-	struct set_encryption_key_request key_req;
-	uint8_t key[16];
-
-	memset(&key_req, 0, sizeof(key_req));
+	memset(key_req, 0, sizeof(*key_req));
 
-	key_req.peks = 0x01;
+	key_req->peks = 0x01;
 
-	gen_passphrase(npw, key, nmk_salt);
-	memcpy(key_req.nmk, key, AES_KEY_SIZE);
-	key_req.peks_payload = NO_KEY;
+	memcpy(key_req->nmk, nmk, AES_KEY_SIZE);
+	key_req->peks_payload = NO_KEY;
 
-	if (dpw) {
-		gen_passphrase(dpw, key, dak_salt);
-		memcpy(key_req.dak, key, AES_KEY_SIZE);
-		key_req.peks_payload = DST_STA_DAK;
+	if (dak) {
+		memcpy(key_req->dak, dak, AES_KEY_SIZE);
+		key_req->peks_payload = DST_STA_DAK;
 	}
 
-	memcpy(key_req.rdra, mac, ETH_ALEN);
+	memcpy(key_req->rdra, mac, ETH_ALEN);
+}
+
+static int send_key(struct context *ctx, const char *npw,
+			const char *dpw, const uint8_t mac[ETH_ALEN])
+{
+	struct set_encryption_key_request key_req;
+	uint8_t nmk[16], dak[16];
+
+	gen_passphrase(npw, nmk, nmk_salt);
+	if (dpw)
+		gen_passphrase(dpw, dak, dak_salt);
+
+	fill_key_req(&key_req, nmk, dpw ? dak : NULL, mac);
 
 	return send_vendor_pkt(ctx, mac, HPAV_MMTYPE_SET_KEY_REQ,
 				&key_req, sizeof(key_req));
@@ -251,6 +233,369 @@ static int read_key_confirm(struct context *ctx, const uint8_t mac[ETH_ALEN])
 
 
 
+/* Fleet mode: SET_KEY_REQs sent from a manifest, at most a window at a time */
+#define FLEET_WINDOW		32
+#define FLEET_TIMEOUT_MS	1000
+#define FLEET_TRIES		3
+
+enum fleet_state {
+	FLEET_PENDING = 0,
+	FLEET_SENT,
+	FLEET_DONE,
+	FLEET_TIMEOUT,
+};
+
+/**
+ * fleet_dev - one device of the manifest
+ * @mac:	device MAC address
+ * @npw:	network password
+ * @dpw:	device password, NULL to only set the NMK
+ * @req:	SET_KEY_REQ payload
+ * @state:	provisioning state
+ * @tries:	SET_KEY_REQs sent
+ * @deadline:	time the current SET_KEY_REQ times out, in ms
+ * @status:	SET_KEY_CNF result when done
+ */
+struct fleet_dev {
+	uint8_t				mac[ETH_ALEN];
+	char				*npw;
+	char				*dpw;
+	struct set_encryption_key_request req;
+	enum fleet_state		state;
+	int				tries;
+	long long			deadline;
+	uint8_t				status;
+};
+
+static long long fleet_clock_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * fleet_parse - read a manifest of "MAC,DPW,NPW" lines
+ * @path:	manifest file
+ * @devs:	receives the devices
+ *
+ * Blank lines and lines starting with '#' are skipped. An empty DPW
+ * only sets the NMK. The NPW is the rest of the line.
+ * Returns the number of devices, -1 on error.
+ */
+static int fleet_parse(const char *path, struct fleet_dev **devs)
+{
+	struct fleet_dev *dev, *list = NULL;
+	char *line = NULL, *dpw, *npw;
+	size_t size = 0;
+	ssize_t len;
+	int n = 0, max = 0, lineno = 0, i;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+
+	while ((len = getline(&line, &size, fp)) >= 0) {
+		lineno++;
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = '\0';
+		if (!len || line[0] == '#')
+			continue;
+
+		if (n == max) {
+			max = max ? max * 2 : 64;
+			dev = realloc(list, max * sizeof(*list));
+			if (!dev) {
+				perror("realloc");
+				goto out_err;
+			}
+			list = dev;
+		}
+		dev = &list[n];
+		memset(dev, 0, sizeof(*dev));
+
+		dpw = strchr(line, ',');
+		npw = dpw ? strchr(dpw + 1, ',') : NULL;
+		if (!npw || !npw[1]) {
+			fprintf(stderr, "%s:%d: expected MAC,DPW,NPW\n", path, lineno);
+			goto out_err;
+		}
+		*dpw++ = '\0';
+		*npw++ = '\0';
+
+		if (sscanf(line, "%"SCNx8":%"SCNx8":%"SCNx8":%"SCNx8":%"SCNx8":%"SCNx8"",
+			   &dev->mac[0], &dev->mac[1], &dev->mac[2],
+			   &dev->mac[3], &dev->mac[4], &dev->mac[5]) != ETH_ALEN) {
+			fprintf(stderr, "%s:%d: invalid MAC address\n", path, lineno);
+			goto out_err;
+		}
+
+		/* Confirms are matched by source MAC, which must be unique */
+		for (i = 0; i < n; i++) {
+			if (!memcmp(list[i].mac, dev->mac, ETH_ALEN)) {
+				fprintf(stderr, "%s:%d: duplicate MAC address\n", path, lineno);
+				goto out_err;
+			}
+		}
+
+		dev->npw = strdup(npw);
+		dev->dpw = *dpw ? strdup(dpw) : NULL;
+		n++;
+		if (!dev->npw || (*dpw && !dev->dpw)) {
+			perror("strdup");
+			goto out_err;
+		}
+	}
+
+	free(line);
+	fclose(fp);
+	*devs = list;
+
+	return n;
+
+out_err:
+	for (i = 0; i < n; i++) {
+		free(list[i].npw);
+		free(list[i].dpw);
+	}
+	free(list);
+	free(line);
+	fclose(fp);
+	return -1;
+}
+
+/**
+ * fleet_derive - derive the keys of every device in batches
+ */
+static int fleet_derive(struct fleet_dev *devs, int n)
+{
+	const char **pw;
+	uint8_t *nmk, *dak;
+	int *with_dak;
+	int i, d = 0, ret = -1;
+
+	pw = malloc(n * sizeof(*pw));
+	nmk = malloc(n * 16);
+	dak = malloc(n * 16);
+	with_dak = malloc(n * sizeof(*with_dak));
+	if (!pw || !nmk || !dak || !with_dak) {
+		perror("malloc");
+		goto out;
+	}
+
+	for (i = 0; i < n; i++)
+		pw[i] = devs[i].npw;
+	gen_passphrase_batch(pw, n, nmk_salt, nmk);
+
+	for (i = 0; i < n; i++) {
+		if (devs[i].dpw) {
+			with_dak[d] = i;
+			pw[d++] = devs[i].dpw;
+		}
+	}
+	gen_passphrase_batch(pw, d, dak_salt, dak);
+
+	for (i = 0; i < n; i++)
+		fill_key_req(&devs[i].req, nmk + i * 16, NULL, devs[i].mac);
+	for (i = 0; i < d; i++) {
+		memcpy(devs[with_dak[i]].req.dak, dak + i * 16, AES_KEY_SIZE);
+		devs[with_dak[i]].req.peks_payload = DST_STA_DAK;
+	}
+	ret = 0;
+
+out:
+	free(pw);
+	free(nmk);
+	free(dak);
+	free(with_dak);
+	return ret;
+}
+
+static void fleet_send(struct context *ctx, struct fleet_dev *dev, long long now)
+{
+	dev->state = FLEET_SENT;
+	dev->tries++;
+	dev->deadline = now + FLEET_TIMEOUT_MS;
+
+	/* A failed send is retried like a lost one */
+	send_vendor_pkt(ctx, dev->mac, HPAV_MMTYPE_SET_KEY_REQ,
+			&dev->req, sizeof(dev->req));
+}
+
+/**
+ * fleet_recv - consume the pending SET_KEY_CNFs
+ * @inflight:	indexes of the devices waiting for a confirm
+ * @ninflight:	number of @inflight entries, updated
+ * Returns the number of devices done.
+ */
+static int fleet_recv(struct context *ctx, struct fleet_dev *devs,
+		      int *inflight, int *ninflight)
+{
+	uint8_t frame[ETH_DATA_LEN];
+	struct hpav_frame *hpav_frame = (struct hpav_frame *)frame;
+	struct sockaddr_ll ll;
+	socklen_t sk_len;
+	ssize_t len;
+	int i, done = 0;
+
+	for (;;) {
+		sk_len = sizeof(ll);
+		len = recvfrom(ctx->sock_fd, frame, sizeof(frame), MSG_DONTWAIT,
+				(struct sockaddr *)&ll, &sk_len);
+		if (len < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				perror("recvfrom");
+			break;
+		}
+		if (len < HPAV_MIN_FRAMSIZ ||
+		    le16toh(hpav_frame->header.mmtype) != HPAV_MMTYPE_SET_KEY_CNF)
+			continue;
+
+		for (i = 0; i < *ninflight; i++) {
+			struct fleet_dev *dev = &devs[inflight[i]];
+
+			if (memcmp(dev->mac, ll.sll_addr, ETH_ALEN))
+				continue;
+			dev->state = FLEET_DONE;
+			dev->status = hpav_frame->payload.vendor.data[0];
+			inflight[i] = inflight[--(*ninflight)];
+			done++;
+			break;
+		}
+	}
+
+	return done;
+}
+
+static const char *fleet_result(const struct fleet_dev *dev, char *buf, size_t len)
+{
+	if (dev->state == FLEET_TIMEOUT)
+		return "timeout";
+
+	switch (dev->status) {
+	case KEY_SUCCESS:
+		return "success";
+	case KEY_INV_EKS:
+		return "invalid EKS";
+	case KEY_INV_PKS:
+		return "invalid PKS";
+	default:
+		snprintf(buf, len, "unknown 0x%02x", dev->status);
+		return buf;
+	}
+}
+
+/**
+ * provision_fleet - set the keys of every device of a manifest
+ * @ctx:	socket context
+ * @path:	manifest of "MAC,DPW,NPW" lines
+ * @window:	SET_KEY_REQs outstanding at once
+ *
+ * Confirms are matched by source MAC. Each device gets FLEET_TRIES
+ * requests, FLEET_TIMEOUT_MS apart, before it is reported as timed out.
+ * Returns 0 when every device confirmed with success.
+ */
+static int provision_fleet(struct context *ctx, const char *path, int window)
+{
+	struct fleet_dev *devs = NULL;
+	struct pollfd pfd;
+	int *inflight = NULL;
+	int n, i, next = 0, ninflight = 0, done = 0, failed = 0, timeout;
+	long long now, start, first;
+	char buf[16];
+
+	n = fleet_parse(path, &devs);
+	if (n <= 0)
+		return n ? 1 : 0;
+
+	if (window < 1)
+		window = FLEET_WINDOW;
+	if (window > n)
+		window = n;
+
+	inflight = malloc(window * sizeof(*inflight));
+	if (!inflight) {
+		perror("malloc");
+		failed = n;
+		goto out;
+	}
+
+	if (fleet_derive(devs, n)) {
+		failed = n;
+		goto out;
+	}
+
+	pfd.fd = ctx->sock_fd;
+	pfd.events = POLLIN;
+	start = fleet_clock_ms();
+
+	while (done < n) {
+		now = fleet_clock_ms();
+
+		/* Resend or give up on the requests that timed out */
+		for (i = 0; i < ninflight; ) {
+			struct fleet_dev *dev = &devs[inflight[i]];
+
+			if (dev->deadline > now) {
+				i++;
+			} else if (dev->tries < FLEET_TRIES) {
+				fleet_send(ctx, dev, now);
+				i++;
+			} else {
+				dev->state = FLEET_TIMEOUT;
+				inflight[i] = inflight[--ninflight];
+				done++;
+			}
+		}
+
+		/* Fill the window */
+		while (ninflight < window && next < n) {
+			fleet_send(ctx, &devs[next], now);
+			inflight[ninflight++] = next++;
+		}
+
+		if (!ninflight)
+			continue;
+
+		first = devs[inflight[0]].deadline;
+		for (i = 1; i < ninflight; i++)
+			if (devs[inflight[i]].deadline < first)
+				first = devs[inflight[i]].deadline;
+		timeout = first > now ? (int)(first - now) : 0;
+
+		if (poll(&pfd, 1, timeout) > 0)
+			done += fleet_recv(ctx, devs, inflight, &ninflight);
+	}
+
+	fprintf(stdout, "%-17s  %-5s  %s\n", "MAC", "TRIES", "RESULT");
+	for (i = 0; i < n; i++) {
+		const uint8_t *m = devs[i].mac;
+
+		if (devs[i].state != FLEET_DONE || devs[i].status != KEY_SUCCESS)
+			failed++;
+		fprintf(stdout, "%02x:%02x:%02x:%02x:%02x:%02x  %-5d  %s\n",
+			m[0], m[1], m[2], m[3], m[4], m[5], devs[i].tries,
+			fleet_result(&devs[i], buf, sizeof(buf)));
+	}
+	fprintf(stdout, "%d/%d devices provisioned in %lld ms\n",
+		n - failed, n, fleet_clock_ms() - start);
+
+out:
+	for (i = 0; i < n; i++) {
+		free(devs[i].npw);
+		free(devs[i].dpw);
+	}
+	free(devs);
+	free(inflight);
+
+	return failed ? 1 : 0;
+}
+
 static int pushbutton_request(struct context *ctx, uint8_t *mac)
 {
 	return send_vendor_pkt(ctx, mac, HPAV_MMTYPE_MS_PB_ENC,
@@ -264,6 +609,66 @@ static int send_reset(struct context *ctx, uint8_t *mac)
 					NULL, 0);
 }
 
+static void print_keys(const uint8_t *keys, int n)
+{
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < 16; j++)
+			fprintf(stdout, "%02x", keys[i * 16 + j]);
+		fprintf(stdout, "\n");
+	}
+}
+
+/* Passphrases read from stdin and hashed together */
+#define HASH_BATCH	4096
+
+/**
+ * generate_passphrases - hash one passphrase per line of stdin
+ * @salt:	salt type (NMK or DAK)
+ */
+static int generate_passphrases(const unsigned char *salt)
+{
+	static char *passwords[HASH_BATCH];
+	static uint8_t keys[HASH_BATCH * 16];
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	int n = 0, i, ret = 0;
+
+	for (;;) {
+		len = getline(&line, &size, stdin);
+		if (len >= 0) {
+			while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+				line[--len] = '\0';
+			passwords[n] = strdup(line);
+			if (!passwords[n]) {
+				perror("strdup");
+				ret = 1;
+				break;
+			}
+			n++;
+		}
+
+		if (n == HASH_BATCH || (len < 0 && n)) {
+			gen_passphrase_batch((const char **)passwords, n, salt, keys);
+			print_keys(keys, n);
+			for (i = 0; i < n; i++)
+				free(passwords[i]);
+			n = 0;
+		}
+
+		if (len < 0)
+			break;
+	}
+
+	for (i = 0; i < n; i++)
+		free(passwords[i]);
+	free(line);
+
+	return ret;
+}
+
 static int generate_passphrase(struct context *ctx,
 				const char *npw, const char *dpw)
 {
@@ -275,6 +680,11 @@ static int generate_passphrase(struct context *ctx,
 		return 1;
 	}
 
+	if (npw && !strcmp(npw, "-"))
+		return generate_passphrases(nmk_salt);
+	if (!npw && !strcmp(dpw, "-"))
+		return generate_passphrases(dak_salt);
+
 	if (npw)
 		gen_passphrase(npw, key, nmk_salt);
 	else
@@ -303,7 +713,10 @@ static void usage(void)
 			"-a:	device MAC address\n"
 			"-r:	send a device reset\n"
 			"-u:	PusbButton request\n"
-			"-k:	hash only\n");
+			"-f:	provision every \"MAC,DPW,NPW\" line of a manifest file\n"
+			"-w:	SET_KEY_REQs outstanding at once with -f (default 32)\n"
+			"-k:	hash only, \"-n -\" or \"-d -\" hashes one passphrase per line of stdin\n"
+			"-K:	do not use the derived key cache ($" KEYCACHE_ENV " or ~/.faifa_keycache)\n");
 }
 
 int main(int argc, char **argv)
@@ -314,15 +727,18 @@ int main(int argc, char **argv)
 	const char *npw = NULL;
 	const char *dpw = NULL;
 	const char *iface = NULL;
+	const char *manifest = NULL;
+	int window = FLEET_WINDOW;
 	struct context ctx;
 	unsigned int hash_only = 0;
 	unsigned int reset_device = 0;
 	unsigned int push_button = 0;
+	unsigned int use_cache = 1;
 	uint8_t mac[ETH_ALEN] = { 0 };
 
 	memset(&ctx, 0, sizeof(ctx));
 
-	while ((opt = getopt(argc, argv, "n:d:p:a:i:ukrh")) > 0) {
+	while ((opt = getopt(argc, argv, "n:d:p:a:i:f:w:ukKrh")) > 0) {
 		switch (opt) {
 		case 'n':
 		case 'p':
@@ -337,9 +753,18 @@ int main(int argc, char **argv)
 		case 'i':
 			iface = optarg;
 			break;
+		case 'f':
+			manifest = optarg;
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
 		case 'k':
 			hash_only = 1;
 			break;
+		case 'K':
+			use_cache = 0;
+			break;
 		case 'r':
 			reset_device = 1;
 			break;
@@ -361,6 +786,10 @@ int main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
+	/* Only a cache that can not be used is worth a warning */
+	if (use_cache && (npw || dpw || manifest) && keycache_open(NULL) && errno != ENOENT)
+		fprintf(stderr, "key cache disabled: %s\n", strerror(errno));
+
 	if (hash_only)
 		return generate_passphrase(&ctx, npw, dpw);
 
@@ -382,7 +811,7 @@ int main(int argc, char **argv)
 			return ret;
 		}
 		fprintf(stdout, "MAC: %s\n", mac_address);
-	} else {
+	} else if (!manifest) {
 		memcpy(mac, bcast_hpav_mac, sizeof(bcast_hpav_mac));
 		fprintf(stdout, "MAC: using broadcast HPAV\n");
 	}
@@ -393,6 +822,9 @@ int main(int argc, char **argv)
 		return ret;
 	}
 
+	if (manifest)
+		return provision_fleet(&ctx, manifest, window);
+
 	if (reset_device) {
 		ret = send_reset(&ctx, mac);
 		if (ret)
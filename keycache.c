@@ -0,0 +1,341 @@
+/*
+ *  Persistent cache of derived HomePlug AV keys
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crypto.h"
+#include "keycache.h"
+#include "sha2.h"
+
+#define KEYCACHE_MAGIC		"FAIFAKC1"
+#define KEYCACHE_VERSION	1
+#define KEYCACHE_SLOTS		65536	/* 4 MiB of entries */
+#define KEYCACHE_PROBE		8	/* slots tried per lookup */
+#define KEYCACHE_TAG_SIZ	16
+#define KEYCACHE_MAC_SIZ	16
+
+/**
+ * keycache_hdr - cache file header
+ * @magic:	KEYCACHE_MAGIC
+ * @version:	KEYCACHE_VERSION
+ * @slots:	number of entries following the header
+ * @secret:	random key of the tag and MAC hashes
+ * @mac:	hash of the fields above
+ */
+struct keycache_hdr {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	slots;
+	uint8_t		secret[32];
+	uint8_t		mac[KEYCACHE_MAC_SIZ];
+};
+
+/**
+ * keycache_entry - one cached key
+ * @tag:	keyed hash of the salt and secret
+ * @digest:	derived hash
+ * @mac:	keyed hash of @tag and @digest, all zeroes when unused
+ */
+struct keycache_entry {
+	uint8_t		tag[KEYCACHE_TAG_SIZ];
+	uint8_t		digest[SHA256_DIGEST_LENGTH];
+	uint8_t		mac[KEYCACHE_MAC_SIZ];
+};
+
+static struct keycache_hdr *cache;
+static struct keycache_entry *entries;
+static size_t cache_size;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void keycache_hash(const uint8_t *secret, const void *a, size_t alen,
+			  const void *b, size_t blen, uint8_t *out, size_t outlen)
+{
+	SHA256_CTX context;
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+
+	SHA256_Init(&context);
+	SHA256_Update(&context, secret, 32);
+	SHA256_Update(&context, a, alen);
+	SHA256_Update(&context, b, blen);
+	SHA256_Final(digest, &context);
+	memcpy(out, digest, outlen);
+}
+
+static void keycache_hdr_mac(const struct keycache_hdr *hdr, uint8_t *mac)
+{
+	keycache_hash(hdr->secret, hdr->magic, sizeof(hdr->magic),
+		      &hdr->version, sizeof(hdr->version) + sizeof(hdr->slots),
+		      mac, KEYCACHE_MAC_SIZ);
+}
+
+static void keycache_tag(const u_int8_t *secret, size_t len,
+			 const unsigned char *salt, uint8_t *tag)
+{
+	uint8_t buf[SALT_SIZ + 1 + MAX_SECRET_SIZ];
+
+	/* The length keeps secrets that prefix each other apart */
+	memcpy(buf, salt, SALT_SIZ);
+	buf[SALT_SIZ] = (uint8_t)len;
+	memcpy(buf + SALT_SIZ + 1, secret, len);
+	keycache_hash(cache->secret, buf, SALT_SIZ + 1 + len, NULL, 0,
+		      tag, KEYCACHE_TAG_SIZ);
+}
+
+static int keycache_init(int fd, size_t size)
+{
+	struct keycache_hdr hdr;
+	int rnd;
+	ssize_t ret;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, KEYCACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = KEYCACHE_VERSION;
+	hdr.slots = KEYCACHE_SLOTS;
+
+	rnd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (rnd < 0)
+		return -1;
+	ret = read(rnd, hdr.secret, sizeof(hdr.secret));
+	close(rnd);
+	if (ret != sizeof(hdr.secret)) {
+		errno = EIO;
+		return -1;
+	}
+	keycache_hdr_mac(&hdr, hdr.mac);
+
+	/* Drop every old entry, they were keyed by the old secret */
+	if (ftruncate(fd, 0) || ftruncate(fd, size))
+		return -1;
+	if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		return -1;
+
+	return 0;
+}
+
+static int keycache_valid(const struct keycache_hdr *hdr, off_t size)
+{
+	uint8_t mac[KEYCACHE_MAC_SIZ];
+
+	if (size != (off_t)(sizeof(*hdr) + KEYCACHE_SLOTS * sizeof(struct keycache_entry)))
+		return 0;
+	if (memcmp(hdr->magic, KEYCACHE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != KEYCACHE_VERSION || hdr->slots != KEYCACHE_SLOTS)
+		return 0;
+
+	keycache_hdr_mac(hdr, mac);
+
+	return !memcmp(mac, hdr->mac, sizeof(mac));
+}
+
+int keycache_open(const char *path)
+{
+	char buf[4096];
+	struct stat st;
+	struct keycache_hdr hdr;
+	size_t size = sizeof(hdr) + KEYCACHE_SLOTS * sizeof(struct keycache_entry);
+	void *map;
+	int fd, err;
+
+	keycache_close();
+
+	if (!path)
+		path = getenv(KEYCACHE_ENV);
+	if (!path) {
+		if (!getenv("HOME")) {
+			errno = ENOENT;
+			return -1;
+		}
+		snprintf(buf, sizeof(buf), "%s/.faifa_keycache", getenv("HOME"));
+		path = buf;
+	}
+
+	fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st))
+		goto out_err;
+
+	/* The cache holds keys, only its owner may ever read it */
+	if (!S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+	    (st.st_mode & (S_IRWXG | S_IRWXO))) {
+		errno = EPERM;
+		goto out_err;
+	}
+
+	if (flock(fd, LOCK_EX))
+		goto out_err;
+
+	if (fstat(fd, &st))
+		goto out_unlock;
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    !keycache_valid(&hdr, st.st_size)) {
+		if (keycache_init(fd, size))
+			goto out_unlock;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto out_unlock;
+
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	cache = map;
+	entries = (struct keycache_entry *)(cache + 1);
+	cache_size = size;
+
+	return 0;
+
+out_unlock:
+	err = errno;
+	flock(fd, LOCK_UN);
+	errno = err;
+out_err:
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+void keycache_close(void)
+{
+	if (!cache)
+		return;
+
+	munmap(cache, cache_size);
+	cache = NULL;
+	entries = NULL;
+	cache_size = 0;
+}
+
+static int keycache_entry_valid(const struct keycache_entry *e)
+{
+	uint8_t mac[KEYCACHE_MAC_SIZ];
+
+	keycache_hash(cache->secret, e->tag, sizeof(e->tag),
+		      e->digest, sizeof(e->digest), mac, sizeof(mac));
+
+	return !memcmp(mac, e->mac, sizeof(mac));
+}
+
+int keycache_lookup(const u_int8_t *secret, size_t len,
+		    const unsigned char *salt, u_int8_t *digest)
+{
+	struct keycache_entry e;
+	uint8_t tag[KEYCACHE_TAG_SIZ];
+	uint32_t slot;
+	int i;
+
+	if (!cache || !salt || len > MAX_SECRET_SIZ)
+		return -1;
+
+	keycache_tag(secret, len, salt, tag);
+	memcpy(&slot, tag, sizeof(slot));
+
+	for (i = 0; i < KEYCACHE_PROBE; i++) {
+		/* Another process may be writing the entry: copy it, then check */
+		pthread_mutex_lock(&cache_lock);
+		memcpy(&e, &entries[(slot + i) % KEYCACHE_SLOTS], sizeof(e));
+		pthread_mutex_unlock(&cache_lock);
+		if (memcmp(e.tag, tag, sizeof(tag)))
+			continue;
+		if (!keycache_entry_valid(&e))
+			return -1;
+		memcpy(digest, e.digest, sizeof(e.digest));
+		return 0;
+	}
+
+	return -1;
+}
+
+void keycache_store(const u_int8_t *secret, size_t len,
+		    const unsigned char *salt, const u_int8_t *digest)
+{
+	struct keycache_entry e, *victim = NULL, *cur;
+	uint32_t slot;
+	int i;
+
+	if (!cache || !salt || len > MAX_SECRET_SIZ)
+		return;
+
+	keycache_tag(secret, len, salt, e.tag);
+	memcpy(e.digest, digest, sizeof(e.digest));
+	keycache_hash(cache->secret, e.tag, sizeof(e.tag),
+		      e.digest, sizeof(e.digest), e.mac, sizeof(e.mac));
+	memcpy(&slot, e.tag, sizeof(slot));
+
+	pthread_mutex_lock(&cache_lock);
+	for (i = 0; i < KEYCACHE_PROBE; i++) {
+		cur = &entries[(slot + i) % KEYCACHE_SLOTS];
+		if (!memcmp(cur->tag, e.tag, sizeof(e.tag)) || !keycache_entry_valid(cur)) {
+			victim = cur;
+			break;
+		}
+	}
+	/* All probed slots in use: evict the first one */
+	if (!victim)
+		victim = &entries[slot % KEYCACHE_SLOTS];
+	memcpy(victim, &e, sizeof(e));
+	pthread_mutex_unlock(&cache_lock);
+}
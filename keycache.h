@@ -0,0 +1,101 @@
+/*
+ *  Persistent cache of derived HomePlug AV keys
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+#ifndef __KEYCACHE_H__
+#define __KEYCACHE_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+
+/* Environment variable overriding the default cache path */
+#define KEYCACHE_ENV	"FAIFA_KEYCACHE"
+
+/**
+ * keycache_open - map the derived key cache
+ * @path:	cache file, NULL for $FAIFA_KEYCACHE or ~/.faifa_keycache
+ *
+ * The file is created with mode 0600 and refused if it is not a
+ * regular file owned by the effective user, or if group or others
+ * can access it. Call before deriving keys from several threads.
+ * @return
+ *	0 on success, -1 on failure with errno set
+ */
+extern int keycache_open(const char *path);
+
+/**
+ * keycache_close - unmap the derived key cache
+ */
+extern void keycache_close(void);
+
+/**
+ * keycache_lookup - find a derived key
+ * @secret:	secret the key was derived from
+ * @len:	length of @secret
+ * @salt:	salt the key was derived with
+ * @digest:	receives the 32 bytes derived hash on a hit
+ * @return
+ *	0 on a hit, -1 on a miss or when no cache is open
+ */
+extern int keycache_lookup(const u_int8_t *secret, size_t len,
+			   const unsigned char *salt, u_int8_t *digest);
+
+/**
+ * keycache_store - remember a derived key
+ * @secret:	secret the key was derived from
+ * @len:	length of @secret
+ * @salt:	salt the key was derived with
+ * @digest:	32 bytes derived hash
+ */
+extern void keycache_store(const u_int8_t *secret, size_t len,
+			   const unsigned char *salt, const u_int8_t *digest);
+
+#endif /* __KEYCACHE_H__ */
@@ -0,0 +1,483 @@
+/*
+ *  Link statistics poller
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+#include <sys/types.h>
+#ifndef __CYGWIN__
+#include <net/ethernet.h>
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <time.h>
+
+#include "faifa.h"
+#include "faifa_compat.h"
+#include "faifa_priv.h"
+#include "frame.h"
+#include "homeplug_av.h"
+#include "device.h"
+#include "tonemap.h"
+
+extern FILE *err_stream;
+extern FILE *out_stream;
+extern int dump_hex(void *buf, int len, char *sep);
+
+#define LS_MAX_LINKS		256
+#define LS_REPLY_TIMEOUT	1000	/* ms to wait for confirms */
+#define LS_DISCOVER_ROUNDS	10	/* rounds between two peer discoveries */
+
+/**
+ * ls_link - statistics state of a (peer, link ID) pair
+ * @macaddr:	peer MAC address
+ * @tei:	peer TEI, used to match the confirms
+ * @link_id:	link ID
+ * @valid:	a previous sample is available
+ * @answered:	a confirm was received for the current round
+ * @when:	time of the previous sample (ms)
+ * @tx:		previous transmit counters
+ * @rx:		previous receive counters
+ */
+struct ls_link {
+	u_int8_t		macaddr[ETHER_ADDR_LEN];
+	u_int8_t		tei;
+	u_int8_t		link_id;
+	int			valid;
+	int			answered;
+	u_int64_t		when;
+	struct tx_link_stats	tx;
+	struct rx_link_stats	rx;
+};
+
+struct ls_ctx {
+	faifa_t		*faifa;
+	struct ls_link	links[LS_MAX_LINKS];
+	int		num_links;
+	u_int8_t	frame[ETHER_MAX_LEN];
+};
+
+static volatile sig_atomic_t ls_stopped;
+
+/**
+ * link_stats_stop - make the pollers return, may be called from a signal handler
+ */
+void link_stats_stop(void)
+{
+	ls_stopped = 1;
+}
+
+static struct ls_link *ls_get_link(struct ls_ctx *ctx, u_int8_t *macaddr, u_int8_t link_id)
+{
+	struct ls_link *link;
+	int i;
+
+	for (i = 0; i < ctx->num_links; i++) {
+		link = &ctx->links[i];
+		if (link->link_id == link_id && !memcmp(link->macaddr, macaddr, ETHER_ADDR_LEN))
+			return link;
+	}
+
+	if (ctx->num_links == LS_MAX_LINKS)
+		return NULL;
+
+	link = &ctx->links[ctx->num_links++];
+	memset(link, 0, sizeof(*link));
+	memcpy(link->macaddr, macaddr, ETHER_ADDR_LEN);
+	link->link_id = link_id;
+
+	return link;
+}
+
+/**
+ * ls_discover - learn the peers of the local device from a Network Info Confirm
+ * @ctx:	poller context
+ * @return
+ *	number of peers, -1 on error
+ */
+static int ls_discover(struct ls_ctx *ctx)
+{
+	struct network_info_confirm *mm;
+	struct ls_link *link;
+	u_int8_t *payload;
+	u_int16_t mmtype;
+	u_int64_t deadline;
+	int i, n;
+
+	if (hpav_send_mme(ctx->faifa, HPAV_MMTYPE_NW_INFO_REQ, ctx->faifa->dst_addr, NULL, 0) < 0)
+		return -1;
+
+	deadline = faifa_clock_ms() + LS_REPLY_TIMEOUT;
+	while (faifa_clock_ms() < deadline) {
+		n = hpav_recv_mme(ctx->faifa, ctx->frame, sizeof(ctx->frame), &mmtype, &payload, NULL);
+		if (n < 0)
+			return -1;
+		if (mmtype != HPAV_MMTYPE_NW_INFO_CNF || n < (int)sizeof(*mm))
+			continue;
+
+		mm = (struct network_info_confirm *)payload;
+		if (n < (int)(sizeof(*mm) + mm->num_stas * sizeof(mm->stas[0])))
+			continue;
+
+		for (i = 0; i < mm->num_stas; i++) {
+			hpav_device_update(mm->stas[i].sta_macaddr, mm->snid, mm->stas[i].sta_tei);
+			link = ls_get_link(ctx, mm->stas[i].sta_macaddr, HPAV_LID_CSMA_SUM);
+			if (link)
+				link->tei = mm->stas[i].sta_tei;
+		}
+
+		return mm->num_stas;
+	}
+
+	return 0;
+}
+
+static int ls_send_requests(struct ls_ctx *ctx)
+{
+	struct link_statistics_request req;
+	int i, sent = 0;
+
+	for (i = 0; i < ctx->num_links; i++) {
+		memset(&req, 0, sizeof(req));
+		req.direction = HPAV_SD_BOTH;
+		req.link_id = ctx->links[i].link_id;
+		memcpy(req.macaddr, ctx->links[i].macaddr, ETHER_ADDR_LEN);
+
+		ctx->links[i].answered = 0;
+		if (hpav_send_mme(ctx->faifa, HPAV_MMTYPE_LNK_STATS_REQ,
+				  ctx->faifa->dst_addr, &req, sizeof(req)) < 0)
+			faifa_printf(err_stream, "Cannot send request: %s\n", faifa_error(ctx->faifa));
+		else
+			sent++;
+	}
+
+	return sent;
+}
+
+static double ls_ratio(u_int64_t num, u_int64_t den)
+{
+	return den ? (double)num / den : 0.0;
+}
+
+/**
+ * ls_counters_reset - check whether the device counters went backwards,
+ * which happens when the device reboots or the counters get cleared
+ */
+static int ls_counters_reset(struct ls_link *link, struct tx_link_stats *tx, struct rx_link_stats *rx)
+{
+	return tx->mpdu_ack < link->tx.mpdu_ack || tx->mpdu_coll < link->tx.mpdu_coll ||
+	       tx->mpdu_fail < link->tx.mpdu_fail || tx->pb_passed < link->tx.pb_passed ||
+	       tx->pb_failed < link->tx.pb_failed || rx->mpdu_ack < link->rx.mpdu_ack ||
+	       rx->mpdu_fail < link->rx.mpdu_fail || rx->pb_passed < link->rx.pb_passed ||
+	       rx->pb_failed < link->rx.pb_failed;
+}
+
+static void ls_update(struct ls_link *link, struct tx_link_stats *tx, struct rx_link_stats *rx, u_int64_t now)
+{
+	u_int64_t tx_mpdu, tx_pb, tx_pb_err, tx_coll, rx_mpdu, rx_pb, rx_pb_err;
+	double dt;
+
+	dump_hex(link->macaddr, ETHER_ADDR_LEN, ":");
+	faifa_printf(out_stream, " 0x%02hx 0x%02hx ", link->tei, link->link_id);
+
+	if (!link->valid) {
+		faifa_printf(out_stream, "first sample\n");
+		goto out;
+	}
+
+	if (ls_counters_reset(link, tx, rx)) {
+		faifa_printf(out_stream, "counters reset\n");
+		goto out;
+	}
+
+	dt = (double)(now - link->when) / 1000;
+	if (dt <= 0)
+		dt = 1;
+
+	tx_coll = tx->mpdu_coll - link->tx.mpdu_coll;
+	tx_mpdu = tx->mpdu_ack - link->tx.mpdu_ack + tx->mpdu_fail - link->tx.mpdu_fail;
+	tx_pb_err = tx->pb_failed - link->tx.pb_failed;
+	tx_pb = tx->pb_passed - link->tx.pb_passed + tx_pb_err;
+	rx_mpdu = rx->mpdu_ack - link->rx.mpdu_ack + rx->mpdu_fail - link->rx.mpdu_fail;
+	rx_pb_err = rx->pb_failed - link->rx.pb_failed;
+	rx_pb = rx->pb_passed - link->rx.pb_passed + rx_pb_err;
+
+	faifa_printf(out_stream, "%9.1f %9.1f %9.4f %9.4f %9.1f %9.1f %9.4f\n",
+		tx_mpdu / dt, tx_pb / dt, ls_ratio(tx_pb_err, tx_pb),
+		ls_ratio(tx_coll, tx_mpdu + tx_coll),
+		rx_mpdu / dt, rx_pb / dt, ls_ratio(rx_pb_err, rx_pb));
+out:
+	link->tx = *tx;
+	link->rx = *rx;
+	link->when = now;
+	link->valid = 1;
+}
+
+static int ls_process_confirm(struct ls_ctx *ctx, u_int8_t *payload, int len)
+{
+	struct link_statistics_confirm *mm = (struct link_statistics_confirm *)payload;
+	struct ls_link *link = NULL;
+	struct tx_link_stats tx;
+	struct rx_link_stats rx;
+	int i;
+
+	if (len < 4)
+		return 0;
+
+	for (i = 0; i < ctx->num_links; i++) {
+		if (!ctx->links[i].answered && ctx->links[i].tei == mm->tei &&
+		    ctx->links[i].link_id == mm->link_id) {
+			link = &ctx->links[i];
+			break;
+		}
+	}
+	if (!link)
+		return 0;
+
+	link->answered = 1;
+	if (mm->mstatus != HPAV_SUC) {
+		dump_hex(link->macaddr, ETHER_ADDR_LEN, ":");
+		faifa_printf(out_stream, " 0x%02hx 0x%02hx error 0x%02hx\n",
+			link->tei, link->link_id, mm->mstatus);
+		return 1;
+	}
+
+	if (mm->direction != HPAV_SD_BOTH ||
+	    len < (int)(offsetof(struct link_statistics_confirm, both.rx) + sizeof(rx)))
+		return 1;
+
+	/* copy out of the packed frame before using the counters */
+	memcpy(&tx, &mm->both.tx, sizeof(tx));
+	memcpy(&rx, &mm->both.rx, sizeof(rx));
+	ls_update(link, &tx, &rx, faifa_clock_ms());
+
+	return 1;
+}
+
+/**
+ * link_stats_poll - poll the link statistics of all the known peers
+ * @faifa:	private handle
+ * @interval:	polling interval in seconds
+ * @return
+ *	0 once link_stats_stop is called, -1 on error
+ */
+int link_stats_poll(faifa_t *faifa, int interval)
+{
+	struct ls_ctx *ctx;
+	u_int8_t *payload;
+	u_int16_t mmtype;
+	u_int64_t now, next, deadline;
+	int round, pending, n;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -1;
+	ctx->faifa = faifa;
+
+	for (round = 0; !ls_stopped; round++) {
+		next = faifa_clock_ms() + (u_int64_t)interval * 1000;
+
+		if (round % LS_DISCOVER_ROUNDS == 0 || !ctx->num_links) {
+			if (ls_discover(ctx) < 0) {
+				faifa_printf(err_stream, "Discovery failed: %s\n", faifa_error(faifa));
+				goto out_error;
+			}
+		}
+
+		faifa_printf(out_stream, "\nStation MAC       TEI  LID  "
+			"TX MPDU/s   TX PB/s TX PB err TX coll   RX MPDU/s   RX PB/s RX PB err\n");
+		faifa_printf(out_stream, "----------------- ---- ---- "
+			"--------- --------- --------- --------- --------- --------- ---------\n");
+
+		pending = ls_send_requests(ctx);
+		deadline = faifa_clock_ms() + LS_REPLY_TIMEOUT;
+		while (pending > 0 && !ls_stopped && faifa_clock_ms() < deadline) {
+			n = hpav_recv_mme(faifa, ctx->frame, sizeof(ctx->frame), &mmtype, &payload, NULL);
+			if (n < 0)
+				goto out_error;
+			if (mmtype != HPAV_MMTYPE_LNK_STATS_CNF || n == 0)
+				continue;
+			pending -= ls_process_confirm(ctx, payload, n);
+		}
+		if (pending > 0 && !ls_stopped)
+			faifa_printf(err_stream, "%d link(s) did not answer\n", pending);
+
+		fflush(out_stream);
+		while (!ls_stopped && (now = faifa_clock_ms()) < next)
+			usleep((next - now) * 1000);
+	}
+
+	free(ctx);
+	return 0;
+
+out_error:
+	free(ctx);
+	return -1;
+}
+
+/**
+ * tm_poll_one - record the tone map of one slot of a peer
+ * @ctx:	poller context
+ * @h:		history to append to
+ * @link:	peer
+ * @slot:	tone map slot
+ * @answered:	set when a confirm was received
+ * @return
+ *	number of tone maps of the peer, 0 if it has none at @slot, -1 on error
+ */
+static int tm_poll_one(struct ls_ctx *ctx, tm_hist_t *h, struct ls_link *link, u_int8_t slot,
+		       int *answered)
+{
+	struct get_tone_map_charac_request req;
+	struct get_tone_map_charac_confirm *mm;
+	u_int8_t *payload;
+	u_int16_t mmtype;
+	u_int64_t deadline;
+	int n;
+
+	*answered = 0;
+
+	memset(&req, 0, sizeof(req));
+	memcpy(req.macaddr, link->macaddr, ETHER_ADDR_LEN);
+	req.tmslot = slot;
+	if (hpav_send_mme(ctx->faifa, HPAV_MMTYPE_TONE_MAP_REQ, ctx->faifa->dst_addr, &req, sizeof(req)) < 0)
+		return -1;
+
+	deadline = faifa_clock_ms() + LS_REPLY_TIMEOUT;
+	while (!ls_stopped && faifa_clock_ms() < deadline) {
+		n = hpav_recv_mme(ctx->faifa, ctx->frame, sizeof(ctx->frame), &mmtype, &payload, NULL);
+		if (n < 0)
+			return -1;
+		if (mmtype != HPAV_MMTYPE_TONE_MAP_CNF || n < (int)sizeof(*mm))
+			continue;
+
+		/* The confirm does not carry the peer address, so requests go one at a time */
+		mm = (struct get_tone_map_charac_confirm *)payload;
+		if (mm->tmslot != slot)
+			continue;
+
+		*answered = 1;
+		if (mm->mstatus != HPAV_SUC ||
+		    n < (int)(sizeof(*mm) + (mm->tm_num_act_carrier + 1) / 2))
+			return 0;
+
+		if (tm_hist_append(h, link->macaddr, slot, time(NULL),
+				   (u_int8_t *)mm->carriers, mm->tm_num_act_carrier))
+			faifa_printf(err_stream, "Cannot record tone map\n");
+
+		return mm->num_tms;
+	}
+
+	return 0;
+}
+
+/**
+ * tone_map_poll - record the tone maps of all the known peers into a history
+ * @faifa:	private handle
+ * @h:		history opened with tm_hist_open
+ * @interval:	polling interval in seconds
+ * @return
+ *	0 once link_stats_stop is called, -1 on error
+ */
+int tone_map_poll(faifa_t *faifa, tm_hist_t *h, int interval)
+{
+	struct ls_ctx *ctx;
+	u_int64_t now, next;
+	int round, i, slot, num_tms, answered, missing;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -1;
+	ctx->faifa = faifa;
+
+	for (round = 0; !ls_stopped; round++) {
+		next = faifa_clock_ms() + (u_int64_t)interval * 1000;
+
+		if (round % LS_DISCOVER_ROUNDS == 0 || !ctx->num_links) {
+			if (ls_discover(ctx) < 0) {
+				faifa_printf(err_stream, "Discovery failed: %s\n", faifa_error(faifa));
+				goto out_error;
+			}
+		}
+
+		/* Walk the slots of every peer, slot 0 tells how many there are */
+		missing = 0;
+		for (i = 0; i < ctx->num_links && !ls_stopped; i++) {
+			for (slot = 0, num_tms = 1; slot < num_tms && !ls_stopped; slot++) {
+				num_tms = tm_poll_one(ctx, h, &ctx->links[i], slot, &answered);
+				if (num_tms < 0) {
+					faifa_printf(err_stream, "%s\n", faifa_error(faifa));
+					goto out_error;
+				}
+				if (!answered) {
+					missing++;
+					break;
+				}
+			}
+		}
+		if (missing > 0 && !ls_stopped)
+			faifa_printf(err_stream, "%d peer(s) did not answer\n", missing);
+
+		while (!ls_stopped && (now = faifa_clock_ms()) < next)
+			usleep((next - now) * 1000);
+	}
+
+	free(ctx);
+	return 0;
+
+out_error:
+	free(ctx);
+	return -1;
+}
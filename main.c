@@ -51,11 +51,22 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/types.h>
 
 #include "faifa.h"
 #include "faifa_compat.h"
+#include "tonemap.h"
+#include "sniffer.h"
+
+/* Default number of outstanding requests during bulk transfers */
+#define XFER_WINDOW	8
+/* More than a station buffers only turns into retransmissions */
+#define XFER_WINDOW_MAX	64
 
 #ifndef FAIFA_PROG
 #define FAIFA_PROG "faifa"
@@ -68,6 +79,18 @@ int opt_key = 0;
 extern FILE *err_stream;
 extern FILE *out_stream;
 extern FILE *in_stream;
+extern tm_hist_t *tm_history;
+extern int sniffer_capture(faifa_t *faifa, const char *path, u_int32_t capacity);
+extern void sniffer_stop(void);
+extern void menu_stop(void);
+extern void link_stats_stop(void);
+extern int hpav_write_module(faifa_t *faifa, u_int8_t module_id, const char *path, unsigned int window);
+extern int hpav_read_module(faifa_t *faifa, u_int8_t module_id, const char *path, unsigned int window);
+extern int hpav_read_memory(faifa_t *faifa, u_int32_t address, u_int32_t length, const char *path,
+			    unsigned int window);
+extern int hpav_read_check_points(faifa_t *faifa, const char *path, int clear);
+extern int hpav_boot(faifa_t *faifa, u_int32_t address, u_int32_t entry, const char *path,
+		     const char *sdram, unsigned int window);
 
 /**
  * error - display error message
@@ -90,11 +113,59 @@ static void usage(void)
 			"-e : error stream (default: stderr)\n"
 			"-o : output stream (default: stdout)\n"
 			"-s : input stream (default: stdin)\n"
+			"-T : record tone maps into a history file\n"
+			"-t : poll the tone maps of every peer into the -T history every <interval> seconds\n"
+			"-l : poll link statistics every <interval> seconds\n"
+			"-S : capture sniffer indications into a ring file\n"
+			"-W : upload <module id>:<file> and commit it to NVM\n"
+			"-R : download <module id>:<file>\n"
+			"-M : dump MAC memory <address>:<length>:<file>\n"
+			"-P : retrieve the check point buffer into a file\n"
+			"-c : clear the check points once -P retrieved them\n"
+			"-B : boot an image from SDRAM <load address>:<entry point>:<file>\n"
+			"-C : SDRAM configuration file applied before booting\n"
+			"-w : requests in flight during bulk transfers (default: 8, at most 64)\n"
 			"-h : this help\n");
 }
 
+/**
+ * close_history - write out the pending tone map history blocks
+ */
+static void close_history(void)
+{
+	tm_hist_close(tm_history);
+	tm_history = NULL;
+}
+
+/*
+ * Only raise the stop flags: the loops notice them, and main closes the
+ * tone map history once no thread can append to it anymore.
+ */
+static void sighandler(int signo)
+{
+	sniffer_stop();
+	menu_stop();
+	link_stats_stop();
+}
+
+/**
+ * catch_signals - let SIGINT and SIGTERM stop the running loop
+ */
+static void catch_signals(void)
+{
+	struct sigaction sa;
+
+	/* No SA_RESTART, a blocked read of the menu has to be interrupted */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sighandler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
 extern void menu(faifa_t *faifa);
 extern void set_key(char *macaddr);
+extern int link_stats_poll(faifa_t *faifa, int interval);
+extern int tone_map_poll(faifa_t *faifa, tm_hist_t *h, int interval);
 
 /**
  * main - main function of faifa
@@ -109,6 +180,25 @@ int main(int argc, char **argv)
 	char *opt_err_stream = NULL;
 	char *opt_out_stream = NULL;
 	char *opt_in_stream = NULL;
+	char *opt_tm_history = NULL;
+	char *opt_sniffer = NULL;
+	int opt_poll_interval = 0;
+	int opt_tm_interval = 0;
+	char *opt_write_module = NULL;
+	unsigned int module_id;
+	char *opt_read_module = NULL;
+	char *opt_read_memory = NULL;
+	unsigned int mem_address, mem_length;
+	int mem_path_offset = 0;
+	char *opt_check_points = NULL;
+	int opt_clear_check_points = 0;
+	char *opt_boot = NULL;
+	char *opt_sdram = NULL;
+	unsigned int boot_address, boot_entry;
+	int boot_path_offset = 0;
+	unsigned int opt_window = XFER_WINDOW;
+	unsigned long window;
+	char *end;
 	int opt_verbose = 0;
 	int c;
 	int ret = 0;
@@ -121,7 +211,7 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	while ((c = getopt(argc, argv, "i:ma:k:ve:o:s:h")) != -1) {
+	while ((c = getopt(argc, argv, "i:ma:k:ve:o:s:T:t:l:S:W:R:M:P:cB:C:w:h")) != -1) {
 		switch (c) {
 			case 'i':
 				opt_ifname = optarg;
@@ -147,6 +237,62 @@ int main(int argc, char **argv)
 			case 's':
 				opt_in_stream = optarg;
 				break;
+			case 'T':
+				opt_tm_history = optarg;
+				break;
+			case 't':
+				opt_tm_interval = atoi(optarg);
+				if (opt_tm_interval <= 0)
+					opt_help = 1;
+				break;
+			case 'W':
+				opt_write_module = optarg;
+				if (sscanf(optarg, "%x:", &module_id) != 1 || !strchr(optarg, ':'))
+					opt_help = 1;
+				break;
+			case 'R':
+				opt_read_module = optarg;
+				if (sscanf(optarg, "%x:", &module_id) != 1 || !strchr(optarg, ':'))
+					opt_help = 1;
+				break;
+			case 'M':
+				opt_read_memory = optarg;
+				if (sscanf(optarg, "%x:%x:%n", &mem_address, &mem_length, &mem_path_offset) < 2 ||
+				    !mem_path_offset || !optarg[mem_path_offset])
+					opt_help = 1;
+				break;
+			case 'P':
+				opt_check_points = optarg;
+				break;
+			case 'c':
+				opt_clear_check_points = 1;
+				break;
+			case 'B':
+				opt_boot = optarg;
+				if (sscanf(optarg, "%x:%x:%n", &boot_address, &boot_entry, &boot_path_offset) < 2 ||
+				    !boot_path_offset || !optarg[boot_path_offset])
+					opt_help = 1;
+				break;
+			case 'C':
+				opt_sdram = optarg;
+				break;
+			case 'w':
+				errno = 0;
+				window = strtoul(optarg, &end, 10);
+				if (errno || !isdigit((unsigned char)*optarg) || *end ||
+				    window < 1 || window > XFER_WINDOW_MAX)
+					opt_help = 1;
+				else
+					opt_window = window;
+				break;
+			case 'S':
+				opt_sniffer = optarg;
+				break;
+			case 'l':
+				opt_poll_interval = atoi(optarg);
+				if (opt_poll_interval <= 0)
+					opt_help = 1;
+				break;
 			case 'h':
 			default:
 				opt_help = 1;
@@ -154,6 +300,14 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* Polled tone maps go to the history */
+	if (opt_tm_interval && !opt_tm_history)
+		opt_help = 1;
+
+	/* Only the check points just retrieved get cleared */
+	if (opt_clear_check_points && !opt_check_points)
+		opt_help = 1;
+
 	if (opt_help) {
 		usage();
 		return -1;
@@ -192,15 +346,25 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (opt_tm_history) {
+		tm_history = tm_hist_open(opt_tm_history);
+		if (!tm_history) {
+			fprintf(stderr, "%s: %s: %s\n", FAIFA_PROG, opt_tm_history, strerror(errno));
+			return -1;
+		}
+	}
+
 	faifa = faifa_init();
 	if (faifa == NULL) {
 		error("can't initialize Faifa library");
+		close_history();
 		return -1;
 	}
 
 	if (faifa_open(faifa, opt_ifname) == -1) {
 		error(faifa_error(faifa));
 		faifa_free(faifa);
+		close_history();
 		return -1;
 	}
 
@@ -216,10 +380,49 @@ int main(int argc, char **argv)
 		faifa_set_dst_addr(faifa, addr);
 	}
 
-	if (opt_interactive)
+	if (opt_sniffer) {
+		/* Let the capture disable the sniffer mode before leaving */
+		catch_signals();
+		ret = sniffer_capture(faifa, opt_sniffer, SNIFF_RING_RECORDS);
+		if (ret < 0)
+			error(faifa_error(faifa));
+	} else if (opt_write_module) {
+		ret = hpav_write_module(faifa, module_id, strchr(opt_write_module, ':') + 1, opt_window);
+		if (ret < 0)
+			error(faifa_error(faifa));
+	} else if (opt_read_module) {
+		ret = hpav_read_module(faifa, module_id, strchr(opt_read_module, ':') + 1, opt_window);
+		if (ret < 0)
+			error(faifa_error(faifa));
+	} else if (opt_read_memory) {
+		ret = hpav_read_memory(faifa, mem_address, mem_length,
+				       opt_read_memory + mem_path_offset, opt_window);
+		if (ret < 0)
+			error(faifa_error(faifa));
+	} else if (opt_check_points) {
+		ret = hpav_read_check_points(faifa, opt_check_points, opt_clear_check_points);
+		if (ret < 0)
+			error(faifa_error(faifa));
+	} else if (opt_boot) {
+		ret = hpav_boot(faifa, boot_address, boot_entry, opt_boot + boot_path_offset,
+				opt_sdram, opt_window);
+		if (ret < 0)
+			error(faifa_error(faifa));
+	} else if (opt_tm_interval) {
+		catch_signals();
+		ret = tone_map_poll(faifa, tm_history, opt_tm_interval);
+	} else if (opt_poll_interval) {
+		catch_signals();
+		ret = link_stats_poll(faifa, opt_poll_interval);
+	} else if (opt_interactive) {
+		/* The menu is left with Ctrl-C */
+		catch_signals();
 		menu(faifa);
+	}
 
 out_error:
+	/* The receiving thread is gone, nothing appends to the history anymore */
+	close_history();
 	faifa_close(faifa);
 	faifa_free(faifa);
 
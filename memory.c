@@ -0,0 +1,607 @@
+/*
+ *  Bulk MAC memory transfers
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifndef __CYGWIN__
+#include <net/ethernet.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "faifa.h"
+#include "faifa_compat.h"
+#include "faifa_priv.h"
+#include "frame.h"
+#include "homeplug_av.h"
+#include "endian.h"
+#include "crc32.h"
+
+extern FILE *err_stream;
+extern FILE *out_stream;
+
+#define MEM_CHUNK		1024	/* maximum data bytes per RD_MEM_REQ/WR_MEM_REQ */
+#define MEM_TIMEOUT		500	/* ms before a request is sent again */
+#define MEM_RETRIES		5	/* attempts per piece before giving up */
+#define MEM_PROGRESS_INTERVAL	1000	/* ms between two progress lines */
+#define BOOT_TIMEOUT		2000	/* ms to wait for SET_SDRAM_CNF and ST_MAC_CNF */
+#define BOOT_RETRIES		3	/* SET_SDRAM_REQ attempts */
+
+enum mem_piece_state {
+	MEM_PENDING = 0,
+	MEM_INFLIGHT,
+	MEM_DONE,
+};
+
+/**
+ * mem_piece - state of a piece of the memory range
+ * @sent:	time the piece was last requested (ms)
+ * @state:	see enum mem_piece_state
+ * @retries:	number of times the piece was requested again
+ */
+struct mem_piece {
+	u_int64_t	sent;
+	u_int8_t	state;
+	u_int8_t	retries;
+};
+
+/**
+ * mem_xfer - bulk transfer state
+ * @write:	write @map into the device memory instead of reading into it
+ * @pieces:	per piece state
+ * @num_pieces:	number of pieces
+ * @inflight:	indexes of the pieces in flight, @window entries
+ * @num_inflight: number of pieces in flight
+ * @retry:	pieces to request again, at most @window of them
+ * @num_retry:	number of pieces to request again
+ * @next:	next piece never requested so far
+ * @done:	number of completed pieces
+ * @crc:	CRC-32 of the pieces written so far, in order
+ */
+struct mem_xfer {
+	faifa_t			*faifa;
+	u_int32_t		address;
+	u_int32_t		length;
+	u_int8_t		*map;
+	int			write;
+	unsigned int		window;
+	struct mem_piece	*pieces;
+	unsigned int		num_pieces;
+	unsigned int		*inflight;
+	unsigned int		num_inflight;
+	unsigned int		*retry;
+	unsigned int		num_retry;
+	unsigned int		next;
+	unsigned int		done;
+	struct crc32_ctx	crc;
+	u_int8_t		frame[ETHER_MAX_LEN];
+	u_int8_t		req[sizeof(struct write_mac_memory_request)];
+};
+
+static u_int32_t mem_piece_len(struct mem_xfer *x, unsigned int i)
+{
+	u_int32_t offset = i * MEM_CHUNK;
+
+	return x->length - offset < MEM_CHUNK ? x->length - offset : MEM_CHUNK;
+}
+
+static int mem_request(struct mem_xfer *x, unsigned int i)
+{
+	struct read_mac_memory_request *rd = (struct read_mac_memory_request *)x->req;
+	struct write_mac_memory_request *wr = (struct write_mac_memory_request *)x->req;
+	u_int32_t length = mem_piece_len(x, i);
+	struct iovec iov[2];
+
+	x->pieces[i].state = MEM_INFLIGHT;
+	x->pieces[i].sent = faifa_clock_ms();
+	x->inflight[x->num_inflight++] = i;
+
+	if (x->write) {
+		wr->address = STORE32_LE(x->address + i * MEM_CHUNK);
+		wr->length = STORE32_LE(length);
+		iov[0].iov_base = wr;
+		iov[0].iov_len = sizeof(*wr);
+		iov[1].iov_base = x->map + i * MEM_CHUNK;
+		iov[1].iov_len = length;
+		return hpav_send_mmev(x->faifa, HPAV_MMTYPE_WR_MEM_REQ, x->faifa->dst_addr,
+				      iov, 2);
+	}
+
+	rd->address = STORE32_LE(x->address + i * MEM_CHUNK);
+	rd->length = STORE32_LE(length);
+	return hpav_send_mme(x->faifa, HPAV_MMTYPE_RD_MEM_REQ, x->faifa->dst_addr, rd, sizeof(*rd));
+}
+
+/**
+ * mem_retry - move an in-flight piece back to the retry list
+ * @slot:	index of the piece in the in-flight list
+ */
+static int mem_retry(struct mem_xfer *x, unsigned int slot)
+{
+	unsigned int i = x->inflight[slot];
+
+	x->inflight[slot] = x->inflight[--x->num_inflight];
+
+	if (++x->pieces[i].retries > MEM_RETRIES) {
+		faifa_set_error(x->faifa, "%s 0x%08x failed %d times",
+				x->write ? "Writing" : "Reading", x->address + i * MEM_CHUNK, MEM_RETRIES);
+		return -1;
+	}
+
+	x->pieces[i].state = MEM_PENDING;
+	x->retry[x->num_retry++] = i;
+
+	return 0;
+}
+
+static int mem_find_inflight(struct mem_xfer *x, unsigned int i)
+{
+	unsigned int slot;
+
+	for (slot = 0; slot < x->num_inflight; slot++) {
+		if (x->inflight[slot] == i)
+			return slot;
+	}
+
+	return -1;
+}
+
+/**
+ * mem_confirm_piece - find the in-flight piece a confirm refers to
+ * @return
+ *	piece index, -1 if the confirm is unexpected
+ */
+static int mem_confirm_piece(struct mem_xfer *x, u_int32_t address)
+{
+	unsigned int i;
+
+	if (address < x->address || (address - x->address) % MEM_CHUNK)
+		return -1;
+
+	i = (address - x->address) / MEM_CHUNK;
+	if (i >= x->num_pieces || x->pieces[i].state != MEM_INFLIGHT)
+		return -1;
+
+	return i;
+}
+
+static void mem_piece_done(struct mem_xfer *x, unsigned int i)
+{
+	int slot = mem_find_inflight(x, i);
+
+	x->pieces[i].state = MEM_DONE;
+	x->inflight[slot] = x->inflight[--x->num_inflight];
+	x->done++;
+}
+
+static int mem_process_confirm(struct mem_xfer *x, u_int16_t mmtype, u_int8_t *payload, int len)
+{
+	struct read_mac_memory_confirm *rd = (struct read_mac_memory_confirm *)payload;
+	struct write_mac_memory_confirm *wr = (struct write_mac_memory_confirm *)payload;
+	u_int32_t address, length;
+	u_int8_t mstatus;
+	int i;
+
+	if (mmtype == HPAV_MMTYPE_WR_MEM_CNF && x->write && len >= (int)sizeof(*wr)) {
+		mstatus = wr->mstatus;
+		address = STORE32_LE(wr->address);
+		length = STORE32_LE(wr->length);
+	} else if (mmtype == HPAV_MMTYPE_RD_MEM_CNF && !x->write && len >= (int)sizeof(*rd)) {
+		mstatus = rd->mstatus;
+		address = STORE32_LE(rd->address);
+		length = STORE32_LE(rd->length);
+		if (len < (int)(sizeof(*rd) + length))
+			mstatus = INV_LEN;
+	} else {
+		return 0;
+	}
+
+	i = mem_confirm_piece(x, address);
+	if (i < 0)
+		return 0;
+
+	if (mstatus != SUCCESS || length != mem_piece_len(x, i)) {
+		if (x->faifa->verbose)
+			faifa_printf(err_stream, "Address 0x%08x: status 0x%02x, retrying\n",
+				address, mstatus);
+		return mem_retry(x, mem_find_inflight(x, i));
+	}
+
+	if (!x->write)
+		memcpy(x->map + i * MEM_CHUNK, rd->data, length);
+	mem_piece_done(x, i);
+
+	return 0;
+}
+
+static void mem_progress(struct mem_xfer *x, u_int64_t start, int last)
+{
+	u_int64_t elapsed = faifa_clock_ms() - start;
+	u_int64_t bytes = (u_int64_t)x->done * MEM_CHUNK;
+
+	if (bytes > x->length)
+		bytes = x->length;
+
+	faifa_printf(out_stream, "\r%3u%% %llu/%u bytes, %.1f KB/s%s",
+		(unsigned int)(bytes * 100 / x->length), (unsigned long long)bytes, x->length,
+		elapsed ? (double)bytes / 1024 * 1000 / elapsed : 0.0, last ? "\n" : "");
+	fflush(out_stream);
+}
+
+static int mem_transfer(struct mem_xfer *x)
+{
+	u_int64_t start, now, next_progress;
+	unsigned int slot;
+	u_int8_t *payload;
+	u_int16_t mmtype;
+	int n;
+
+	start = faifa_clock_ms();
+	next_progress = start + MEM_PROGRESS_INTERVAL;
+
+	while (x->done < x->num_pieces) {
+		while (x->num_inflight < x->window) {
+			if (x->num_retry) {
+				if (mem_request(x, x->retry[--x->num_retry]) < 0)
+					return -1;
+			} else if (x->next < x->num_pieces) {
+				/* First transmissions are in order: checksum the image as it goes */
+				if (x->write)
+					crc32_update(&x->crc, x->map + x->next * MEM_CHUNK,
+						     mem_piece_len(x, x->next));
+				if (mem_request(x, x->next++) < 0)
+					return -1;
+			} else {
+				break;
+			}
+		}
+
+		n = hpav_recv_mme(x->faifa, x->frame, sizeof(x->frame), &mmtype, &payload, NULL);
+		if (n < 0)
+			return -1;
+		if (n > 0 && mem_process_confirm(x, mmtype, payload, n) < 0)
+			return -1;
+
+		now = faifa_clock_ms();
+		for (slot = 0; slot < x->num_inflight; ) {
+			if (now - x->pieces[x->inflight[slot]].sent > MEM_TIMEOUT) {
+				/* mem_retry moves the last in-flight piece into this slot */
+				if (mem_retry(x, slot) < 0)
+					return -1;
+			} else {
+				slot++;
+			}
+		}
+
+		if (now >= next_progress) {
+			mem_progress(x, start, 0);
+			next_progress = now + MEM_PROGRESS_INTERVAL;
+		}
+	}
+	mem_progress(x, start, 1);
+
+	return 0;
+}
+
+static struct mem_xfer *mem_xfer_alloc(faifa_t *faifa, u_int32_t address, u_int32_t length,
+				       unsigned int window)
+{
+	struct mem_xfer *x;
+
+	x = calloc(1, sizeof(*x));
+	if (!x)
+		goto out_error;
+	x->faifa = faifa;
+	x->address = address;
+	x->length = length;
+	x->window = window ? window : 1;
+	x->num_pieces = (length + MEM_CHUNK - 1) / MEM_CHUNK;
+	crc32_init(&x->crc);
+
+	x->pieces = calloc(x->num_pieces, sizeof(*x->pieces));
+	x->inflight = calloc(x->window, sizeof(*x->inflight));
+	x->retry = calloc(x->window, sizeof(*x->retry));
+	if (!x->pieces || !x->inflight || !x->retry)
+		goto out_error;
+
+	return x;
+
+out_error:
+	if (x) {
+		free(x->retry);
+		free(x->inflight);
+		free(x->pieces);
+		free(x);
+	}
+	faifa_set_error(faifa, "Cannot allocate memory");
+	return NULL;
+}
+
+static void mem_xfer_free(struct mem_xfer *x)
+{
+	free(x->retry);
+	free(x->inflight);
+	free(x->pieces);
+	free(x);
+}
+
+/**
+ * hpav_read_memory - dump a MAC memory range into a file
+ * @faifa:	private handle
+ * @address:	first address of the range
+ * @length:	length of the range
+ * @path:	output file path
+ * @window:	maximum number of RD_MEM_REQ in flight
+ * @return
+ *	0 on success, -1 on error
+ */
+int hpav_read_memory(faifa_t *faifa, u_int32_t address, u_int32_t length, const char *path,
+		     unsigned int window)
+{
+	struct mem_xfer *x;
+	void *map;
+	int fd, ret = -1;
+
+	if (!length) {
+		faifa_set_error(faifa, "Nothing to read");
+		return -1;
+	}
+
+	x = mem_xfer_alloc(faifa, address, length, window);
+	if (!x)
+		return -1;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		faifa_set_error(faifa, "%s: %s", path, strerror(errno));
+		goto out_free;
+	}
+
+	if (ftruncate(fd, length) < 0) {
+		faifa_set_error(faifa, "%s: %s", path, strerror(errno));
+		goto out_close;
+	}
+
+	map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		faifa_set_error(faifa, "%s: %s", path, strerror(errno));
+		goto out_close;
+	}
+	x->map = map;
+
+	faifa_printf(out_stream, "Reading 0x%08x-0x%08x into %s\n",
+		address, address + length - 1, path);
+
+	ret = mem_transfer(x);
+
+	msync(map, length, MS_SYNC);
+	munmap(map, length);
+out_close:
+	close(fd);
+out_free:
+	mem_xfer_free(x);
+	return ret;
+}
+
+/**
+ * mem_transact - send a request and wait for its confirm
+ * @retries:	number of attempts
+ * @return
+ *	confirm payload length, -1 on error or if no confirm came back
+ */
+static int mem_transact(faifa_t *faifa, u_int16_t mmtype, const void *req, int len,
+			u_int8_t *frame, u_int8_t **payload, int retries)
+{
+	u_int64_t deadline;
+	u_int16_t cnf_mmtype;
+	int n;
+
+	while (retries-- > 0) {
+		if (hpav_send_mme(faifa, mmtype, faifa->dst_addr, req, len) < 0)
+			return -1;
+
+		deadline = faifa_clock_ms() + BOOT_TIMEOUT;
+		while (faifa_clock_ms() < deadline) {
+			n = hpav_recv_mme(faifa, frame, ETHER_MAX_LEN, &cnf_mmtype, payload, NULL);
+			if (n < 0)
+				return -1;
+			if (n > 0 && cnf_mmtype == mmtype + 1)
+				return n;
+		}
+	}
+
+	faifa_set_error(faifa, "No answer to MME 0x%04x", mmtype);
+	return -1;
+}
+
+static int mem_set_sdram(faifa_t *faifa, const char *path, u_int8_t *frame)
+{
+	struct set_sdram_config_request req;
+	struct set_sdram_config_confirm *cnf;
+	u_int8_t *payload;
+	FILE *fp;
+	int n;
+
+	fp = fopen(path, "rb");
+	if (!fp) {
+		faifa_set_error(faifa, "%s: %s", path, strerror(errno));
+		return -1;
+	}
+	n = fread(&req.config, sizeof(req.config), 1, fp);
+	fclose(fp);
+	if (n != 1) {
+		faifa_set_error(faifa, "%s: SDRAM configuration must be %zu bytes",
+				path, sizeof(req.config));
+		return -1;
+	}
+	req.checksum = STORE32_LE(crc32buf(&req.config, sizeof(req.config)));
+
+	n = mem_transact(faifa, HPAV_MMTYPE_SET_SDRAM_REQ, &req, sizeof(req), frame, &payload,
+			 BOOT_RETRIES);
+	if (n < 0)
+		return -1;
+
+	cnf = (struct set_sdram_config_confirm *)payload;
+	if (cnf->mstatus != SUCCESS) {
+		faifa_set_error(faifa, "SDRAM configuration failed, status 0x%02x", cnf->mstatus);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mem_start_mac(faifa_t *faifa, struct mem_xfer *x, u_int32_t entry, u_int8_t *frame)
+{
+	struct start_mac_request req;
+	struct start_mac_confirm *cnf;
+	u_int8_t *payload;
+	int n;
+
+	memset(&req, 0, sizeof(req));
+	req.image_load = STORE32_LE(x->address);
+	req.image_length = STORE32_LE(x->length);
+	req.image_chksum = STORE32_LE(crc32_raw(&x->crc));
+	req.image_saddr = STORE32_LE(entry);
+
+	/* Starting the MAC twice is not safe, only send it once */
+	n = mem_transact(faifa, HPAV_MMTYPE_ST_MAC_REQ, &req, sizeof(req), frame, &payload, 1);
+	if (n < (int)sizeof(*cnf))
+		return -1;
+
+	cnf = (struct start_mac_confirm *)payload;
+	if (cnf->mstatus != SUCCESS) {
+		faifa_set_error(faifa, "Start MAC failed, status 0x%02x", cnf->mstatus);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * hpav_boot - boot a device from its SDRAM
+ * @faifa:	private handle
+ * @address:	load address of the image
+ * @entry:	image entry point
+ * @path:	image file path
+ * @sdram:	SDRAM configuration file applied first, NULL for none
+ * @window:	maximum number of WR_MEM_REQ in flight
+ * @return
+ *	0 on success, -1 on error
+ */
+int hpav_boot(faifa_t *faifa, u_int32_t address, u_int32_t entry, const char *path,
+	      const char *sdram, unsigned int window)
+{
+	struct mem_xfer *x;
+	struct stat st;
+	void *map;
+	u_int64_t start;
+	int fd, ret = -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		faifa_set_error(faifa, "%s: %s", path, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		faifa_set_error(faifa, "%s: empty or unreadable image", path);
+		goto out_close;
+	}
+
+	x = mem_xfer_alloc(faifa, address, st.st_size, window);
+	if (!x)
+		goto out_close;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		faifa_set_error(faifa, "%s: %s", path, strerror(errno));
+		goto out_free;
+	}
+	x->map = map;
+	x->write = 1;
+
+	start = faifa_clock_ms();
+
+	if (sdram) {
+		faifa_printf(out_stream, "Applying SDRAM configuration %s\n", sdram);
+		if (mem_set_sdram(faifa, sdram, x->frame) < 0)
+			goto out_unmap;
+	}
+
+	faifa_printf(out_stream, "Writing %s to 0x%08x-0x%08x\n",
+		path, address, address + x->length - 1);
+	if (mem_transfer(x) < 0)
+		goto out_unmap;
+
+	faifa_printf(out_stream, "Starting the MAC at 0x%08x\n", entry);
+	if (mem_start_mac(faifa, x, entry, x->frame) < 0)
+		goto out_unmap;
+
+	faifa_printf(out_stream, "Booted in %llu ms\n",
+		(unsigned long long)(faifa_clock_ms() - start));
+	ret = 0;
+
+out_unmap:
+	munmap(map, st.st_size);
+out_free:
+	mem_xfer_free(x);
+out_close:
+	close(fd);
+	return ret;
+}
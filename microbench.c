@@ -0,0 +1,470 @@
+/*
+ *  Microbenchmarks of the decode, hashing, CRC and formatting hot paths
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+
+/*
+ * The frame lookup and construction helpers are static: build frame.c
+ * into this program rather than linking frame.o.
+ */
+#include "frame.c"
+
+#include <getopt.h>
+
+#include "crc32.h"
+
+#define MB_RUNS		5	/* default measured runs per case */
+#define MB_RUN_MS	20	/* default length of a run */
+#define MB_MAX_CASES	128
+#define MB_NAME_LEN	60
+
+extern const unsigned char *hash_hpav(const unsigned char *isecret, const unsigned char *salt);
+
+/* Keeps the measured calls from being optimized out */
+static volatile u_int64_t mb_sink;
+
+/**
+ * mb_case - benchmarked operation
+ * @name:	name in the report
+ * @fn:		runs the operation @iters times
+ * @index:	hpav_frame_ops or hp10_frame_ops entry, for the decoders
+ * @len:	length of @buf handed to the operation
+ * @buf:	canned frame payload or input buffer
+ * @hdr:	Ethernet header of the canned frame
+ */
+struct mb_case {
+	char			name[MB_NAME_LEN];
+	void			(*fn)(struct mb_case *c, u_int64_t iters);
+	int			index;
+	int			len;
+	u_int8_t		*buf;
+	struct ether_header	*hdr;
+};
+
+static faifa_t *mb_faifa;
+static u_int8_t mb_da[ETHER_ADDR_LEN] = { 0x00, 0xb0, 0x52, 0x00, 0x00, 0x01 };
+static u_int8_t mb_sa[ETHER_ADDR_LEN] = { 0x00, 0x1d, 0x92, 0x12, 0x34, 0x56 };
+static u_int8_t mb_data[64 << 10];
+
+static u_int64_t mb_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Confirms as an INT6400 would send them: decoders trust the counts and
+ * lengths in the payload, the other MMEs are left zeroed.
+ */
+static void mb_fill_payload(u_int16_t mmtype, u_int8_t *p)
+{
+	static const char version[] = "INT6000-MAC-4-1-4102-00-3679-20090724-FINAL-B";
+	struct get_device_sw_version_confirm *sw = (void *)p;
+	struct read_mac_memory_confirm *mem = (void *)p;
+	struct read_mod_data_confirm *mod = (void *)p;
+	struct network_info_confirm *nw = (void *)p;
+	struct link_statistics_confirm *ls = (void *)p;
+	struct get_tone_map_charac_confirm *tm = (void *)p;
+	int i;
+
+	switch (mmtype) {
+	case HPAV_MMTYPE_GET_SW_CNF:
+		sw->device_id = INT6400_DEVICE_ID;
+		sw->version_length = sizeof(version) - 1;
+		memcpy(sw->version, version, sizeof(version) - 1);
+		sw->upgradeable = 1;
+		break;
+	case HPAV_MMTYPE_RD_MEM_CNF:
+		mem->length = STORE32_LE(1024);
+		memcpy(mem->data, mb_data, 1024);
+		break;
+	case HPAV_MMTYPE_RD_MOD_CNF:
+		mod->module_id = PIB;
+		mod->length = STORE16_LE(1024);
+		memcpy(mod->data, mb_data, 1024);
+		mod->checksum = STORE32_LE(crc32buf(mod->data, 1024));
+		break;
+	case HPAV_MMTYPE_NW_INFO_CNF:
+		nw->num_avlns = 1;
+		nw->tei = 2;
+		nw->cco_tei = 1;
+		nw->num_stas = 15;
+		for (i = 0; i < nw->num_stas; i++) {
+			memcpy(nw->stas[i].sta_macaddr, mb_sa, ETHER_ADDR_LEN);
+			nw->stas[i].sta_macaddr[5] += i + 1;
+			nw->stas[i].sta_tei = i + 3;
+			nw->stas[i].avg_phy_tx_rate = 40 + 7 * i;
+			nw->stas[i].avg_phy_rx_rate = 45 + 5 * i;
+		}
+		break;
+	case HPAV_MMTYPE_LNK_STATS_CNF:
+		ls->direction = HPAV_SD_BOTH;
+		ls->tei = 3;
+		ls->both.tx.mpdu_ack = 1234567;
+		ls->both.rx.mpdu_ack = 7654321;
+		break;
+	case HPAV_MMTYPE_TONE_MAP_CNF:
+		/* 917 carriers, mostly QAM-1024 with weaker ones at the edges */
+		tm->num_tms = 1;
+		tm->tm_num_act_carrier = STORE16_LE(917);
+		for (i = 0; i < (917 + 1) / 2; i++) {
+			tm->carriers[i].mod_carrier_lo = i < 40 ? QAM_64 : QAM_1024;
+			tm->carriers[i].mod_carrier_hi = i % 17 ? QAM_1024 : QAM_256;
+		}
+		break;
+	}
+}
+
+static void mb_dump_hpav(struct mb_case *c, u_int64_t iters)
+{
+	while (iters--)
+		mb_sink += hpav_frame_ops[c->index].dump_frame(c->buf, c->len, c->hdr);
+}
+
+static void mb_dump_hp10(struct mb_case *c, u_int64_t iters)
+{
+	while (iters--)
+		mb_sink += hp10_frame_ops[c->index].dump_frame(c->buf, c->len);
+}
+
+/* One lookup of each registered MM type per iteration */
+static void mb_mmtype2index(struct mb_case *c, u_int64_t iters)
+{
+	unsigned int i;
+
+	while (iters--)
+		for (i = 0; i < ARRAY_SIZE(hpav_frame_ops); i++)
+			mb_sink += hpav_mmtype2index(hpav_frame_ops[i].mmtype);
+}
+
+static void mb_mmtype2index_miss(struct mb_case *c, u_int64_t iters)
+{
+	while (iters--)
+		mb_sink += hpav_mmtype2index(0xFFFF);
+}
+
+static void mb_hash_hpav(struct mb_case *c, u_int64_t iters)
+{
+	while (iters--)
+		mb_sink += hash_hpav((const unsigned char *)"HomePlugAV", nmk_salt)[0];
+}
+
+static void mb_gen_passphrase_dak(struct mb_case *c, u_int64_t iters)
+{
+	u_int8_t key[16];
+
+	while (iters--) {
+		gen_passphrase("ABCD-EFGH-IJKL-MNOP", key, dak_salt);
+		mb_sink += key[0];
+	}
+}
+
+static void mb_gen_passphrase_nid(struct mb_case *c, u_int64_t iters)
+{
+	u_int8_t key[16];
+
+	while (iters--) {
+		gen_passphrase((const char *)mb_data, key, NULL);
+		mb_sink += key[0];
+	}
+}
+
+static void mb_crc32buf(struct mb_case *c, u_int64_t iters)
+{
+	while (iters--)
+		mb_sink += crc32buf(c->buf, c->len);
+}
+
+static void mb_dump_hex(struct mb_case *c, u_int64_t iters)
+{
+	while (iters--)
+		mb_sink += dump_hex(c->buf, c->len, " ");
+}
+
+static void mb_sprint_hex(struct mb_case *c, u_int64_t iters)
+{
+	static char str[3 * sizeof(mb_data) + 1];
+
+	while (iters--)
+		mb_sink += faifa_sprint_hex(str, c->buf, c->len, " ");
+}
+
+static void mb_parse_mac_addr(struct mb_case *c, u_int64_t iters)
+{
+	u_int8_t addr[ETHER_ADDR_LEN];
+
+	while (iters--) {
+		faifa_parse_mac_addr(mb_faifa, "00:1d:92:12:34:56", addr);
+		mb_sink += addr[5];
+	}
+}
+
+static void mb_ether_init_header(struct mb_case *c, u_int64_t iters)
+{
+	while (iters--)
+		mb_sink += ether_init_header(c->buf, c->len, mb_da, mb_sa, ETHERTYPE_HOMEPLUG_AV);
+}
+
+static void mb_hpav_do_frame(struct mb_case *c, u_int64_t iters)
+{
+	while (iters--)
+		mb_sink += hpav_do_frame(c->buf, c->len, HPAV_MMTYPE_GET_SW_REQ, mb_da, mb_sa, NULL);
+}
+
+static struct mb_case *mb_add(struct mb_case *cases, int *n, const char *name,
+			      void (*fn)(struct mb_case *, u_int64_t), u_int8_t *buf, int len)
+{
+	struct mb_case *c;
+
+	if (*n == MB_MAX_CASES)
+		return NULL;
+
+	c = &cases[(*n)++];
+	memset(c, 0, sizeof(*c));
+	snprintf(c->name, sizeof(c->name), "%s", name);
+	c->fn = fn;
+	c->buf = buf;
+	c->len = len;
+
+	return c;
+}
+
+/**
+ * mb_add_decoders - add a case per registered dump_frame callback
+ * @frames:	canned frames, ETHER_MAX_LEN bytes each
+ */
+static int mb_add_decoders(struct mb_case *cases, int *n, u_int8_t *frames)
+{
+	struct mb_case *c;
+	char name[MB_NAME_LEN];
+	u_int8_t *frame;
+	unsigned int i;
+	int hdrlen;
+
+	for (i = 0; i < ARRAY_SIZE(hpav_frame_ops); i++) {
+		if (!hpav_frame_ops[i].dump_frame)
+			continue;
+
+		frame = frames + *n * ETHER_MAX_LEN;
+		hdrlen = hpav_init_frame(frame, ETHER_MAX_LEN, hpav_frame_ops[i].mmtype, mb_da, mb_sa);
+		mb_fill_payload(hpav_frame_ops[i].mmtype, frame + hdrlen);
+
+		snprintf(name, sizeof(name), "dump 0x%04X %s", hpav_frame_ops[i].mmtype,
+			 hpav_frame_ops[i].desc);
+		c = mb_add(cases, n, name, mb_dump_hpav, frame + hdrlen, ETH_FRAME_LEN - hdrlen);
+		if (!c)
+			return -1;
+		c->index = i;
+		c->hdr = (struct ether_header *)frame;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(hp10_frame_ops); i++) {
+		if (!hp10_frame_ops[i].dump_frame)
+			continue;
+
+		frame = frames + *n * ETHER_MAX_LEN;
+		snprintf(name, sizeof(name), "dump HP1.0 0x%02X %s", hp10_frame_ops[i].mmtype,
+			 hp10_frame_ops[i].desc);
+		c = mb_add(cases, n, name, mb_dump_hp10, frame, ETH_DATA_LEN);
+		if (!c)
+			return -1;
+		c->index = i;
+	}
+
+	return 0;
+}
+
+static double mb_time(struct mb_case *c, u_int64_t iters)
+{
+	u_int64_t start = mb_clock_ns();
+
+	c->fn(c, iters);
+
+	return mb_clock_ns() - start;
+}
+
+static int mb_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * mb_measure - time a case
+ * @runs:	measured runs
+ * @run_ns:	length of a run
+ * @median:	median time per operation, in ns
+ * @best:	best time per operation, in ns
+ *
+ * The iteration count is calibrated so that a run lasts about @run_ns,
+ * then a full run warms caches and branch predictors up before the
+ * measured ones.
+ */
+static void mb_measure(struct mb_case *c, unsigned int runs, double run_ns,
+		       double *median, double *best)
+{
+	double ns[runs], t;
+	u_int64_t iters = 1;
+	unsigned int r;
+
+	while ((t = mb_time(c, iters)) < run_ns / 10)
+		iters *= 2;
+	iters = iters * run_ns / (t > 1 ? t : 1);
+	if (!iters)
+		iters = 1;
+
+	mb_time(c, iters);
+	for (r = 0; r < runs; r++)
+		ns[r] = mb_time(c, iters) / iters;
+
+	qsort(ns, runs, sizeof(ns[0]), mb_cmp);
+	*median = ns[runs / 2];
+	*best = ns[0];
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: microbench [options]\n"
+			"-r:	measured runs per case (default: %d)\n"
+			"-t:	milliseconds per run (default: %d)\n"
+			"-f:	only run the cases whose name contains this string\n"
+			"-h:	this help\n",
+			MB_RUNS, MB_RUN_MS);
+}
+
+int main(int argc, char **argv)
+{
+	struct mb_case cases[MB_MAX_CASES];
+	static u_int8_t frames[MB_MAX_CASES][ETHER_MAX_LEN];
+	static u_int8_t buf[ETHER_MAX_LEN];
+	unsigned int runs = MB_RUNS, run_ms = MB_RUN_MS, i;
+	const char *filter = NULL;
+	double median, best;
+	int n = 0, opt;
+
+	while ((opt = getopt(argc, argv, "r:t:f:h")) > 0) {
+		switch (opt) {
+		case 'r':
+			runs = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			run_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'h':
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if (!runs || !run_ms) {
+		usage();
+		return 1;
+	}
+
+	/* Decoders and dump_hex print to a null sink */
+	out_stream = fopen("/dev/null", "w");
+	err_stream = out_stream;
+	if (!out_stream) {
+		perror("/dev/null");
+		return 1;
+	}
+	mb_faifa = faifa_init();
+	if (!mb_faifa) {
+		fprintf(stderr, "Can't initialize Faifa library\n");
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(mb_data); i++)
+		mb_data[i] = i * 131 + (i >> 8);
+
+	if (mb_add_decoders(cases, &n, (u_int8_t *)frames)) {
+		fprintf(stderr, "too many cases\n");
+		return 1;
+	}
+	mb_add(cases, &n, "hpav_mmtype2index (all types)", mb_mmtype2index, NULL, 0);
+	mb_add(cases, &n, "hpav_mmtype2index miss", mb_mmtype2index_miss, NULL, 0);
+	mb_add(cases, &n, "hash_hpav NMK", mb_hash_hpav, NULL, 0);
+	mb_add(cases, &n, "gen_passphrase DAK", mb_gen_passphrase_dak, NULL, 0);
+	mb_add(cases, &n, "gen_passphrase NID", mb_gen_passphrase_nid, NULL, 0);
+	mb_add(cases, &n, "crc32buf 64", mb_crc32buf, mb_data, 64);
+	mb_add(cases, &n, "crc32buf 1514", mb_crc32buf, mb_data, ETH_FRAME_LEN);
+	mb_add(cases, &n, "crc32buf 64K", mb_crc32buf, mb_data, sizeof(mb_data));
+	mb_add(cases, &n, "dump_hex 16", mb_dump_hex, mb_data, 16);
+	mb_add(cases, &n, "dump_hex 1024", mb_dump_hex, mb_data, 1024);
+	mb_add(cases, &n, "faifa_sprint_hex 16", mb_sprint_hex, mb_data, 16);
+	mb_add(cases, &n, "faifa_sprint_hex 1024", mb_sprint_hex, mb_data, 1024);
+	mb_add(cases, &n, "faifa_parse_mac_addr", mb_parse_mac_addr, NULL, 0);
+	mb_add(cases, &n, "ether_init_header", mb_ether_init_header, buf, sizeof(buf));
+	if (!mb_add(cases, &n, "hpav_do_frame GET_SW_REQ", mb_hpav_do_frame, buf, sizeof(buf))) {
+		fprintf(stderr, "too many cases\n");
+		return 1;
+	}
+
+	fprintf(stdout, "%-*s %12s %12s\n", MB_NAME_LEN, "Case", "ns/op", "best ns/op");
+	for (i = 0; i < (unsigned int)n; i++) {
+		if (filter && !strstr(cases[i].name, filter))
+			continue;
+		mb_measure(&cases[i], runs, run_ms * 1e6, &median, &best);
+		fprintf(stdout, "%-*s %12.1f %12.1f\n", MB_NAME_LEN, cases[i].name, median, best);
+		fflush(stdout);
+	}
+
+	faifa_free(mb_faifa);
+	fclose(out_stream);
+	return 0;
+}
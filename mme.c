@@ -0,0 +1,104 @@
+/*
+ *  Scatter-gather HomePlug AV MME transmission
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+#include <errno.h>
+#include <string.h>
+
+#include "mme.h"
+
+/* Longest padding: a bare header in a minimum size Ethernet frame */
+static const u_int8_t mme_zeroes[64];
+
+ssize_t mme_sendv(int fd, const struct sockaddr *to, socklen_t tolen,
+		  const void *hdr, size_t hdrlen, const u_int8_t *oui,
+		  const struct iovec *iov, int iovcnt, size_t min_len)
+{
+	struct iovec vec[MME_IOV_MAX + 3];
+	struct msghdr msg;
+	size_t total;
+	int i, n = 0;
+
+	if (iovcnt < 0 || iovcnt > MME_IOV_MAX || min_len > sizeof(mme_zeroes) + hdrlen) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	vec[n].iov_base = (void *)hdr;
+	vec[n++].iov_len = hdrlen;
+	total = hdrlen;
+
+	if (oui) {
+		vec[n].iov_base = (void *)oui;
+		vec[n++].iov_len = 3;
+		total += 3;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		if (!iov[i].iov_len)
+			continue;
+		vec[n++] = iov[i];
+		total += iov[i].iov_len;
+	}
+
+	if (total < min_len) {
+		vec[n].iov_base = (void *)mme_zeroes;
+		vec[n++].iov_len = min_len - total;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = (void *)to;
+	msg.msg_namelen = to ? tolen : 0;
+	msg.msg_iov = vec;
+	msg.msg_iovlen = n;
+
+	return sendmsg(fd, &msg, 0);
+}
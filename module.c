@@ -0,0 +1,607 @@
+/*
+ *  Module upload over Write Module Data
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifndef __CYGWIN__
+#include <net/ethernet.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "faifa.h"
+#include "faifa_compat.h"
+#include "faifa_priv.h"
+#include "frame.h"
+#include "homeplug_av.h"
+#include "endian.h"
+#include "crc32.h"
+
+extern FILE *err_stream;
+extern FILE *out_stream;
+
+#define WR_MOD_CHUNK		1024	/* maximum data bytes per WR_MOD_REQ */
+#define WR_MOD_TIMEOUT		500	/* ms before an unconfirmed chunk is resent */
+#define WR_MOD_RETRIES		5	/* attempts per chunk before giving up */
+#define WR_MOD_ERRORS		3	/* rejected chunks triggering a resend */
+#define NVM_MOD_TIMEOUT		30000	/* ms to wait for the NVM commit */
+#define RD_MOD_CHUNK		1024	/* maximum data bytes per RD_MOD_REQ */
+#define RD_MOD_TIMEOUT		500	/* ms before a chunk is requested again */
+#define RD_MOD_RETRIES		5	/* attempts per chunk before giving up */
+
+/**
+ * wr_chunk - state of an image chunk
+ * @sent:	time the chunk was last sent (ms)
+ * @inflight:	a confirm is expected for the last transmission
+ * @retries:	number of times the chunk was resent
+ */
+struct wr_chunk {
+	u_int64_t	sent;
+	u_int8_t	inflight;
+	u_int8_t	retries;
+};
+
+struct wr_ctx {
+	faifa_t		*faifa;
+	u_int8_t	module_id;
+	const u_int8_t	*image;
+	size_t		size;
+	unsigned int	num_chunks;
+	struct wr_chunk	*chunks;
+	u_int8_t	req[sizeof(struct write_mod_data_request)];
+	u_int8_t	frame[ETHER_MAX_LEN];
+};
+
+static int wr_send_chunk(struct wr_ctx *ctx, unsigned int i)
+{
+	struct write_mod_data_request *mm = (struct write_mod_data_request *)ctx->req;
+	size_t offset = (size_t)i * WR_MOD_CHUNK;
+	u_int16_t length = WR_MOD_CHUNK;
+	struct iovec iov[2];
+
+	if (ctx->size - offset < WR_MOD_CHUNK)
+		length = ctx->size - offset;
+
+	memset(mm, 0, sizeof(*mm));
+	mm->module_id = ctx->module_id;
+	mm->length = STORE16_LE(length);
+	mm->offset = STORE32_LE(offset);
+	mm->checksum = STORE32_LE(crc32buf(ctx->image + offset, length));
+
+	ctx->chunks[i].sent = faifa_clock_ms();
+	ctx->chunks[i].inflight = 1;
+
+	/* The chunk goes to the kernel straight from the mapped image */
+	iov[0].iov_base = mm;
+	iov[0].iov_len = sizeof(*mm);
+	iov[1].iov_base = (void *)(ctx->image + offset);
+	iov[1].iov_len = length;
+
+	return hpav_send_mmev(ctx->faifa, HPAV_MMTYPE_WR_MOD_REQ, ctx->faifa->dst_addr,
+			      iov, 2);
+}
+
+/**
+ * wr_rewind - resend every chunk from @i on, counting a retry for @i
+ * @return
+ *	0 on success, -1 if chunk @i ran out of retries
+ */
+static int wr_rewind(struct wr_ctx *ctx, unsigned int i, unsigned int *next)
+{
+	unsigned int j;
+
+	if (++ctx->chunks[i].retries > WR_MOD_RETRIES) {
+		faifa_set_error(ctx->faifa, "Chunk at offset 0x%08x failed %d times",
+				i * WR_MOD_CHUNK, WR_MOD_RETRIES);
+		return -1;
+	}
+
+	/* Confirms for the chunks sent after this one are now stale */
+	for (j = i; j < *next; j++)
+		ctx->chunks[j].inflight = 0;
+	*next = i;
+
+	return 0;
+}
+
+static int wr_commit(struct wr_ctx *ctx)
+{
+	struct write_module_data_to_nvm_request req;
+	struct write_module_data_to_nvm_confirm *cnf;
+	u_int8_t *payload;
+	u_int16_t mmtype;
+	u_int64_t deadline;
+	int n;
+
+	req.module_id = ctx->module_id;
+	if (hpav_send_mme(ctx->faifa, HPAV_MMTYPE_NVM_MOD_REQ, ctx->faifa->dst_addr,
+			  &req, sizeof(req)) < 0)
+		return -1;
+
+	deadline = faifa_clock_ms() + NVM_MOD_TIMEOUT;
+	while (faifa_clock_ms() < deadline) {
+		n = hpav_recv_mme(ctx->faifa, ctx->frame, sizeof(ctx->frame), &mmtype, &payload, NULL);
+		if (n < 0)
+			return -1;
+		if (mmtype != HPAV_MMTYPE_NVM_MOD_CNF || n < (int)sizeof(*cnf))
+			continue;
+
+		cnf = (struct write_module_data_to_nvm_confirm *)payload;
+		if (cnf->module_id != ctx->module_id)
+			continue;
+		if (cnf->mstatus != SUCCESS) {
+			faifa_set_error(ctx->faifa, "NVM commit failed, status 0x%02x", cnf->mstatus);
+			return -1;
+		}
+		return 0;
+	}
+
+	faifa_set_error(ctx->faifa, "No answer to the NVM commit request");
+	return -1;
+}
+
+static int wr_upload(struct wr_ctx *ctx, unsigned int window)
+{
+	struct write_mod_data_confirm *cnf;
+	unsigned int base = 0, next = 0, i, percent = 0, errors = 0;
+	u_int32_t offset;
+	u_int8_t *payload;
+	u_int16_t mmtype;
+	int n;
+
+	while (base < ctx->num_chunks) {
+		while (next < ctx->num_chunks && next - base < window) {
+			if (wr_send_chunk(ctx, next) < 0)
+				return -1;
+			next++;
+		}
+
+		n = hpav_recv_mme(ctx->faifa, ctx->frame, sizeof(ctx->frame), &mmtype, &payload, NULL);
+		if (n < 0)
+			return -1;
+
+		if (mmtype == HPAV_MMTYPE_WR_MOD_CNF && n >= (int)sizeof(*cnf)) {
+			cnf = (struct write_mod_data_confirm *)payload;
+			offset = STORE32_LE(cnf->offset);
+			i = offset / WR_MOD_CHUNK;
+
+			if (cnf->module_id == ctx->module_id && !(offset % WR_MOD_CHUNK) &&
+			    i >= base && i < next && ctx->chunks[i].inflight) {
+				/*
+				 * The device only accepts data at the offset it expects,
+				 * so a confirmed chunk also confirms all the previous ones.
+				 * Rejected chunks mean that an earlier one got lost (or
+				 * that a resent one was already written): resend from
+				 * the oldest chunk once a few of them were rejected.
+				 */
+				ctx->chunks[i].inflight = 0;
+				if (cnf->mstatus == SUCCESS) {
+					base = i + 1;
+				} else if (++errors >= WR_MOD_ERRORS || errors >= next - base) {
+					if (ctx->faifa->verbose)
+						faifa_printf(err_stream, "Offset 0x%08x: status 0x%02x, resending from 0x%08x\n",
+							offset, cnf->mstatus, base * WR_MOD_CHUNK);
+					if (wr_rewind(ctx, base, &next) < 0)
+						return -1;
+					errors = 0;
+				}
+			}
+		}
+
+		/* The oldest chunk timed out, go back to it */
+		if (base < next && faifa_clock_ms() - ctx->chunks[base].sent > WR_MOD_TIMEOUT) {
+			if (wr_rewind(ctx, base, &next) < 0)
+				return -1;
+			errors = 0;
+		}
+
+		if (base * 100 / ctx->num_chunks >= percent + 10) {
+			percent = base * 100 / ctx->num_chunks;
+			faifa_printf(out_stream, "\r%3u%%", percent);
+			fflush(out_stream);
+		}
+	}
+	faifa_printf(out_stream, "\r");
+
+	return 0;
+}
+
+/**
+ * hpav_write_module - upload a module image and commit it to NVM
+ * @faifa:	private handle
+ * @module_id:	module ID
+ * @path:	image file path
+ * @window:	maximum number of unconfirmed WR_MOD_REQ
+ * @return
+ *	0 on success, -1 on error
+ */
+int hpav_write_module(faifa_t *faifa, u_int8_t module_id, const char *path, unsigned int window)
+{
+	struct wr_ctx *ctx;
+	struct stat st;
+	void *map = MAP_FAILED;
+	u_int64_t start, elapsed;
+	int fd, ret = -1;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx) {
+		faifa_set_error(faifa, "Cannot allocate memory");
+		return -1;
+	}
+	ctx->faifa = faifa;
+	ctx->module_id = module_id;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		faifa_set_error(faifa, "%s: %s", path, strerror(errno));
+		goto out_free;
+	}
+
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		faifa_set_error(faifa, "%s: empty or unreadable image", path);
+		goto out_close;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		faifa_set_error(faifa, "%s: %s", path, strerror(errno));
+		goto out_close;
+	}
+	ctx->image = map;
+	ctx->size = st.st_size;
+	ctx->num_chunks = (ctx->size + WR_MOD_CHUNK - 1) / WR_MOD_CHUNK;
+
+	ctx->chunks = calloc(ctx->num_chunks, sizeof(*ctx->chunks));
+	if (!ctx->chunks) {
+		faifa_set_error(faifa, "Cannot allocate memory");
+		goto out_unmap;
+	}
+
+	if (!window)
+		window = 1;
+
+	faifa_printf(out_stream, "Uploading %s (%zu bytes, %u chunks) to module 0x%02x\n",
+		path, ctx->size, ctx->num_chunks, module_id);
+
+	start = faifa_clock_ms();
+	if (wr_upload(ctx, window) < 0)
+		goto out_chunks;
+	elapsed = faifa_clock_ms() - start;
+
+	faifa_printf(out_stream, "Uploaded %zu bytes in %llu ms (%.1f KB/s)\n", ctx->size,
+		(unsigned long long)elapsed,
+		elapsed ? (double)ctx->size / 1024 * 1000 / elapsed : 0.0);
+
+	faifa_printf(out_stream, "Committing module 0x%02x to NVM\n", module_id);
+	if (wr_commit(ctx) < 0)
+		goto out_chunks;
+	faifa_printf(out_stream, "Done\n");
+	ret = 0;
+
+out_chunks:
+	free(ctx->chunks);
+out_unmap:
+	munmap(map, st.st_size);
+out_close:
+	close(fd);
+out_free:
+	free(ctx);
+	return ret;
+}
+
+/**
+ * rd_slot - a chunk being downloaded
+ * @index:	chunk index
+ * @sent:	time the chunk was last requested (ms)
+ * @retries:	number of times the chunk was requested again
+ */
+struct rd_slot {
+	unsigned int	index;
+	u_int64_t	sent;
+	unsigned int	retries;
+};
+
+/**
+ * rd_ctx - module download state
+ * @slots:	chunks in flight, @window entries
+ * @num_slots:	number of chunks in flight
+ * @next:	next chunk never requested so far
+ * @eof:	index of the first chunk past the end of the module
+ * @size:	end of the furthest chunk downloaded so far
+ * @done:	number of chunks written to the file
+ */
+struct rd_ctx {
+	faifa_t		*faifa;
+	u_int8_t	module_id;
+	int		fd;
+	struct rd_slot	*slots;
+	unsigned int	num_slots;
+	unsigned int	window;
+	unsigned int	next;
+	unsigned int	eof;
+	size_t		size;
+	unsigned int	done;
+	u_int8_t	frame[ETHER_MAX_LEN];
+};
+
+static int rd_request(struct rd_ctx *ctx, struct rd_slot *slot)
+{
+	struct read_mod_data_request req;
+
+	memset(&req, 0, sizeof(req));
+	req.module_id = ctx->module_id;
+	req.length = STORE16_LE(RD_MOD_CHUNK);
+	req.offset = STORE32_LE(slot->index * RD_MOD_CHUNK);
+
+	slot->sent = faifa_clock_ms();
+
+	return hpav_send_mme(ctx->faifa, HPAV_MMTYPE_RD_MOD_REQ, ctx->faifa->dst_addr,
+			     &req, sizeof(req));
+}
+
+static void rd_release(struct rd_ctx *ctx, unsigned int s)
+{
+	ctx->slots[s] = ctx->slots[--ctx->num_slots];
+}
+
+static int rd_retry(struct rd_ctx *ctx, unsigned int s)
+{
+	struct rd_slot *slot = &ctx->slots[s];
+
+	if (++slot->retries > RD_MOD_RETRIES) {
+		faifa_set_error(ctx->faifa, "Chunk at offset 0x%08x failed %d times",
+				slot->index * RD_MOD_CHUNK, RD_MOD_RETRIES);
+		return -1;
+	}
+
+	return rd_request(ctx, slot);
+}
+
+/**
+ * rd_end - record the end of the module
+ * @index:	first chunk past the end
+ *
+ * Chunks in flight beyond the end are dropped, their answer does not matter.
+ */
+static void rd_end(struct rd_ctx *ctx, unsigned int index)
+{
+	unsigned int s;
+
+	if (index >= ctx->eof)
+		return;
+	ctx->eof = index;
+
+	for (s = 0; s < ctx->num_slots; ) {
+		if (ctx->slots[s].index >= ctx->eof)
+			rd_release(ctx, s);
+		else
+			s++;
+	}
+}
+
+static int rd_process_confirm(struct rd_ctx *ctx, u_int8_t *payload, int len)
+{
+	struct read_mod_data_confirm *cnf = (struct read_mod_data_confirm *)payload;
+	u_int32_t offset, checksum;
+	u_int16_t length;
+	unsigned int s, i;
+
+	if (len < (int)sizeof(*cnf) || cnf->module_id != ctx->module_id)
+		return 0;
+
+	offset = STORE32_LE(cnf->offset);
+	length = STORE16_LE(cnf->length);
+	checksum = STORE32_LE(cnf->checksum);
+	if (offset % RD_MOD_CHUNK)
+		return 0;
+	i = offset / RD_MOD_CHUNK;
+
+	for (s = 0; s < ctx->num_slots; s++) {
+		if (ctx->slots[s].index == i)
+			break;
+	}
+	if (s == ctx->num_slots)
+		return 0;
+
+	switch (cnf->mstatus) {
+	case SUCCESS:
+		break;
+	case INV_LEN:
+	case UNEX_OFF:
+		/* Reading past the end of the module */
+		rd_end(ctx, i);
+		return 0;
+	case INV_MOD_ID:
+		faifa_set_error(ctx->faifa, "Invalid module ID 0x%02x", ctx->module_id);
+		return -1;
+	default:
+		if (ctx->faifa->verbose)
+			faifa_printf(err_stream, "Offset 0x%08x: status 0x%02x, retrying\n",
+				offset, cnf->mstatus);
+		return rd_retry(ctx, s);
+	}
+
+	if (length > RD_MOD_CHUNK || len < (int)(sizeof(*cnf) + length) ||
+	    crc32buf(cnf->data, length) != checksum) {
+		if (ctx->faifa->verbose)
+			faifa_printf(err_stream, "Offset 0x%08x: bad checksum, retrying\n", offset);
+		return rd_retry(ctx, s);
+	}
+
+	if (pwrite(ctx->fd, cnf->data, length, offset) != length) {
+		faifa_set_error(ctx->faifa, "write: %s", strerror(errno));
+		return -1;
+	}
+
+	rd_release(ctx, s);
+	ctx->done++;
+	if ((size_t)offset + length > ctx->size)
+		ctx->size = (size_t)offset + length;
+
+	/* A short chunk is the last one */
+	if (length < RD_MOD_CHUNK)
+		rd_end(ctx, i + 1);
+
+	return 0;
+}
+
+static int rd_download(struct rd_ctx *ctx)
+{
+	struct rd_slot *slot;
+	u_int8_t *payload;
+	u_int16_t mmtype;
+	u_int64_t now;
+	unsigned int s;
+	int n;
+
+	while (ctx->done < ctx->eof) {
+		while (ctx->num_slots < ctx->window && ctx->next < ctx->eof) {
+			slot = &ctx->slots[ctx->num_slots++];
+			slot->index = ctx->next++;
+			slot->retries = 0;
+			if (rd_request(ctx, slot) < 0)
+				return -1;
+		}
+
+		n = hpav_recv_mme(ctx->faifa, ctx->frame, sizeof(ctx->frame), &mmtype, &payload, NULL);
+		if (n < 0)
+			return -1;
+		if (mmtype == HPAV_MMTYPE_RD_MOD_CNF && rd_process_confirm(ctx, payload, n) < 0)
+			return -1;
+
+		now = faifa_clock_ms();
+		for (s = 0; s < ctx->num_slots; s++) {
+			if (now - ctx->slots[s].sent > RD_MOD_TIMEOUT && rd_retry(ctx, s) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * hpav_read_module - download a module into a file
+ * @faifa:	private handle
+ * @module_id:	module ID
+ * @path:	output file path
+ * @window:	maximum number of RD_MOD_REQ in flight
+ *
+ * The module size is not known beforehand: chunks are requested until
+ * the device returns a short one or rejects an offset past the end.
+ * @return
+ *	0 on success, -1 on error
+ */
+int hpav_read_module(faifa_t *faifa, u_int8_t module_id, const char *path, unsigned int window)
+{
+	struct rd_ctx *ctx;
+	u_int64_t start, elapsed;
+	int ret = -1;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx) {
+		faifa_set_error(faifa, "Cannot allocate memory");
+		return -1;
+	}
+	ctx->faifa = faifa;
+	ctx->module_id = module_id;
+	ctx->window = window ? window : 1;
+	ctx->eof = UINT_MAX;
+
+	ctx->slots = calloc(ctx->window, sizeof(*ctx->slots));
+	if (!ctx->slots) {
+		faifa_set_error(faifa, "Cannot allocate memory");
+		goto out_free;
+	}
+
+	ctx->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (ctx->fd < 0) {
+		faifa_set_error(faifa, "%s: %s", path, strerror(errno));
+		goto out_slots;
+	}
+
+	faifa_printf(out_stream, "Downloading module 0x%02x to %s\n", module_id, path);
+
+	start = faifa_clock_ms();
+	if (rd_download(ctx) < 0)
+		goto out_close;
+	elapsed = faifa_clock_ms() - start;
+
+	/* Drop anything written past the end by a stale confirm */
+	if (ftruncate(ctx->fd, ctx->size) < 0) {
+		faifa_set_error(faifa, "%s: %s", path, strerror(errno));
+		goto out_close;
+	}
+
+	faifa_printf(out_stream, "Downloaded %zu bytes in %llu ms (%.1f KB/s)\n", ctx->size,
+		(unsigned long long)elapsed,
+		elapsed ? (double)ctx->size / 1024 * 1000 / elapsed : 0.0);
+	ret = 0;
+
+out_close:
+	if (close(ctx->fd) < 0 && !ret) {
+		faifa_set_error(faifa, "%s: %s", path, strerror(errno));
+		ret = -1;
+	}
+out_slots:
+	free(ctx->slots);
+out_free:
+	free(ctx);
+	return ret;
+}
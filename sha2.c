@@ -39,9 +39,16 @@
 #include <stddef.h>
 #include <inttypes.h>
 #include <string.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define SHA2_HAVE_X86
+#include <immintrin.h>
+#endif
 
 #include "endian.h"
 #include "sha2.h"
+#include "cpu.h"
 
 /*
  * UNROLLED TRANSFORM LOOP NOTE:
@@ -141,8 +148,8 @@
 #define S32(b,x)	(((x) >> (b)) | ((x) << (32 - (b))))
 
 /* Two of six logical functions used in SHA-256, SHA-384, and SHA-512: */
-#define Ch(x,y,z)	(((x) & (y)) ^ ((~(x)) & (z)))
-#define Maj(x,y,z)	(((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define Ch(x,y,z)	((z) ^ ((x) & ((y) ^ (z))))
+#define Maj(x,y,z)	(((x) & (y)) | ((z) & ((x) | (y))))
 
 /* Four of six logical functions used in SHA-256: */
 #define Sigma0_256(x)	(S32(2,  (x)) ^ S32(13, (x)) ^ S32(22, (x)))
@@ -162,6 +169,19 @@
  * only.
  */
 static void SHA256_Transform(SHA256_CTX *, const uint8_t *);
+static void SHA256_Transform_C(SHA256_CTX *, const uint8_t *);
+static void SHA256_Iterate_C(uint32_t[8], unsigned int);
+static void sha256_select(void);
+
+/* Implementations picked by sha256_select() on first use */
+static pthread_once_t sha256_once = PTHREAD_ONCE_INIT;
+static void (*sha256_transform)(SHA256_CTX *, const uint8_t *) = SHA256_Transform_C;
+static void (*sha256_iterate)(uint32_t[8], unsigned int) = SHA256_Iterate_C;
+
+/* Multi-buffer kernel for SHA256_Iterate_Batch(), if any */
+#define SHA256_MAX_LANES	16
+static void (*sha256_iterate_mb)(uint32_t[][8], unsigned int);
+static unsigned int sha256_lanes = 1;
 
 
 /*** SHA-XYZ INITIAL HASH VALUES AND CONSTANTS ************************/
@@ -203,6 +223,7 @@ SHA256_Init(SHA256_CTX * context)
 {
 	if (context == NULL)
 		return;
+	pthread_once(&sha256_once, sha256_select);
 	memcpy(context->state, sha256_initial_hash_value, SHA256_DIGEST_LENGTH);
 	memset(context->buffer, 0, SHA256_BLOCK_LENGTH);
 	context->bitcount = 0;
@@ -235,7 +256,7 @@ SHA256_Init(SHA256_CTX * context)
 } while(0)
 
 static void
-SHA256_Transform(SHA256_CTX * context, const uint8_t *data)
+SHA256_Transform_C(SHA256_CTX * context, const uint8_t *data)
 {
 	uint32_t		a,
 				b,
@@ -306,7 +327,7 @@ SHA256_Transform(SHA256_CTX * context, const uint8_t *data)
 #else							/* SHA2_UNROLL_TRANSFORM */
 
 static void
-SHA256_Transform(SHA256_CTX * context, const uint8_t *data)
+SHA256_Transform_C(SHA256_CTX * context, const uint8_t *data)
 {
 	uint32_t		a,
 				b,
@@ -395,6 +416,547 @@ SHA256_Transform(SHA256_CTX * context, const uint8_t *data)
 }
 #endif   /* SHA2_UNROLL_TRANSFORM */
 
+/*
+ * Compression of a 32-byte message for SHA256_Iterate(): the state
+ * starts from the initial hash value, the first half of the block holds
+ * the previous digest as host order words and the second half is
+ * constant padding. Every round index is a constant, so the compiler
+ * keeps the schedule in registers and folds the padding words away.
+ */
+#define W256_C(W,i)	((i) < 16 ? (W)[(i)] :					\
+	((W)[(i) & 0x0f] += sigma1_256((W)[((i) + 14) & 0x0f]) +		\
+		(W)[((i) + 9) & 0x0f] + sigma0_256((W)[((i) + 1) & 0x0f])))
+
+#define ROUND256_C(a,b,c,d,e,f,g,h,i) do {					\
+	T1 = (h) + Sigma1_256((e)) + Ch((e), (f), (g)) + K256[(i)] + W256_C(W, (i)); \
+	(d) += T1;								\
+	(h) = T1 + Sigma0_256((a)) + Maj((a), (b), (c));			\
+} while(0)
+
+#define ROUNDS256_C(i) do {							\
+	ROUND256_C(a, b, c, d, e, f, g, h, (i) + 0);				\
+	ROUND256_C(h, a, b, c, d, e, f, g, (i) + 1);				\
+	ROUND256_C(g, h, a, b, c, d, e, f, (i) + 2);				\
+	ROUND256_C(f, g, h, a, b, c, d, e, (i) + 3);				\
+	ROUND256_C(e, f, g, h, a, b, c, d, (i) + 4);				\
+	ROUND256_C(d, e, f, g, h, a, b, c, (i) + 5);				\
+	ROUND256_C(c, d, e, f, g, h, a, b, (i) + 6);				\
+	ROUND256_C(b, c, d, e, f, g, h, a, (i) + 7);				\
+} while(0)
+
+static void
+SHA256_Compress32(uint32_t digest[8])
+{
+	uint32_t	a, b, c, d, e, f, g, h, T1;
+	uint32_t	W[16];
+
+	memcpy(W, digest, 8 * sizeof(uint32_t));
+	W[8] = 0x80000000UL;
+	W[9] = W[10] = W[11] = W[12] = W[13] = W[14] = 0;
+	W[15] = SHA256_DIGEST_LENGTH * 8;
+
+	a = sha256_initial_hash_value[0];
+	b = sha256_initial_hash_value[1];
+	c = sha256_initial_hash_value[2];
+	d = sha256_initial_hash_value[3];
+	e = sha256_initial_hash_value[4];
+	f = sha256_initial_hash_value[5];
+	g = sha256_initial_hash_value[6];
+	h = sha256_initial_hash_value[7];
+
+	ROUNDS256_C(0);
+	ROUNDS256_C(8);
+	ROUNDS256_C(16);
+	ROUNDS256_C(24);
+	ROUNDS256_C(32);
+	ROUNDS256_C(40);
+	ROUNDS256_C(48);
+	ROUNDS256_C(56);
+
+	digest[0] = sha256_initial_hash_value[0] + a;
+	digest[1] = sha256_initial_hash_value[1] + b;
+	digest[2] = sha256_initial_hash_value[2] + c;
+	digest[3] = sha256_initial_hash_value[3] + d;
+	digest[4] = sha256_initial_hash_value[4] + e;
+	digest[5] = sha256_initial_hash_value[5] + f;
+	digest[6] = sha256_initial_hash_value[6] + g;
+	digest[7] = sha256_initial_hash_value[7] + h;
+}
+
+/*
+ * SHA256_Iterate - replace a digest by its own SHA-256, count times
+ *
+ * A 32-byte message always fits in a single block whose second half is
+ * constant padding (0x80, zeroes, then a 256-bit length), so each round
+ * is exactly one compression of the previous state words.
+ */
+static void
+SHA256_Iterate_C(uint32_t words[8], unsigned int count)
+{
+	while (count--)
+		SHA256_Compress32(words);
+}
+
+#ifdef SHA2_HAVE_X86
+/*
+ * SHA extensions: the state lives in the ABEF/CDGH register pair that
+ * sha256rnds2 works on, each pair of sha256rnds2 doing four rounds.
+ */
+#define SHANI_ROUNDS4(m, k) do {						\
+	MSG = _mm_add_epi32((m), _mm_loadu_si128((const __m128i *)&K256[(k)])); \
+	STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);			\
+	MSG = _mm_shuffle_epi32(MSG, 0x0e);					\
+	STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);			\
+} while(0)
+
+/* m0 becomes the next four schedule words, m0..m3 holding the previous 16 */
+#define SHANI_SCHED(m0, m1, m2, m3)						\
+	(m0) = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32((m0), (m1)), \
+		_mm_alignr_epi8((m3), (m2), 4)), (m3))
+
+#define SHANI_COMPRESS(m0, m1, m2, m3) do {					\
+	SHANI_ROUNDS4((m0), 0);							\
+	SHANI_ROUNDS4((m1), 4);							\
+	SHANI_ROUNDS4((m2), 8);							\
+	SHANI_ROUNDS4((m3), 12);						\
+	for (k = 16; k < 64; k += 16) {						\
+		SHANI_SCHED((m0), (m1), (m2), (m3));				\
+		SHANI_ROUNDS4((m0), k);						\
+		SHANI_SCHED((m1), (m2), (m3), (m0));				\
+		SHANI_ROUNDS4((m1), k + 4);					\
+		SHANI_SCHED((m2), (m3), (m0), (m1));				\
+		SHANI_ROUNDS4((m2), k + 8);					\
+		SHANI_SCHED((m3), (m0), (m1), (m2));				\
+		SHANI_ROUNDS4((m3), k + 12);					\
+	}									\
+} while(0)
+
+/* A..D, E..H to ABEF, CDGH */
+#define SHANI_LOAD(abcd, efgh, abef, cdgh) do {					\
+	TMP = _mm_shuffle_epi32((abcd), 0xb1);					\
+	(cdgh) = _mm_shuffle_epi32((efgh), 0x1b);				\
+	(abef) = _mm_alignr_epi8(TMP, (cdgh), 8);				\
+	(cdgh) = _mm_blend_epi16((cdgh), TMP, 0xf0);				\
+} while(0)
+
+/* ABEF, CDGH to A..D, E..H */
+#define SHANI_STORE(abef, cdgh, abcd, efgh) do {				\
+	TMP = _mm_shuffle_epi32((abef), 0x1b);					\
+	(efgh) = _mm_shuffle_epi32((cdgh), 0xb1);				\
+	(abcd) = _mm_blend_epi16(TMP, (efgh), 0xf0);				\
+	(efgh) = _mm_alignr_epi8((efgh), TMP, 8);				\
+} while(0)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void
+SHA256_Transform_SHANI(SHA256_CTX * context, const uint8_t *data)
+{
+	const __m128i	MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i		STATE0, STATE1, ABEF_SAVE, CDGH_SAVE, MSG, TMP;
+	__m128i		MSG0, MSG1, MSG2, MSG3;
+	int		k;
+
+	SHANI_LOAD(_mm_loadu_si128((const __m128i *)&context->state[0]),
+		   _mm_loadu_si128((const __m128i *)&context->state[4]), STATE0, STATE1);
+	ABEF_SAVE = STATE0;
+	CDGH_SAVE = STATE1;
+
+	MSG0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 0)), MASK);
+	MSG1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), MASK);
+	MSG2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), MASK);
+	MSG3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), MASK);
+	SHANI_COMPRESS(MSG0, MSG1, MSG2, MSG3);
+
+	STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+	STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+	SHANI_STORE(STATE0, STATE1, MSG0, MSG1);
+	_mm_storeu_si128((__m128i *)&context->state[0], MSG0);
+	_mm_storeu_si128((__m128i *)&context->state[4], MSG1);
+}
+
+/*
+ * The digest words are the next message words as they are: only the
+ * state layout has to be converted between two rounds.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void
+SHA256_Iterate_SHANI(uint32_t words[8], unsigned int count)
+{
+	const __m128i	PAD0 = _mm_set_epi32(0, 0, 0, 0x80000000);
+	const __m128i	PAD1 = _mm_set_epi32(SHA256_DIGEST_LENGTH * 8, 0, 0, 0);
+	__m128i		IV_ABEF, IV_CDGH, STATE0, STATE1, MSG, TMP;
+	__m128i		W0, W1, MSG0, MSG1, MSG2, MSG3;
+	int		k;
+
+	SHANI_LOAD(_mm_loadu_si128((const __m128i *)&sha256_initial_hash_value[0]),
+		   _mm_loadu_si128((const __m128i *)&sha256_initial_hash_value[4]), IV_ABEF, IV_CDGH);
+	W0 = _mm_loadu_si128((const __m128i *)&words[0]);
+	W1 = _mm_loadu_si128((const __m128i *)&words[4]);
+
+	while (count--)
+	{
+		STATE0 = IV_ABEF;
+		STATE1 = IV_CDGH;
+		MSG0 = W0;
+		MSG1 = W1;
+		MSG2 = PAD0;
+		MSG3 = PAD1;
+		SHANI_COMPRESS(MSG0, MSG1, MSG2, MSG3);
+
+		STATE0 = _mm_add_epi32(STATE0, IV_ABEF);
+		STATE1 = _mm_add_epi32(STATE1, IV_CDGH);
+		SHANI_STORE(STATE0, STATE1, W0, W1);
+	}
+
+	_mm_storeu_si128((__m128i *)&words[0], W0);
+	_mm_storeu_si128((__m128i *)&words[4], W1);
+}
+
+/*
+ * AVX2/BMI2: the message schedule is expanded four words at a time in
+ * vector registers and added to the round constants up front, so the
+ * scalar rounds (using BMI2 rotates) only depend on one another.
+ */
+#define ROTR_V(x, n)		_mm_or_si128(_mm_srli_epi32((x), (n)), _mm_slli_epi32((x), 32 - (n)))
+#define SIGMA_V(x, r1, r2, s)	_mm_xor_si128(_mm_xor_si128(ROTR_V((x), (r1)), ROTR_V((x), (r2))), \
+					      _mm_srli_epi32((x), (s)))
+
+#define ROUND256_WK(a,b,c,d,e,f,g,h,i) do {					\
+	T1 = (h) + Sigma1_256((e)) + Ch((e), (f), (g)) + WK[(i)];		\
+	(d) += T1;								\
+	(h) = T1 + Sigma0_256((a)) + Maj((a), (b), (c));			\
+} while(0)
+
+#define ROUNDS256_WK(i) do {							\
+	ROUND256_WK(a, b, c, d, e, f, g, h, (i) + 0);				\
+	ROUND256_WK(h, a, b, c, d, e, f, g, (i) + 1);				\
+	ROUND256_WK(g, h, a, b, c, d, e, f, (i) + 2);				\
+	ROUND256_WK(f, g, h, a, b, c, d, e, (i) + 3);				\
+	ROUND256_WK(e, f, g, h, a, b, c, d, (i) + 4);				\
+	ROUND256_WK(d, e, f, g, h, a, b, c, (i) + 5);				\
+	ROUND256_WK(c, d, e, f, g, h, a, b, (i) + 6);				\
+	ROUND256_WK(b, c, d, e, f, g, h, a, (i) + 7);				\
+} while(0)
+
+__attribute__((target("avx2,bmi2")))
+static void
+SHA256_Transform_AVX2(SHA256_CTX * context, const uint8_t *data)
+{
+	const __m128i	MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	uint32_t	W[64] __attribute__((aligned(16)));
+	uint32_t	WK[64] __attribute__((aligned(16)));
+	uint32_t	a, b, c, d, e, f, g, h, T1;
+	__m128i		x, y;
+	int		t;
+
+	for (t = 0; t < 16; t += 4)
+		_mm_store_si128((__m128i *)&W[t],
+			_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 4 * t)), MASK));
+
+	for (t = 16; t < 64; t += 4)
+	{
+		x = _mm_add_epi32(_mm_load_si128((const __m128i *)&W[t - 16]),
+			SIGMA_V(_mm_loadu_si128((const __m128i *)&W[t - 15]), 7, 18, 3));
+		x = _mm_add_epi32(x, _mm_loadu_si128((const __m128i *)&W[t - 7]));
+		/* W[t] and W[t + 1] first, they feed W[t + 2] and W[t + 3] */
+		y = _mm_loadl_epi64((const __m128i *)&W[t - 2]);
+		x = _mm_add_epi32(x, SIGMA_V(y, 17, 19, 10));
+		y = _mm_slli_si128(x, 8);
+		x = _mm_add_epi32(x, SIGMA_V(y, 17, 19, 10));
+		_mm_store_si128((__m128i *)&W[t], x);
+	}
+
+	for (t = 0; t < 64; t += 4)
+		_mm_store_si128((__m128i *)&WK[t], _mm_add_epi32(_mm_load_si128((const __m128i *)&W[t]),
+			_mm_loadu_si128((const __m128i *)&K256[t])));
+
+	a = context->state[0];
+	b = context->state[1];
+	c = context->state[2];
+	d = context->state[3];
+	e = context->state[4];
+	f = context->state[5];
+	g = context->state[6];
+	h = context->state[7];
+
+	ROUNDS256_WK(0);
+	ROUNDS256_WK(8);
+	ROUNDS256_WK(16);
+	ROUNDS256_WK(24);
+	ROUNDS256_WK(32);
+	ROUNDS256_WK(40);
+	ROUNDS256_WK(48);
+	ROUNDS256_WK(56);
+
+	context->state[0] += a;
+	context->state[1] += b;
+	context->state[2] += c;
+	context->state[3] += d;
+	context->state[4] += e;
+	context->state[5] += f;
+	context->state[6] += g;
+	context->state[7] += h;
+}
+
+/*
+ * Multi-buffer kernels for SHA256_Iterate_Batch(): every vector lane
+ * iterates its own digest. The round macros of SHA256_Compress32()
+ * work on GCC vector types as they are, and the digests stay transposed
+ * (one vector per state word) for the whole loop.
+ */
+typedef uint32_t sha256_v8 __attribute__((vector_size(32)));
+typedef uint32_t sha256_v16 __attribute__((vector_size(64)));
+
+#define SHA256_MB_ITERATE(vec, lanes) do {					\
+	vec		a, b, c, d, e, f, g, h, T1, W[16], S[8];		\
+	const vec	zero = { 0 };						\
+	int		i, l;							\
+										\
+	for (i = 0; i < 8; i++)							\
+		for (l = 0; l < (lanes); l++)					\
+			S[i][l] = words[l][i];					\
+										\
+	while (count--)								\
+	{									\
+		for (i = 0; i < 8; i++)						\
+			W[i] = S[i];						\
+		W[8] = zero + 0x80000000U;					\
+		W[9] = W[10] = W[11] = W[12] = W[13] = W[14] = zero;		\
+		W[15] = zero + SHA256_DIGEST_LENGTH * 8;			\
+										\
+		a = zero + sha256_initial_hash_value[0];			\
+		b = zero + sha256_initial_hash_value[1];			\
+		c = zero + sha256_initial_hash_value[2];			\
+		d = zero + sha256_initial_hash_value[3];			\
+		e = zero + sha256_initial_hash_value[4];			\
+		f = zero + sha256_initial_hash_value[5];			\
+		g = zero + sha256_initial_hash_value[6];			\
+		h = zero + sha256_initial_hash_value[7];			\
+										\
+		ROUNDS256_C(0);							\
+		ROUNDS256_C(8);							\
+		ROUNDS256_C(16);						\
+		ROUNDS256_C(24);						\
+		ROUNDS256_C(32);						\
+		ROUNDS256_C(40);						\
+		ROUNDS256_C(48);						\
+		ROUNDS256_C(56);						\
+										\
+		S[0] = a + sha256_initial_hash_value[0];			\
+		S[1] = b + sha256_initial_hash_value[1];			\
+		S[2] = c + sha256_initial_hash_value[2];			\
+		S[3] = d + sha256_initial_hash_value[3];			\
+		S[4] = e + sha256_initial_hash_value[4];			\
+		S[5] = f + sha256_initial_hash_value[5];			\
+		S[6] = g + sha256_initial_hash_value[6];			\
+		S[7] = h + sha256_initial_hash_value[7];			\
+	}									\
+										\
+	for (i = 0; i < 8; i++)							\
+		for (l = 0; l < (lanes); l++)					\
+			words[l][i] = S[i][l];					\
+} while(0)
+
+__attribute__((target("avx2")))
+static void
+SHA256_Iterate_AVX2x8(uint32_t words[][8], unsigned int count)
+{
+	SHA256_MB_ITERATE(sha256_v8, 8);
+}
+
+__attribute__((target("avx512f")))
+static void
+SHA256_Iterate_AVX512x16(uint32_t words[][8], unsigned int count)
+{
+	SHA256_MB_ITERATE(sha256_v16, 16);
+}
+#endif   /* SHA2_HAVE_X86 */
+
+static void
+SHA256_Transform(SHA256_CTX * context, const uint8_t *data)
+{
+	sha256_transform(context, data);
+}
+
+/*
+ * sha256_selftest - check an implementation against known answers
+ *
+ * The transform must give SHA-256("abc"), and the iterated kernel must
+ * agree with the C one when chaining from that digest.
+ */
+static int
+sha256_selftest(void (*transform)(SHA256_CTX *, const uint8_t *),
+				void (*iterate)(uint32_t[8], unsigned int))
+{
+	static const uint32_t abc[8] = {
+		0xba7816bfUL, 0x8f01cfeaUL, 0x414140deUL, 0x5dae2223UL,
+		0xb00361a3UL, 0x96177a9cUL, 0xb410ff61UL, 0xf20015adUL
+	};
+	SHA256_CTX	context;
+	uint8_t		block[SHA256_BLOCK_LENGTH];
+	uint32_t	words[8], expected[8];
+
+	memset(block, 0, sizeof(block));
+	memcpy(block, "abc", 3);
+	block[3] = 0x80;
+	block[SHA256_BLOCK_LENGTH - 1] = 3 * 8;
+
+	memcpy(context.state, sha256_initial_hash_value, sizeof(context.state));
+	transform(&context, block);
+	if (memcmp(context.state, abc, sizeof(abc)))
+		return -1;
+
+	memcpy(words, abc, sizeof(words));
+	memcpy(expected, abc, sizeof(expected));
+	iterate(words, 3);
+	SHA256_Iterate_C(expected, 3);
+
+	return memcmp(words, expected, sizeof(words)) ? -1 : 0;
+}
+
+/*
+ * sha256_selftest_mb - check a multi-buffer kernel against the C one
+ */
+static int
+sha256_selftest_mb(void (*iterate)(uint32_t[][8], unsigned int), unsigned int lanes)
+{
+	uint32_t	words[SHA256_MAX_LANES][8], expected[8];
+	unsigned int	l, j;
+
+	for (l = 0; l < lanes; l++)
+		for (j = 0; j < 8; j++)
+			words[l][j] = K256[(l * 4 + j) & 63] ^ (j << 24);
+	iterate(words, 3);
+
+	for (l = 0; l < lanes; l++)
+	{
+		for (j = 0; j < 8; j++)
+			expected[j] = K256[(l * 4 + j) & 63] ^ (j << 24);
+		SHA256_Iterate_C(expected, 3);
+		if (memcmp(words[l], expected, sizeof(expected)))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * sha256_select - pick the fastest implementation this CPU runs correctly
+ *
+ * For batches, 16 AVX-512 lanes beat the SHA extensions, which are about
+ * as fast as 8 AVX2 lanes.
+ */
+static void
+sha256_select(void)
+{
+#ifdef SHA2_HAVE_X86
+	unsigned int	features = cpu_features();
+
+	if ((features & CPU_F_AVX512F) && !sha256_selftest_mb(SHA256_Iterate_AVX512x16, 16))
+	{
+		sha256_iterate_mb = SHA256_Iterate_AVX512x16;
+		sha256_lanes = 16;
+	}
+	else if ((features & (CPU_F_AVX2 | CPU_F_SHA)) == CPU_F_AVX2 &&
+			 !sha256_selftest_mb(SHA256_Iterate_AVX2x8, 8))
+	{
+		sha256_iterate_mb = SHA256_Iterate_AVX2x8;
+		sha256_lanes = 8;
+	}
+
+	if ((features & (CPU_F_SHA | CPU_F_SSSE3 | CPU_F_SSE41)) == (CPU_F_SHA | CPU_F_SSSE3 | CPU_F_SSE41) &&
+		!sha256_selftest(SHA256_Transform_SHANI, SHA256_Iterate_SHANI))
+	{
+		sha256_transform = SHA256_Transform_SHANI;
+		sha256_iterate = SHA256_Iterate_SHANI;
+		return;
+	}
+
+	if ((features & (CPU_F_AVX2 | CPU_F_BMI2)) == (CPU_F_AVX2 | CPU_F_BMI2) &&
+		!sha256_selftest(SHA256_Transform_AVX2, SHA256_Iterate_C))
+	{
+		sha256_transform = SHA256_Transform_AVX2;
+		return;
+	}
+#endif
+}
+
+static void
+sha256_load_digest(uint32_t words[8], const uint8_t digest[SHA256_DIGEST_LENGTH])
+{
+	int		j;
+
+	for (j = 0; j < 8; j++)
+		words[j] = (uint32_t) digest[4 * j + 3] | ((uint32_t) digest[4 * j + 2] << 8) |
+			((uint32_t) digest[4 * j + 1] << 16) | ((uint32_t) digest[4 * j] << 24);
+}
+
+static void
+sha256_store_digest(uint8_t digest[SHA256_DIGEST_LENGTH], const uint32_t words[8])
+{
+	int		j;
+
+	for (j = 0; j < 8; j++)
+	{
+		digest[4 * j] = words[j] >> 24;
+		digest[4 * j + 1] = words[j] >> 16;
+		digest[4 * j + 2] = words[j] >> 8;
+		digest[4 * j + 3] = words[j];
+	}
+}
+
+void
+SHA256_Iterate(uint8_t digest[SHA256_DIGEST_LENGTH], unsigned int count)
+{
+	uint32_t	words[8];
+
+	if (!count)
+		return;
+
+	pthread_once(&sha256_once, sha256_select);
+
+	sha256_load_digest(words, digest);
+	sha256_iterate(words, count);
+	sha256_store_digest(digest, words);
+}
+
+/*
+ * SHA256_Iterate_Batch - SHA256_Iterate() n independent digests
+ *
+ * Digests are processed a vector of lanes at a time when the CPU has a
+ * multi-buffer kernel. A short tail is padded to a full vector unless
+ * it is small enough to be cheaper one digest at a time.
+ */
+void
+SHA256_Iterate_Batch(uint8_t digests[][SHA256_DIGEST_LENGTH], size_t n, unsigned int count)
+{
+	uint32_t	words[SHA256_MAX_LANES][8];
+	unsigned int	lanes, l;
+
+	if (!count)
+		return;
+
+	pthread_once(&sha256_once, sha256_select);
+
+	while (sha256_lanes > 1 && n > sha256_lanes / 4)
+	{
+		lanes = n < sha256_lanes ? n : sha256_lanes;
+
+		memset(words, 0, sizeof(words));
+		for (l = 0; l < lanes; l++)
+			sha256_load_digest(words[l], digests[l]);
+		sha256_iterate_mb(words, count);
+		for (l = 0; l < lanes; l++)
+			sha256_store_digest(digests[l], words[l]);
+
+		digests += lanes;
+		n -= lanes;
+	}
+
+	for (; n; n--, digests++)
+		SHA256_Iterate(*digests, count);
+}
+
 void
 SHA256_Update(SHA256_CTX * context, const uint8_t *data, size_t len)
 {
@@ -45,6 +45,8 @@
 #define SHA256_Init pg_SHA256_Init
 #define SHA256_Update pg_SHA256_Update
 #define SHA256_Final pg_SHA256_Final
+#define SHA256_Iterate pg_SHA256_Iterate
+#define SHA256_Iterate_Batch pg_SHA256_Iterate_Batch
 #define SHA384_Init pg_SHA384_Init
 #define SHA384_Update pg_SHA384_Update
 #define SHA384_Final pg_SHA384_Final
@@ -78,5 +80,7 @@ typedef struct _SHA256_CTX
 void		SHA256_Init(SHA256_CTX *);
 void		SHA256_Update(SHA256_CTX *, const uint8_t *, size_t);
 void		SHA256_Final(uint8_t[SHA256_DIGEST_LENGTH], SHA256_CTX *);
+void		SHA256_Iterate(uint8_t[SHA256_DIGEST_LENGTH], unsigned int);
+void		SHA256_Iterate_Batch(uint8_t[][SHA256_DIGEST_LENGTH], size_t, unsigned int);
 
 #endif   /* _SHA2_H */
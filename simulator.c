@@ -25,72 +25,499 @@
 #include <errno.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include <netpacket/packet.h>
+#include <linux/filter.h>
 #include <net/if.h>
 #include <net/ethernet.h>
+#include <arpa/inet.h>
 
 #include <linux/if_ether.h>
 
 #include <event2/event-config.h>
 #include <event2/event.h>
 #include <event2/util.h>
+#include <event2/thread.h>
 
 #include "homeplug_av.h"
+#include "mme.h"
+#include "crc32.h"
 
+#define SIM_MAX_AVLN	64	/* stations per AVLN, bounded by the NW_INFO CNF size */
+#define SIM_MAX_STATIONS (1 << 20)
+#define SIM_MAX_WORKERS	64
+#define SIM_RX_BURST	64	/* frames read per socket wakeup */
+#define SIM_SDRAM_SIZE	(16 << 20)	/* default SDRAM size of a station */
+#define SIM_REBOOT_MS	1000	/* default time a station takes to reset */
+#define SIM_CHUNK	1024	/* most data bytes per memory or module MME */
+#define SIM_MOD_MAX	(4 << 20)	/* largest module a station stores */
+#define SIM_NVM_RATE	256	/* flash programming speed, KB/s */
+
+/* Not in every libc's <netpacket/packet.h> yet */
+#ifndef PACKET_FANOUT_CBPF
+#define PACKET_FANOUT_CBPF	6
+#endif
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING	23
+#endif
+
+static const uint8_t sim_qca_oui[3] = { 0x00, 0xB0, 0x52 };
+static const uint8_t sim_local_mac[ETH_ALEN] = { 0x00, 0xB0, 0x52, 0x00, 0x00, 0x01 };
+static const uint8_t sim_bcast_mac[ETH_ALEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+static const char *sim_versions[] = {
+	"INT6000-MAC-4-1-4102-00-3679-20090724-FINAL-B",
+	"INT6300-MAC-4-4-4405-00-4203-20091229-FINAL-C",
+	"INT6400-MAC-4-4-4405-01-4203-20100212-FINAL-C",
+	"QCA7420-MAC-1-1-0013-02-20130328-FINAL",
+};
+
+/* Response latency distributions */
+enum sim_latency {
+	SIM_LAT_NONE = 0,
+	SIM_LAT_FIXED,		/* @lat_a ms */
+	SIM_LAT_UNIFORM,	/* between @lat_a and @lat_b ms */
+	SIM_LAT_LOGNORMAL,	/* median @lat_a ms, shape @lat_b */
+};
+
+/**
+ * sim_profile - impairments of a station
+ * @latency:	response latency distribution
+ * @lat_a:	first latency parameter
+ * @lat_b:	second latency parameter
+ * @drop:	probability to ignore a request
+ * @dup:	probability to send a reply twice
+ * @reorder:	probability to hold a reply back so later ones overtake it
+ * @rate:	MMEs per second the station answers, 0 for no limit
+ * @burst:	token bucket depth of @rate
+ */
+struct sim_profile {
+	enum sim_latency	latency;
+	double			lat_a;
+	double			lat_b;
+	double			drop;
+	double			dup;
+	double			reorder;
+	double			rate;
+	double			burst;
+};
+
+/**
+ * sim_station - virtual station
+ * @mac:	station MAC address
+ * @tei:	terminal equipment identifier in its AVLN
+ * @role:	HPAV_SR_STA or HPAV_SR_CCO
+ * @device_id:	INTx000_DEVICE_ID
+ * @tx_rate:	average PHY TX rate to its AVLN (Mbps)
+ * @rx_rate:	average PHY RX rate from its AVLN (Mbps)
+ * @avln:	index of the first station (the CCo) of its AVLN
+ * @version:	software version string
+ * @profile:	impairments of the station
+ */
+struct sim_station {
+	uint8_t		mac[ETH_ALEN];
+	uint8_t		tei;
+	uint8_t		role;
+	uint8_t		device_id;
+	uint8_t		tx_rate;
+	uint8_t		rx_rate;
+	uint32_t	avln;
+	const char	*version;
+	const struct sim_profile *profile;
+};
+
+/* Modules of a station, and the size of the ones it ships with */
+static const struct {
+	uint8_t		id;
+	size_t		size;
+} sim_modules[] = {
+	{ MAC_SL_IMG, 64 << 10 },
+	{ MAC_SW_IMG, 1 << 20 },
+	{ PIB, 16 << 10 },
+	{ WR_ALT_FLSH, 0 },
+};
+
+#define SIM_NUM_MODULES	(sizeof(sim_modules) / sizeof(sim_modules[0]))
+
+/**
+ * sim_module - module store
+ * @data:	module contents, NULL for a factory module (see sim_nvm_read)
+ * @size:	bytes of the module
+ * @alloc:	bytes allocated at @data
+ */
+struct sim_module {
+	uint8_t		*data;
+	size_t		size;
+	size_t		alloc;
+};
+
+/**
+ * sim_device - memory and module state of a station, created on its first write
+ * @lock:	serializes the workers, which may all reach the station
+ * @sdram:	SDRAM image, mapped on the first WR_MEM_REQ, zeroed on reset
+ * @staged:	modules written with WR_MOD_REQ, lost on reset
+ * @nvm:	modules in the NVM, the factory ones until NVM_MOD_REQ replaces them
+ *
+ * A station without one reads as zeroed SDRAM and factory modules.
+ */
+struct sim_device {
+	pthread_mutex_t		lock;
+	uint8_t			*sdram;
+	struct sim_module	staged[SIM_NUM_MODULES];
+	struct sim_module	nvm[SIM_NUM_MODULES];
+};
+
+/**
+ * sim - simulated powerline network, read-only once set up but for @devices and @ready
+ * @stations:	virtual stations
+ * @num_stations: number of @stations
+ * @avln_size:	stations per AVLN
+ * @slots:	MAC hash table, station index + 1, 0 when empty
+ * @mask:	number of @slots - 1
+ * @start:	time the simulator started, for link statistics
+ * @profiles:	impairment profiles, the first one is the default
+ * @num_profiles: number of @profiles
+ * @seed:	random seed, replies are reproducible for a given seed
+ * @workers:	worker threads, each with its own socket and event loop
+ * @devices:	device state of each station, NULL until it is needed
+ * @ready:	time each station is back from a reset, in us
+ * @sdram_size:	SDRAM size of a station
+ * @reboot_ms:	time a station stays silent after a reset
+ */
+struct sim {
+	struct sim_station	*stations;
+	uint32_t		num_stations;
+	uint32_t		avln_size;
+	uint32_t		*slots;
+	uint32_t		mask;
+	struct timespec		start;
+	struct sim_profile	*profiles;
+	unsigned int		num_profiles;
+	uint64_t		seed;
+	unsigned int		workers;
+	struct sim_device	**devices;
+	uint64_t		*ready;
+	uint32_t		sdram_size;
+	unsigned int		reboot_ms;
+};
+
+/**
+ * sim_bucket - token bucket of a station
+ * @tokens:	MMEs the station may still answer
+ * @last:	time of the last refill, in us
+ */
+struct sim_bucket {
+	double		tokens;
+	uint64_t	last;
+};
+
+/*
+ * One context per worker: token buckets are per worker too, so a
+ * station reached through several workers answers each at its rate.
+ */
 struct context {
+	struct sim *sim;
 	struct event_base *ev;
 	struct event *read_ev;
 	int sock_fd;
 	const char *iface;
 	int if_index;
+	unsigned int id;
+	pthread_t thread;
+	uint64_t rng;
+	struct sim_bucket *buckets;
+	double hold_ms;		/* extra latency the last handler asked for */
+	uint64_t requests;
+	uint64_t replies;
+};
+
+/**
+ * sim_pending - reply waiting for its latency to elapse
+ */
+struct sim_pending {
+	struct context		*ctx;
+	const struct sim_station *st;
+	uint8_t			to[ETH_ALEN];
+	uint16_t		mmtype;
+	size_t			len;
+	uint8_t			payload[0];
+};
+
+/**
+ * sim_handler - MME handler of a station
+ * @mmtype:	request MM type, the confirm is @mmtype + 1
+ * @handler:	fills the confirm payload, returns its length, 0 for no reply
+ */
+struct sim_handler {
+	uint16_t	mmtype;
+	size_t		(*handler)(struct context *ctx, struct sim_station *st,
+				   const uint8_t *req, size_t len, uint8_t *cnf);
 };
 
-static int sim_send_pkt(struct context *ctx, const uint8_t *to,
-			const void *hdr, size_t hdrlen,
-			const void *payload, size_t payload_len)
+/*
+ * Mixes all of the MAC address so the low bits used as the slot index
+ * differ between consecutive stations.
+ */
+static inline uint32_t sim_hash(const uint8_t *mac)
 {
-	struct sockaddr_ll ll;
-	struct msghdr msg;
-	struct iovec iov[3];
-	size_t total_len;
-	uint8_t padding[64];
-	int ret;
+	uint64_t k = 0;
+	int i;
 
-	memset(&msg, 0, sizeof(msg));
-	msg.msg_iov = iov;
-	total_len = 0;
+	for (i = 0; i < ETH_ALEN; i++)
+		k = (k << 8) | mac[i];
 
-	iov[msg.msg_iovlen].iov_base = (void *)hdr;
-	iov[msg.msg_iovlen].iov_len = hdrlen;
-	total_len += hdrlen;
-	msg.msg_iovlen = 1;
+	k = (k ^ (k >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	k = (k ^ (k >> 27)) * 0x94d049bb133111ebULL;
+	return k ^ (k >> 31);
+}
+
+static struct sim_station *sim_lookup(struct sim *sim, const uint8_t *mac)
+{
+	uint32_t i = sim_hash(mac) & sim->mask;
+	uint32_t idx;
 
-	if (payload_len) {
-		iov[msg.msg_iovlen].iov_base = (void *)payload;
-		iov[msg.msg_iovlen].iov_len = payload_len;
-		total_len += payload_len;
-		msg.msg_iovlen++;
+	while ((idx = sim->slots[i])) {
+		if (!memcmp(sim->stations[idx - 1].mac, mac, ETH_ALEN))
+			return &sim->stations[idx - 1];
+		i = (i + 1) & sim->mask;
 	}
 
-	if (total_len < 64) {
-		memset(padding, 0, sizeof(padding));
-		iov[msg.msg_iovlen].iov_base = (void *)padding;
-		iov[msg.msg_iovlen].iov_len = 64 - total_len;
-		msg.msg_iovlen++;
+	return NULL;
+}
+
+/**
+ * sim_init_stations - create the virtual stations
+ * @base:	MAC address of the first station, the others follow it
+ * @version:	software version of every station, NULL to mix a few
+ *
+ * Stations are grouped into AVLNs of @sim->avln_size, the first
+ * station of each being its CCo.
+ */
+static int sim_init_stations(struct sim *sim, const uint8_t *base, const char *version)
+{
+	uint64_t mac = 0;
+	uint32_t n, i, j, size;
+	struct sim_station *st;
+
+	for (j = 0; j < ETH_ALEN; j++)
+		mac = (mac << 8) | base[j];
+
+	for (size = 2; size < 2 * sim->num_stations; size <<= 1)
+		;
+
+	sim->stations = calloc(sim->num_stations, sizeof(*sim->stations));
+	sim->slots = calloc(size, sizeof(*sim->slots));
+	if (!sim->stations || !sim->slots) {
+		fprintf(stderr, "failed to allocate %u stations\n", sim->num_stations);
+		return -ENOMEM;
+	}
+	sim->mask = size - 1;
+
+	for (n = 0; n < sim->num_stations; n++) {
+		st = &sim->stations[n];
+		for (j = 0; j < ETH_ALEN; j++)
+			st->mac[j] = (mac + n) >> (8 * (ETH_ALEN - 1 - j));
+
+		st->avln = n - n % sim->avln_size;
+		st->tei = n % sim->avln_size + 1;
+		st->role = st->tei == 1 ? HPAV_SR_CCO : HPAV_SR_STA;
+		st->device_id = INT6000_DEVICE_ID + n % 3;
+		st->tx_rate = 40 + (n * 37) % 110;
+		st->rx_rate = 40 + (n * 53) % 110;
+		st->version = version ? version :
+			sim_versions[n % (sizeof(sim_versions) / sizeof(sim_versions[0]))];
+		st->profile = &sim->profiles[0];
+
+		if (sim_lookup(sim, st->mac)) {
+			fprintf(stderr, "station MAC addresses wrap around\n");
+			return -EINVAL;
+		}
+		for (i = sim_hash(st->mac) & sim->mask; sim->slots[i]; i = (i + 1) & sim->mask)
+			;
+		sim->slots[i] = n + 1;
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &sim->start);
+
+	return 0;
+}
+
+static int sim_parse_mac(const char *str, uint8_t *mac)
+{
+	return sscanf(str, "%"SCNx8":%"SCNx8":%"SCNx8":%"SCNx8":%"SCNx8":%"SCNx8"",
+		      &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) == ETH_ALEN ? 0 : -1;
+}
+
+static int sim_parse_prob(const char *str, double *prob)
+{
+	char *end;
+
+	*prob = strtod(str, &end);
+
+	return (*end || *prob < 0 || *prob > 1) ? -1 : 0;
+}
+
+/**
+ * sim_parse_option - set one impairment of a profile
+ * @key:	latency, drop, dup, reorder or rate
+ * @val:	"none", "fixed:MS", "uniform:MIN:MAX" or "lognormal:MEDIAN:SIGMA"
+ *		for latency, a probability or "MMES[:BURST]" for rate
+ */
+static int sim_parse_option(struct sim_profile *p, const char *key, const char *val)
+{
+	char *end;
+
+	if (!strcmp(key, "latency")) {
+		if (!strcmp(val, "none")) {
+			p->latency = SIM_LAT_NONE;
+			return 0;
+		}
+		if (sscanf(val, "fixed:%lf", &p->lat_a) == 1) {
+			p->latency = SIM_LAT_FIXED;
+			return p->lat_a < 0 ? -1 : 0;
+		}
+		if (sscanf(val, "uniform:%lf:%lf", &p->lat_a, &p->lat_b) == 2) {
+			p->latency = SIM_LAT_UNIFORM;
+			return (p->lat_a < 0 || p->lat_b < p->lat_a) ? -1 : 0;
+		}
+		if (sscanf(val, "lognormal:%lf:%lf", &p->lat_a, &p->lat_b) == 2) {
+			p->latency = SIM_LAT_LOGNORMAL;
+			return (p->lat_a <= 0 || p->lat_b < 0) ? -1 : 0;
+		}
+		return -1;
+	}
+	if (!strcmp(key, "drop"))
+		return sim_parse_prob(val, &p->drop);
+	if (!strcmp(key, "dup"))
+		return sim_parse_prob(val, &p->dup);
+	if (!strcmp(key, "reorder"))
+		return sim_parse_prob(val, &p->reorder);
+	if (!strcmp(key, "rate")) {
+		p->rate = strtod(val, &end);
+		p->burst = p->rate < 1 ? 1 : p->rate;
+		if (*end == ':')
+			p->burst = strtod(end + 1, &end);
+		return (*end || p->rate < 0 || p->burst < 1) ? -1 : 0;
+	}
+
+	return -1;
+}
+
+/**
+ * sim_load_profiles - read per-station impairments
+ * @path:	lines of "MAC key=value...", keys as for sim_parse_option()
+ *
+ * Impairments not given on a line are those of the default profile.
+ */
+static int sim_load_profiles(struct sim *sim, const char *path)
+{
+	struct sim_profile *profiles;
+	struct sim_station *st;
+	uint8_t (*macs)[ETH_ALEN] = NULL;
+	char *line = NULL, *tok, *val, *save;
+	size_t size = 0;
+	unsigned int n = 1, max = 1, i;
+	int lineno = 0, ret = -EINVAL;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return -errno;
+	}
+
+	while (getline(&line, &size, fp) >= 0) {
+		lineno++;
+		tok = strtok_r(line, " \t\r\n", &save);
+		if (!tok || tok[0] == '#')
+			continue;
+
+		if (n == max) {
+			max *= 2;
+			profiles = realloc(sim->profiles, max * sizeof(*profiles));
+			macs = realloc(macs, max * sizeof(*macs));
+			if (!profiles || !macs) {
+				if (profiles)
+					sim->profiles = profiles;
+				ret = -ENOMEM;
+				goto out;
+			}
+			sim->profiles = profiles;
+		}
+
+		if (sim_parse_mac(tok, macs[n])) {
+			fprintf(stderr, "%s:%d: invalid MAC address\n", path, lineno);
+			goto out;
+		}
+		sim->profiles[n] = sim->profiles[0];
+
+		while ((tok = strtok_r(NULL, " \t\r\n", &save))) {
+			val = strchr(tok, '=');
+			if (val)
+				*val++ = '\0';
+			if (!val || sim_parse_option(&sim->profiles[n], tok, val)) {
+				fprintf(stderr, "%s:%d: invalid impairment %s\n", path, lineno, tok);
+				goto out;
+			}
+		}
+		n++;
+	}
+
+	/* The array is final, stations may point into it now */
+	for (i = 0; i < sim->num_stations; i++)
+		sim->stations[i].profile = &sim->profiles[0];
+	for (i = 1; i < n; i++) {
+		st = sim_lookup(sim, macs[i]);
+		if (st)
+			st->profile = &sim->profiles[i];
+	}
+	sim->num_profiles = n;
+	ret = 0;
+
+out:
+	free(macs);
+	free(line);
+	fclose(fp);
+	return ret;
+}
+
+static int sim_send_vendor_pkt(struct context *ctx, const struct sim_station *st,
+				const uint8_t *to, uint16_t mmtype,
+				const void *payload, size_t payload_len)
+{
+	struct {
+		struct ether_header eth;
+		struct hpav_frame_header mm;
+	} __attribute__((__packed__)) hdr;
+	struct sockaddr_ll ll;
+	struct iovec iov;
+	ssize_t ret;
+
+	memcpy(hdr.eth.ether_dhost, to, ETH_ALEN);
+	memcpy(hdr.eth.ether_shost, st->mac, ETH_ALEN);
+	hdr.eth.ether_type = htons(ETHERTYPE_HOMEPLUG_AV);
+	hdr.mm.mmver = 0;
+	hdr.mm.mmtype = htole16(mmtype);
+
 	memset(&ll, 0, sizeof(ll));
 	ll.sll_family = AF_PACKET;
 	ll.sll_ifindex = ctx->if_index;
 	ll.sll_protocol = htons(ETHERTYPE_HOMEPLUG_AV);
 
-	memcpy(ll.sll_addr, to, ETH_ALEN);
-	msg.msg_name = &ll;
-	msg.msg_namelen = sizeof(ll);
+	iov.iov_base = (void *)payload;
+	iov.iov_len = payload_len;
 
-	ret = sendmsg(ctx->sock_fd, &msg, 0);
+	ret = mme_sendv(ctx->sock_fd, (struct sockaddr *)&ll, sizeof(ll),
+			&hdr, sizeof(hdr), sim_qca_oui, &iov, 1, ETH_ZLEN);
 	if (ret < 0) {
 		if (errno != EAGAIN)
 			perror("sendmsg");
@@ -100,82 +527,912 @@ static int sim_send_pkt(struct context *ctx, const uint8_t *to,
 	return 0;
 }
 
-struct homeplug_av_vendor_hdr {
-	uint8_t mmver;
-	uint16_t mmtype;
-	uint8_t oui[3];
-} __attribute__((__packed__));
+static size_t sim_get_sw(struct context *ctx, struct sim_station *st,
+			 const uint8_t *req, size_t len, uint8_t *cnf)
+{
+	struct get_device_sw_version_confirm *mm = (void *)cnf;
 
-static int sim_send_vendor_pkt(struct context *ctx, const uint8_t *to,
-				uint16_t mmtype, const void *payload, size_t payload_len)
+	memset(mm, 0, sizeof(*mm));
+	mm->mstatus = 0;
+	mm->device_id = st->device_id;
+	mm->version_length = strlen(st->version);
+	if (mm->version_length > sizeof(mm->version))
+		mm->version_length = sizeof(mm->version);
+	memcpy(mm->version, st->version, mm->version_length);
+	mm->upgradeable = 1;
+
+	return sizeof(*mm);
+}
+
+static size_t sim_nw_info(struct context *ctx, struct sim_station *st,
+			  const uint8_t *req, size_t len, uint8_t *cnf)
 {
-	struct homeplug_av_vendor_hdr hdr;
+	struct sim *sim = ctx->sim;
+	struct network_info_confirm *mm = (void *)cnf;
+	struct sim_station *cco = &sim->stations[st->avln];
+	struct sim_station *peer;
+	uint32_t i, end;
+
+	memset(mm, 0, sizeof(*mm));
+	mm->num_avlns = 1;
+	/* One NID per AVLN, the upper bits mark it as simulated */
+	memcpy(mm->nid, "\x5a\x5a\x00\x00\x00\x00\x00", sizeof(mm->nid));
+	mm->nid[3] = st->avln >> 16;
+	mm->nid[4] = st->avln >> 8;
+	mm->nid[5] = st->avln;
+	mm->snid = (st->avln / sim->avln_size) & 0xf;
+	mm->tei = st->tei;
+	mm->sta_role = st->role;
+	memcpy(mm->cco_macaddr, cco->mac, ETH_ALEN);
+	mm->cco_tei = cco->tei;
 
-	memset(&hdr, 0, sizeof(hdr));
-	hdr.mmver = 0;
-	hdr.mmtype = mmtype;
-	hdr.oui[0] = 0x00;
-	hdr.oui[1] = 0xB0;
-	hdr.oui[2] = 0x52;
+	end = st->avln + sim->avln_size;
+	if (end > sim->num_stations)
+		end = sim->num_stations;
 
-	return sim_send_pkt(ctx, to, &hdr, sizeof(hdr), payload, payload_len);
+	for (i = st->avln; i < end; i++) {
+		peer = &sim->stations[i];
+		if (peer == st)
+			continue;
+		memcpy(mm->stas[mm->num_stas].sta_macaddr, peer->mac, ETH_ALEN);
+		mm->stas[mm->num_stas].sta_tei = peer->tei;
+		memset(mm->stas[mm->num_stas].bridge_macaddr, 0, ETH_ALEN);
+		mm->stas[mm->num_stas].avg_phy_tx_rate = (st->tx_rate + peer->rx_rate) / 2;
+		mm->stas[mm->num_stas].avg_phy_rx_rate = (st->rx_rate + peer->tx_rate) / 2;
+		mm->num_stas++;
+	}
+
+	return sizeof(*mm) + mm->num_stas * sizeof(mm->stas[0]);
 }
 
-static void sim_read_cb(evutil_socket_t fd, short flags, void *argv)
+/* Link counters grow with uptime at a pace set by the PHY rate */
+static void sim_tx_stats(struct tx_link_stats *tx, uint64_t ms, uint8_t rate, uint32_t n)
 {
-	struct context *ctx = argv;
-	char frame[ETH_DATA_LEN];
-	ssize_t len;
-	socklen_t lllen;
-	struct sockaddr_ll ll;
-	struct hpav_frame_header *hdr;
-	const void *payload = NULL;
-	size_t payload_size = 0;
-	uint8_t qca_bcast[ETH_ALEN] = { 0x00, 0xB0, 0x52, 0x00, 0x00, 0x00 };
-	int ret;
+	uint64_t mpdu = ms * rate / 8;
 
+	tx->mpdu_ack = htole64(mpdu);
+	tx->mpdu_coll = htole64(mpdu / 200);
+	tx->mpdu_fail = htole64(mpdu / (1000 + n % 1000));
+	tx->pb_passed = htole64(mpdu * 3);
+	tx->pb_failed = htole64(mpdu * 3 / (500 + n % 500));
+}
 
-	lllen = sizeof(ll);
-	len = recvfrom(ctx->sock_fd, frame, sizeof(frame), 0,
-			(struct sockaddr *)&ll, &lllen);
-	if (len < 0 || len < HPAV_MIN_FRAMSIZ) {
-		if (errno != EAGAIN)
-			perror("recvfrom");
+static void sim_rx_stats(struct rx_link_stats *rx, uint64_t ms, uint8_t rate, uint32_t n)
+{
+	uint64_t mpdu = ms * rate / 8;
+
+	rx->mpdu_ack = htole64(mpdu);
+	rx->mpdu_fail = htole64(mpdu / (1000 + n % 1000));
+	rx->pb_passed = htole64(mpdu * 3);
+	rx->pb_failed = htole64(mpdu * 3 / (500 + n % 500));
+	rx->tbe_passed = htole64(mpdu * 3);
+	rx->tbe_failed = htole64(mpdu * 3 / (2000 + n % 500));
+	rx->num_rx_intervals = 0;
+}
+
+static size_t sim_link_stats(struct context *ctx, struct sim_station *st,
+			     const uint8_t *req, size_t len, uint8_t *cnf)
+{
+	const struct link_statistics_request *rq = (const void *)req;
+	struct link_statistics_confirm *mm = (void *)cnf;
+	struct sim *sim = ctx->sim;
+	struct sim_station *peer;
+	struct timespec now;
+	uint64_t ms;
+	uint32_t n;
+
+	if (len < sizeof(*rq))
+		return 0;
+
+	memset(mm, 0, sizeof(*mm));
+	mm->direction = rq->direction;
+	mm->link_id = rq->link_id;
+
+	peer = sim_lookup(sim, rq->macaddr);
+	if (!peer || peer == st || peer->avln != st->avln) {
+		mm->mstatus = HPAV_INV_MAC;
+		return 4;
+	}
+	mm->tei = peer->tei;
+	n = peer - sim->stations;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (now.tv_sec - sim->start.tv_sec) * 1000ULL +
+	     (now.tv_nsec - sim->start.tv_nsec) / 1000000;
+
+	switch (rq->direction) {
+	case HPAV_SD_TX:
+		sim_tx_stats(&mm->tx, ms, st->tx_rate, n);
+		return 4 + sizeof(mm->tx);
+	case HPAV_SD_RX:
+		sim_rx_stats(&mm->rx, ms, st->rx_rate, n);
+		return 4 + sizeof(mm->rx);
+	case HPAV_SD_BOTH:
+		sim_tx_stats(&mm->both.tx, ms, st->tx_rate, n);
+		sim_rx_stats(&mm->both.rx, ms, st->rx_rate, n);
+		return 4 + sizeof(mm->both);
+	default:
+		mm->mstatus = HPAV_INV_DIR;
+		return 4;
+	}
+}
+
+static uint64_t sim_clock_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int sim_module_index(uint8_t id)
+{
+	unsigned int i;
+
+	for (i = 0; i < SIM_NUM_MODULES; i++)
+		if (sim_modules[i].id == id)
+			return i;
+
+	return -1;
+}
+
+static int sim_module_reserve(struct sim_module *m, size_t size)
+{
+	uint8_t *data;
+	size_t alloc;
+
+	if (size <= m->alloc)
+		return 0;
+
+	for (alloc = m->alloc ? m->alloc : SIM_CHUNK; alloc < size; alloc <<= 1)
+		;
+	data = realloc(m->data, alloc);
+	if (!data)
+		return -ENOMEM;
+	m->data = data;
+	m->alloc = alloc;
+
+	return 0;
+}
+
+static void sim_free_device(struct sim *sim, struct sim_device *dev)
+{
+	unsigned int i;
+
+	if (dev->sdram)
+		munmap(dev->sdram, sim->sdram_size);
+	for (i = 0; i < SIM_NUM_MODULES; i++) {
+		free(dev->staged[i].data);
+		free(dev->nvm[i].data);
+	}
+	pthread_mutex_destroy(&dev->lock);
+	free(dev);
+}
+
+/**
+ * sim_new_device - create the device state of a station
+ *
+ * Nothing is allocated for the SDRAM or the factory modules yet.
+ */
+static struct sim_device *sim_new_device(void)
+{
+	struct sim_device *dev;
+	size_t i;
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
+		return NULL;
+	pthread_mutex_init(&dev->lock, NULL);
+
+	for (i = 0; i < SIM_NUM_MODULES; i++)
+		dev->nvm[i].size = sim_modules[i].size;
+
+	return dev;
+}
+
+/*
+ * The SDRAM is mapped without reserving swap, so only the pages
+ * clients touch cost memory. Called with the device lock held.
+ */
+static int sim_map_sdram(struct sim *sim, struct sim_device *dev)
+{
+	uint8_t *sdram;
+
+	if (dev->sdram)
+		return 0;
+
+	sdram = mmap(NULL, sim->sdram_size, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (sdram == MAP_FAILED)
+		return -ENOMEM;
+	dev->sdram = sdram;
+
+	return 0;
+}
+
+/*
+ * Factory modules only depend on the seed, the station and the
+ * position, and are computed as they are read.
+ */
+static uint64_t sim_factory_word(struct sim *sim, uint32_t n, unsigned int i, uint64_t w)
+{
+	uint64_t x = sim->seed + 0x9e3779b97f4a7c15ULL *
+		     (((uint64_t)n << 32) | ((uint64_t)i << 24) | w);
+
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/**
+ * sim_nvm_read - read module @i from the NVM of station @n
+ * @m:		NVM module of the station, NULL when it has no device state
+ */
+static void sim_nvm_read(struct sim *sim, uint32_t n, unsigned int i, const struct sim_module *m,
+			 size_t offset, uint8_t *buf, size_t length)
+{
+	size_t done, skip, chunk;
+	uint64_t x;
+
+	if (m && m->data) {
+		memcpy(buf, m->data + offset, length);
 		return;
 	}
 
-	hdr = (struct hpav_frame_header *)frame;
+	for (done = 0; done < length; done += chunk) {
+		x = htole64(sim_factory_word(sim, n, i, (offset + done) / sizeof(x)));
+		skip = (offset + done) % sizeof(x);
+		chunk = sizeof(x) - skip;
+		if (chunk > length - done)
+			chunk = length - done;
+		memcpy(buf + done, (uint8_t *)&x + skip, chunk);
+	}
+}
+
+/**
+ * sim_get_device - device state of a station
+ * @create:	create it if the station has none yet, only writes need to
+ */
+static struct sim_device *sim_get_device(struct sim *sim, const struct sim_station *st,
+					 int create)
+{
+	uint32_t n = st - sim->stations;
+	struct sim_device *dev, *cur = NULL;
+
+	dev = __atomic_load_n(&sim->devices[n], __ATOMIC_ACQUIRE);
+	if (dev || !create)
+		return dev;
+
+	dev = sim_new_device();
+	if (!dev) {
+		fprintf(stderr, "failed to allocate the device of station %u\n", n);
+		return NULL;
+	}
+
+	/* Another worker may have got there first */
+	if (!__atomic_compare_exchange_n(&sim->devices[n], &cur, dev, 0,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		sim_free_device(sim, dev);
+		dev = cur;
+	}
+
+	return dev;
+}
+
+static uint8_t sim_check_range(struct sim *sim, uint32_t address, uint32_t length)
+{
+	if (length > SIM_CHUNK)
+		return INV_LEN;
+	if (address > sim->sdram_size || length > sim->sdram_size - address)
+		return UNEX_OFF;
+
+	return SUCCESS;
+}
+
+static size_t sim_wr_mem(struct context *ctx, struct sim_station *st,
+			 const uint8_t *req, size_t len, uint8_t *cnf)
+{
+	const struct write_mac_memory_request *rq = (const void *)req;
+	struct write_mac_memory_confirm *mm = (void *)cnf;
+	struct sim_device *dev;
+	uint32_t address, length;
+
+	if (len < sizeof(*rq))
+		return 0;
+	dev = sim_get_device(ctx->sim, st, 1);
+	if (!dev)
+		return 0;
+
+	address = le32toh(rq->address);
+	length = le32toh(rq->length);
+
+	memset(mm, 0, sizeof(*mm));
+	mm->address = rq->address;
+	mm->length = rq->length;
+	mm->mstatus = sim_check_range(ctx->sim, address, length);
+	if (mm->mstatus == SUCCESS && len < sizeof(*rq) + length)
+		mm->mstatus = INV_LEN;
+	if (mm->mstatus != SUCCESS)
+		return sizeof(*mm);
+
+	pthread_mutex_lock(&dev->lock);
+	if (sim_map_sdram(ctx->sim, dev)) {
+		pthread_mutex_unlock(&dev->lock);
+		fprintf(stderr, "failed to map the SDRAM of station %u\n",
+			(unsigned int)(st - ctx->sim->stations));
+		return 0;
+	}
+	memcpy(dev->sdram + address, rq->data, length);
+	pthread_mutex_unlock(&dev->lock);
+
+	return sizeof(*mm);
+}
+
+static size_t sim_rd_mem(struct context *ctx, struct sim_station *st,
+			 const uint8_t *req, size_t len, uint8_t *cnf)
+{
+	const struct read_mac_memory_request *rq = (const void *)req;
+	struct read_mac_memory_confirm *mm = (void *)cnf;
+	struct sim_device *dev;
+	uint32_t address, length;
+
+	if (len < sizeof(*rq))
+		return 0;
+	dev = sim_get_device(ctx->sim, st, 0);
+
+	address = le32toh(rq->address);
+	length = le32toh(rq->length);
+
+	memset(mm, 0, sizeof(*mm));
+	mm->address = rq->address;
+	mm->mstatus = sim_check_range(ctx->sim, address, length);
+	if (mm->mstatus != SUCCESS)
+		return sizeof(*mm);
+
+	mm->length = rq->length;
+	memset(mm->data, 0, length);
+	if (dev) {
+		pthread_mutex_lock(&dev->lock);
+		if (dev->sdram)
+			memcpy(mm->data, dev->sdram + address, length);
+		pthread_mutex_unlock(&dev->lock);
+	}
+
+	return sizeof(*mm) + length;
+}
+
+/* Checksum of an SDRAM range, which reads as zeroes until it is mapped */
+static uint32_t sim_sdram_crc(struct sim_device *dev, uint32_t load, uint32_t length)
+{
+	static const uint8_t zero[SIM_CHUNK];
+	struct crc32_ctx crc;
+	uint32_t n;
+
+	if (dev && dev->sdram)
+		return crc32buf(dev->sdram + load, length);
+
+	crc32_init(&crc);
+	for (; length; length -= n) {
+		n = length < sizeof(zero) ? length : sizeof(zero);
+		crc32_update(&crc, zero, n);
+	}
+
+	return crc32_raw(&crc);
+}
+
+/* Starting the MAC checks the image the client wrote to the SDRAM */
+static size_t sim_st_mac(struct context *ctx, struct sim_station *st,
+			 const uint8_t *req, size_t len, uint8_t *cnf)
+{
+	const struct start_mac_request *rq = (const void *)req;
+	struct start_mac_confirm *mm = (void *)cnf;
+	struct sim *sim = ctx->sim;
+	struct sim_device *dev;
+	uint32_t load, length;
+
+	if (len < sizeof(*rq))
+		return 0;
+	dev = sim_get_device(sim, st, 0);
+
+	load = le32toh(rq->image_load);
+	length = le32toh(rq->image_length);
+
+	memset(mm, 0, sizeof(*mm));
+	mm->module_id = rq->module_id;
+	if (load > sim->sdram_size || length > sim->sdram_size - load) {
+		mm->mstatus = INV_LEN;
+		return sizeof(*mm);
+	}
+
+	if (dev)
+		pthread_mutex_lock(&dev->lock);
+	if (sim_sdram_crc(dev, load, length) != le32toh(rq->image_chksum))
+		mm->mstatus = INV_CHKSUM;
+	if (dev)
+		pthread_mutex_unlock(&dev->lock);
+
+	return sizeof(*mm);
+}
+
+/* The SDRAM and the modules not yet committed are lost */
+static size_t sim_rs_dev(struct context *ctx, struct sim_station *st,
+			 const uint8_t *req, size_t len, uint8_t *cnf)
+{
+	struct reset_device_confirm *mm = (void *)cnf;
+	struct sim *sim = ctx->sim;
+	struct sim_device *dev;
+	unsigned int i;
+
+	/* A station without device state has nothing to lose */
+	dev = sim_get_device(sim, st, 0);
+	if (dev) {
+		pthread_mutex_lock(&dev->lock);
+		if (dev->sdram)
+			madvise(dev->sdram, sim->sdram_size, MADV_DONTNEED);
+		for (i = 0; i < SIM_NUM_MODULES; i++)
+			dev->staged[i].size = 0;
+		pthread_mutex_unlock(&dev->lock);
+	}
+	__atomic_store_n(&sim->ready[st - sim->stations], sim_clock_us() + sim->reboot_ms * 1000ULL,
+			 __ATOMIC_RELEASE);
+
+	mm->mstatus = SUCCESS;
+
+	return sizeof(*mm);
+}
+
+/*
+ * Module data is only accepted at the offset following what was
+ * written so far, or at offset 0 to start over, as module.c expects.
+ */
+static size_t sim_wr_mod(struct context *ctx, struct sim_station *st,
+			 const uint8_t *req, size_t len, uint8_t *cnf)
+{
+	const struct write_mod_data_request *rq = (const void *)req;
+	struct write_mod_data_confirm *mm = (void *)cnf;
+	struct sim_device *dev;
+	struct sim_module *m;
+	uint32_t offset;
+	uint16_t length;
+	int i;
+
+	if (len < sizeof(*rq))
+		return 0;
+	dev = sim_get_device(ctx->sim, st, 1);
+	if (!dev)
+		return 0;
+
+	offset = le32toh(rq->offset);
+	length = le16toh(rq->length);
+
+	memset(mm, 0, sizeof(*mm));
+	mm->module_id = rq->module_id;
+	mm->length = rq->length;
+	mm->offset = rq->offset;
+
+	i = sim_module_index(rq->module_id);
+	if (i < 0) {
+		mm->mstatus = INV_MOD_ID;
+		return sizeof(*mm);
+	}
+	if (length > SIM_CHUNK || len < sizeof(*rq) + length ||
+	    offset > SIM_MOD_MAX - length) {
+		mm->mstatus = INV_LEN;
+		return sizeof(*mm);
+	}
+	if (crc32buf(rq->data, length) != le32toh(rq->checksum)) {
+		mm->mstatus = INV_CHKSUM;
+		return sizeof(*mm);
+	}
+
+	pthread_mutex_lock(&dev->lock);
+	m = &dev->staged[i];
+	if (offset && offset != m->size)
+		mm->mstatus = UNEX_OFF;
+	else if (sim_module_reserve(m, offset + length))
+		mm->mstatus = INV_LEN;
+	else {
+		memcpy(m->data + offset, rq->data, length);
+		m->size = offset + length;
+	}
+	pthread_mutex_unlock(&dev->lock);
+
+	return sizeof(*mm);
+}
+
+static size_t sim_rd_mod(struct context *ctx, struct sim_station *st,
+			 const uint8_t *req, size_t len, uint8_t *cnf)
+{
+	const struct read_mod_data_request *rq = (const void *)req;
+	struct read_mod_data_confirm *mm = (void *)cnf;
+	struct sim_device *dev;
+	struct sim_module *m = NULL;
+	uint32_t offset;
+	uint16_t length;
+	size_t size;
+	int i;
+
+	if (len < sizeof(*rq))
+		return 0;
+	dev = sim_get_device(ctx->sim, st, 0);
+
+	offset = le32toh(rq->offset);
+	length = le16toh(rq->length);
+
+	memset(mm, 0, sizeof(*mm));
+	mm->module_id = rq->module_id;
+	mm->offset = rq->offset;
+
+	i = sim_module_index(rq->module_id);
+	if (i < 0) {
+		mm->mstatus = INV_MOD_ID;
+		return sizeof(*mm);
+	}
+	if (length > SIM_CHUNK) {
+		mm->mstatus = INV_LEN;
+		return sizeof(*mm);
+	}
+
+	if (dev) {
+		pthread_mutex_lock(&dev->lock);
+		m = &dev->nvm[i];
+	}
+	size = m ? m->size : sim_modules[i].size;
+	if (offset >= size) {
+		mm->mstatus = UNEX_OFF;
+		length = 0;
+	} else {
+		if (length > size - offset)
+			length = size - offset;
+		sim_nvm_read(ctx->sim, st - ctx->sim->stations, i, m, offset, mm->data, length);
+	}
+	if (dev)
+		pthread_mutex_unlock(&dev->lock);
+
+	mm->length = htole16(length);
+	mm->checksum = htole32(crc32buf(mm->data, length));
+
+	return sizeof(*mm) + length;
+}
+
+/* Committing takes as long as programming the flash would */
+static size_t sim_nvm_mod(struct context *ctx, struct sim_station *st,
+			  const uint8_t *req, size_t len, uint8_t *cnf)
+{
+	const struct write_module_data_to_nvm_request *rq = (const void *)req;
+	struct write_module_data_to_nvm_confirm *mm = (void *)cnf;
+	struct sim_device *dev;
+	struct sim_module tmp;
+	int i;
 
-	switch (hdr->mmtype) {
-	case 0xA000:
-		fprintf(stdout, "Get Software version\n");
-		struct get_device_sw_version_confirm sw_confirm;
+	if (len < sizeof(*rq))
+		return 0;
+	dev = sim_get_device(ctx->sim, st, 0);
 
-		memset(&sw_confirm, 0, sizeof(sw_confirm));
-		sw_confirm.mstatus = 0;
-		sw_confirm.device_id = INT6300_DEVICE_ID;
-		sw_confirm.version_length = sizeof(sw_confirm.version);
-		snprintf((char *)sw_confirm.version, sizeof(sw_confirm.version), "%s", "Faifa simulator");
-		sw_confirm.upgradeable = 1;
-		payload = &sw_confirm;
-		payload_size = sizeof(sw_confirm);
-		break;
+	memset(mm, 0, sizeof(*mm));
+	mm->module_id = rq->module_id;
+
+	i = sim_module_index(rq->module_id);
+	if (i < 0) {
+		mm->mstatus = INV_MOD_ID;
+		return sizeof(*mm);
+	}
+	/* Nothing was written to a station without device state */
+	if (!dev) {
+		mm->mstatus = INV_LEN;
+		return sizeof(*mm);
+	}
+
+	pthread_mutex_lock(&dev->lock);
+	if (!dev->staged[i].size) {
+		mm->mstatus = INV_LEN;
+	} else {
+		/* The old module's buffer, if not a factory one, takes the next upload */
+		tmp = dev->nvm[i];
+		dev->nvm[i] = dev->staged[i];
+		dev->staged[i] = tmp;
+		dev->staged[i].size = 0;
+		ctx->hold_ms = dev->nvm[i].size / (SIM_NVM_RATE * 1024.0) * 1000;
 	}
+	pthread_mutex_unlock(&dev->lock);
+
+	return sizeof(*mm);
+}
+
+static size_t sim_set_sdram(struct context *ctx, struct sim_station *st,
+			    const uint8_t *req, size_t len, uint8_t *cnf)
+{
+	const struct set_sdram_config_request *rq = (const void *)req;
+	struct set_sdram_config_confirm *mm = (void *)cnf;
+
+	if (len < sizeof(*rq))
+		return 0;
+
+	mm->mstatus = SUCCESS;
+	if (crc32buf(&rq->config, sizeof(rq->config)) != le32toh(rq->checksum))
+		mm->mstatus = SDR_INV_CHKSUM;
+
+	return sizeof(*mm);
+}
+
+static const struct sim_handler sim_handlers[] = {
+	{ HPAV_MMTYPE_GET_SW_REQ, sim_get_sw },
+	{ HPAV_MMTYPE_WR_MEM_REQ, sim_wr_mem },
+	{ HPAV_MMTYPE_RD_MEM_REQ, sim_rd_mem },
+	{ HPAV_MMTYPE_ST_MAC_REQ, sim_st_mac },
+	{ HPAV_MMTYPE_RS_DEV_REQ, sim_rs_dev },
+	{ HPAV_MMTYPE_WR_MOD_REQ, sim_wr_mod },
+	{ HPAV_MMTYPE_RD_MOD_REQ, sim_rd_mod },
+	{ HPAV_MMTYPE_NVM_MOD_REQ, sim_nvm_mod },
+	{ HPAV_MMTYPE_LNK_STATS_REQ, sim_link_stats },
+	{ HPAV_MMTYPE_NW_INFO_REQ, sim_nw_info },
+	{ HPAV_MMTYPE_SET_SDRAM_REQ, sim_set_sdram },
+};
 
-	if (!payload_size)
+static const struct sim_handler *sim_find_handler(uint16_t mmtype)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(sim_handlers) / sizeof(sim_handlers[0]); i++)
+		if (sim_handlers[i].mmtype == mmtype)
+			return &sim_handlers[i];
+
+	return NULL;
+}
+
+/* xorshift64*, seeded per context so that runs are reproducible */
+static double sim_random(struct context *ctx)
+{
+	ctx->rng ^= ctx->rng >> 12;
+	ctx->rng ^= ctx->rng << 25;
+	ctx->rng ^= ctx->rng >> 27;
+
+	return ((ctx->rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double sim_latency_ms(struct context *ctx, const struct sim_profile *p)
+{
+	double u, v;
+
+	switch (p->latency) {
+	case SIM_LAT_FIXED:
+		return p->lat_a;
+	case SIM_LAT_UNIFORM:
+		return p->lat_a + (p->lat_b - p->lat_a) * sim_random(ctx);
+	case SIM_LAT_LOGNORMAL:
+		/* Box-Muller */
+		u = 1.0 - sim_random(ctx);
+		v = sim_random(ctx);
+		return p->lat_a * exp(p->lat_b * sqrt(-2.0 * log(u)) * cos(2 * M_PI * v));
+	default:
+		return 0;
+	}
+}
+
+/**
+ * sim_admit - decide whether a station handles a request
+ *
+ * Drops it at random or when the station's token bucket is empty,
+ * as an overloaded adapter would.
+ */
+static int sim_admit(struct context *ctx, const struct sim_station *st)
+{
+	const struct sim_profile *p = st->profile;
+	struct sim_bucket *b;
+	uint64_t now;
+
+	if (p->drop > 0 && sim_random(ctx) < p->drop)
+		return 0;
+
+	if (p->rate <= 0)
+		return 1;
+
+	b = &ctx->buckets[st - ctx->sim->stations];
+	now = sim_clock_us();
+	if (!b->last)
+		b->tokens = p->burst;
+	else
+		b->tokens += (now - b->last) * p->rate / 1000000.0;
+	if (b->tokens > p->burst)
+		b->tokens = p->burst;
+	b->last = now;
+
+	if (b->tokens < 1)
+		return 0;
+	b->tokens--;
+
+	return 1;
+}
+
+static void sim_pending_cb(evutil_socket_t fd, short flags, void *arg)
+{
+	struct sim_pending *pd = arg;
+
+	if (sim_send_vendor_pkt(pd->ctx, pd->st, pd->to, pd->mmtype, pd->payload, pd->len))
+		fprintf(stdout, "failed to reply from station %u\n",
+			(unsigned int)(pd->st - pd->ctx->sim->stations));
+	else
+		__atomic_fetch_add(&pd->ctx->replies, 1, __ATOMIC_RELAXED);
+	free(pd);
+}
+
+/**
+ * sim_emit - send a reply once the station's latency has elapsed
+ * @hold_ms:	time the station spends on the request on top of its latency
+ */
+static void sim_emit(struct context *ctx, const struct sim_station *st,
+		     const uint8_t *to, uint16_t mmtype, const uint8_t *payload, size_t len,
+		     double hold_ms)
+{
+	const struct sim_profile *p = st->profile;
+	struct sim_pending *pd;
+	struct timeval tv;
+	double ms;
+	int copies, i;
+
+	copies = (p->dup > 0 && sim_random(ctx) < p->dup) ? 2 : 1;
+
+	for (i = 0; i < copies; i++) {
+		ms = hold_ms + sim_latency_ms(ctx, p);
+		/* Held back for up to four latencies, later replies overtake it */
+		if (p->reorder > 0 && sim_random(ctx) < p->reorder)
+			ms += (1 + 4 * sim_random(ctx)) * (ms > 1 ? ms : 1);
+
+		pd = malloc(sizeof(*pd) + len);
+		if (!pd) {
+			fprintf(stderr, "failed to allocate a reply\n");
+			return;
+		}
+		pd->ctx = ctx;
+		pd->st = st;
+		memcpy(pd->to, to, ETH_ALEN);
+		pd->mmtype = mmtype;
+		pd->len = len;
+		memcpy(pd->payload, payload, len);
+
+		if (ms <= 0) {
+			sim_pending_cb(-1, 0, pd);
+			continue;
+		}
+
+		tv.tv_sec = (time_t)(ms / 1000);
+		tv.tv_usec = (suseconds_t)((ms - tv.tv_sec * 1000.0) * 1000);
+		if (event_base_once(ctx->ev, -1, EV_TIMEOUT, sim_pending_cb, pd, &tv)) {
+			fprintf(stderr, "failed to schedule a reply\n");
+			free(pd);
+		}
+	}
+}
+
+static void sim_reply(struct context *ctx, struct sim_station *st,
+		      const struct sim_handler *h, const uint8_t *from,
+		      const uint8_t *req, size_t len)
+{
+	uint8_t cnf[ETH_DATA_LEN];
+	size_t cnf_len;
+
+	/* A station answers nothing while it resets */
+	if (sim_clock_us() < __atomic_load_n(&ctx->sim->ready[st - ctx->sim->stations],
+					     __ATOMIC_ACQUIRE))
 		return;
 
-	ret = sim_send_vendor_pkt(ctx, qca_bcast, htole16(hdr->mmtype + 1),
-				payload, payload_size);
-	if (ret)
-		fprintf(stdout, "failed to reply: %d\n", ret);
+	if (!sim_admit(ctx, st))
+		return;
+
+	ctx->hold_ms = 0;
+	cnf_len = h->handler(ctx, st, req, len, cnf);
+	if (!cnf_len)
+		return;
+
+	sim_emit(ctx, st, from, h->mmtype + 1, cnf, cnf_len, ctx->hold_ms);
+}
+
+static void sim_handle_frame(struct context *ctx, uint8_t *frame, size_t len)
+{
+	struct sim *sim = ctx->sim;
+	struct ether_header *eth = (struct ether_header *)frame;
+	struct hpav_frame *hpav = (struct hpav_frame *)(frame + sizeof(*eth));
+	size_t hdrlen = sizeof(*eth) + sizeof(hpav->header) + sizeof(hpav->payload.vendor);
+	const struct sim_handler *h;
+	struct sim_station *st;
+	uint16_t mmtype;
+	uint32_t i;
+
+	if (len < hdrlen)
+		return;
+
+	mmtype = le16toh(hpav->header.mmtype);
+	h = sim_find_handler(mmtype);
+	if (!h)
+		return;
+
+	__atomic_fetch_add(&ctx->requests, 1, __ATOMIC_RELAXED);
+
+	if (!memcmp(eth->ether_dhost, sim_bcast_mac, ETH_ALEN)) {
+		for (i = 0; i < sim->num_stations; i++)
+			sim_reply(ctx, &sim->stations[i], h, eth->ether_shost,
+				  frame + hdrlen, len - hdrlen);
+		return;
+	}
+
+	/* The local management address reaches the first station */
+	if (!memcmp(eth->ether_dhost, sim_local_mac, ETH_ALEN))
+		st = &sim->stations[0];
+	else
+		st = sim_lookup(sim, eth->ether_dhost);
+	if (!st)
+		return;
+
+	sim_reply(ctx, st, h, eth->ether_shost, frame + hdrlen, len - hdrlen);
+}
+
+static void sim_read_cb(evutil_socket_t fd, short flags, void *argv)
+{
+	struct context *ctx = argv;
+	uint8_t frame[ETH_FRAME_LEN];
+	struct sockaddr_ll ll;
+	socklen_t lllen;
+	ssize_t len;
+	int i;
+
+	for (i = 0; i < SIM_RX_BURST; i++) {
+		lllen = sizeof(ll);
+		len = recvfrom(ctx->sock_fd, frame, sizeof(frame), 0,
+				(struct sockaddr *)&ll, &lllen);
+		if (len < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				perror("recvfrom");
+			return;
+		}
+
+		/* Our own replies come back on the socket as outgoing frames */
+		if (ll.sll_pkttype == PACKET_OUTGOING)
+			continue;
+
+		sim_handle_frame(ctx, frame, len);
+	}
+}
+
+/**
+ * sim_join_fanout - spread incoming frames over the workers' sockets
+ * @group:	fanout group id, shared by the workers
+ *
+ * Frames are steered by the last four bytes of their source MAC, so
+ * every request of a client is handled by the same worker.
+ */
+static int sim_join_fanout(struct context *ctx, int fd, int group)
+{
+	struct sock_filter code[] = {
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_LL_OFF + ETH_ALEN + 2 },
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog prog = {
+		.len = sizeof(code) / sizeof(code[0]),
+		.filter = code,
+	};
+	int arg = group | (PACKET_FANOUT_CBPF << 16);
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+		perror("setsockopt(PACKET_FANOUT)");
+		return -1;
+	}
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT_DATA, &prog, sizeof(prog)) < 0) {
+		perror("setsockopt(PACKET_FANOUT_DATA)");
+		return -1;
+	}
+
+	return 0;
 }
 
 static int sim_init_ctx(struct context *ctx)
 {
 	int fd;
 	int ret;
+	int opt;
 	struct sockaddr_ll ll;
+	struct packet_mreq mreq;
 
 	ctx->ev = event_base_new();
 	if (!ctx->ev) {
@@ -183,7 +1440,23 @@ static int sim_init_ctx(struct context *ctx)
 		return -ENOMEM;
 	}
 
-	fd = socket(PF_PACKET, SOCK_DGRAM, htons(ETHERTYPE_HOMEPLUG_AV));
+	/* splitmix64 of the seed, xorshift needs a non zero state */
+	ctx->rng = ctx->sim->seed + 0x9E3779B97F4A7C15ULL;
+	ctx->rng = (ctx->rng ^ (ctx->rng >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	ctx->rng = (ctx->rng ^ (ctx->rng >> 27)) * 0x94D049BB133111EBULL;
+	ctx->rng ^= ctx->rng >> 31;
+	ctx->rng ^= ctx->id * 0xD1B54A32D192ED03ULL;
+	if (!ctx->rng)
+		ctx->rng = 1;
+
+	ctx->buckets = calloc(ctx->sim->num_stations, sizeof(*ctx->buckets));
+	if (!ctx->buckets) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* Raw socket: the destination MAC tells which station is addressed */
+	fd = socket(PF_PACKET, SOCK_RAW, htons(ETHERTYPE_HOMEPLUG_AV));
 	if (fd < 0) {
 		perror("socket");
 		ret = fd;
@@ -202,6 +1475,27 @@ static int sim_init_ctx(struct context *ctx)
 		goto out_close;
 	}
 
+	/* Frames to the virtual stations are not addressed to this host */
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.mr_ifindex = ctx->if_index;
+	mreq.mr_type = PACKET_MR_PROMISC;
+	ret = setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+	if (ret < 0) {
+		perror("setsockopt");
+		goto out_close;
+	}
+
+	/* Do not read back the replies of every worker, when supported */
+	opt = 1;
+	setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &opt, sizeof(opt));
+
+	if (ctx->sim->workers > 1) {
+		ret = sim_join_fanout(ctx, fd, getpid() & 0xffff);
+		if (ret < 0)
+			goto out_close;
+	}
+
+	evutil_make_socket_nonblocking(fd);
 	ctx->sock_fd = fd;
 
 	/* setup libevent for polling this socket */
@@ -212,8 +1506,6 @@ static int sim_init_ctx(struct context *ctx)
 		goto out_close;
 	}
 
-	fprintf(stdout, "initialized RAW socket\n");
-
 	event_add(ctx->read_ev, NULL);
 
 	return 0;
@@ -221,6 +1513,7 @@ static int sim_init_ctx(struct context *ctx)
 out_close:
 	close(fd);
 out:
+	free(ctx->buckets);
 	event_base_free(ctx->ev);
 	return ret;
 }
@@ -228,7 +1521,10 @@ out:
 static void sim_deinit_ctx(struct context *ctx)
 {
 	/* disable all events */
+	event_free(ctx->read_ev);
+	close(ctx->sock_fd);
 	event_base_free(ctx->ev);
+	free(ctx->buckets);
 }
 
 static int sim_event_loop(struct context *ctx)
@@ -238,25 +1534,246 @@ static int sim_event_loop(struct context *ctx)
 	return 0;
 }
 
+static void *sim_worker(void *arg)
+{
+	sim_event_loop(arg);
+
+	return NULL;
+}
+
+/**
+ * sim_monitor - aggregate rate reporting of the workers
+ * @requests:	requests handled at the last report
+ * @replies:	replies sent at the last report
+ * @last:	time of the last report, in us
+ * @start:	time the workers started, in us
+ * @peak:	highest request rate reported
+ */
+struct sim_monitor {
+	struct sim		*sim;
+	struct context		*ctxs;
+	struct event_base	*ev;
+	uint64_t		requests;
+	uint64_t		replies;
+	uint64_t		last;
+	uint64_t		start;
+	double			peak;
+};
+
+static void sim_monitor_totals(struct sim_monitor *mon, uint64_t *requests, uint64_t *replies)
+{
+	unsigned int i;
+
+	*requests = *replies = 0;
+	for (i = 0; i < mon->sim->workers; i++) {
+		*requests += __atomic_load_n(&mon->ctxs[i].requests, __ATOMIC_RELAXED);
+		*replies += __atomic_load_n(&mon->ctxs[i].replies, __ATOMIC_RELAXED);
+	}
+}
+
+static void sim_monitor_cb(evutil_socket_t fd, short flags, void *arg)
+{
+	struct sim_monitor *mon = arg;
+	uint64_t requests, replies, now = sim_clock_us();
+	double secs = (now - mon->last) / 1000000.0;
+	double rate;
+
+	sim_monitor_totals(mon, &requests, &replies);
+
+	/* Stay quiet while idle */
+	if (requests != mon->requests) {
+		rate = (requests - mon->requests) / secs;
+		if (rate > mon->peak)
+			mon->peak = rate;
+		fprintf(stdout, "%.0f requests/s, %.0f replies/s\n",
+			rate, (replies - mon->replies) / secs);
+		fflush(stdout);
+	}
+
+	mon->requests = requests;
+	mon->replies = replies;
+	mon->last = now;
+}
+
+static void sim_signal_cb(evutil_socket_t fd, short flags, void *arg)
+{
+	struct sim_monitor *mon = arg;
+	unsigned int i;
+
+	for (i = 0; i < mon->sim->workers; i++)
+		event_base_loopbreak(mon->ctxs[i].ev);
+	event_base_loopbreak(mon->ev);
+}
+
+/**
+ * sim_run - run the workers until SIGINT or SIGTERM
+ *
+ * Reports the aggregate request rate every second, and a summary
+ * on exit.
+ */
+static int sim_run(struct sim *sim, struct context *ctxs)
+{
+	struct sim_monitor mon;
+	struct event *tick, *sigint, *sigterm;
+	struct timeval tv = { 1, 0 };
+	uint64_t requests, replies;
+	unsigned int i, started;
+	double secs;
+	int ret = 0;
+
+	memset(&mon, 0, sizeof(mon));
+	mon.sim = sim;
+	mon.ctxs = ctxs;
+	mon.ev = event_base_new();
+	if (!mon.ev) {
+		fprintf(stderr, "failed to create new libevent context\n");
+		return -ENOMEM;
+	}
+
+	tick = event_new(mon.ev, -1, EV_PERSIST, sim_monitor_cb, &mon);
+	sigint = evsignal_new(mon.ev, SIGINT, sim_signal_cb, &mon);
+	sigterm = evsignal_new(mon.ev, SIGTERM, sim_signal_cb, &mon);
+	if (!tick || !sigint || !sigterm) {
+		fprintf(stderr, "failed to create monitor events\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+	event_add(tick, &tv);
+	event_add(sigint, NULL);
+	event_add(sigterm, NULL);
+
+	mon.start = mon.last = sim_clock_us();
+	for (started = 0; started < sim->workers; started++) {
+		if (pthread_create(&ctxs[started].thread, NULL, sim_worker, &ctxs[started])) {
+			fprintf(stderr, "failed to start worker %u\n", started);
+			ret = -EAGAIN;
+			break;
+		}
+	}
+
+	if (!ret)
+		event_base_dispatch(mon.ev);
+
+	for (i = 0; i < started; i++) {
+		event_base_loopbreak(ctxs[i].ev);
+		pthread_join(ctxs[i].thread, NULL);
+	}
+
+	sim_monitor_totals(&mon, &requests, &replies);
+	secs = (sim_clock_us() - mon.start) / 1000000.0;
+	fprintf(stdout, "%" PRIu64 " requests, %" PRIu64 " replies in %.1f s: "
+		"%.0f requests/s average, %.0f requests/s peak\n",
+		requests, replies, secs, secs > 0 ? requests / secs : 0, mon.peak);
+	for (i = 0; sim->workers > 1 && i < sim->workers; i++)
+		fprintf(stdout, "worker %u: %" PRIu64 " requests\n", i, ctxs[i].requests);
+
+out:
+	if (tick)
+		event_free(tick);
+	if (sigint)
+		event_free(sigint);
+	if (sigterm)
+		event_free(sigterm);
+	event_base_free(mon.ev);
+	return ret;
+}
+
 static void usage(const char *name)
 {
 	fprintf(stderr, "Usage %s [options] [interface]\n"
-			"-h:	this help",
-			name);
+			"-n:	number of virtual stations (default 1, max %d)\n"
+			"-m:	MAC address of the first station (default 00:b0:52:00:10:00)\n"
+			"-a:	stations per AVLN, the first one is the CCo (default 16, max %d)\n"
+			"-V:	software version of every station\n"
+			"-l:	reply latency: none, fixed:MS, uniform:MIN:MAX or lognormal:MEDIAN:SIGMA\n"
+			"-d:	probability to drop a request\n"
+			"-D:	probability to duplicate a reply\n"
+			"-o:	probability to deliver a reply out of order\n"
+			"-r:	MMEs per second a station answers, as RATE[:BURST]\n"
+			"-P:	per-station impairments, lines of \"MAC key=value...\"\n"
+			"-S:	random seed (default 1)\n"
+			"-j:	worker threads sharing the traffic by source MAC (default 1, max %d)\n"
+			"-M:	SDRAM size of a station in bytes (default %d)\n"
+			"-B:	time a station takes to reset in ms (default %d)\n"
+			"-h:	this help\n",
+			name, SIM_MAX_STATIONS, SIM_MAX_AVLN, SIM_MAX_WORKERS,
+			SIM_SDRAM_SIZE, SIM_REBOOT_MS);
 	exit(1);
 }
 
 int main(int argc, char **argv)
 {
 	int opt;
-	struct context ctx;
+	struct context *ctxs;
+	struct sim sim;
+	const char *iface;
+	unsigned int i;
 	int ret;
 	const char *appname = argv[0];
+	const char *version = NULL;
+	const char *profiles = NULL;
+	struct sim_profile def;
+	uint8_t base[ETH_ALEN] = { 0x00, 0xB0, 0x52, 0x00, 0x10, 0x00 };
 
-	memset(&ctx, 0, sizeof(ctx));
+	memset(&sim, 0, sizeof(sim));
+	sim.num_stations = 1;
+	sim.avln_size = 16;
+	sim.seed = 1;
+	sim.workers = 1;
+	sim.sdram_size = SIM_SDRAM_SIZE;
+	sim.reboot_ms = SIM_REBOOT_MS;
+	memset(&def, 0, sizeof(def));
 
-	while ((opt = getopt(argc, argv, "V:h")) > 0) {
+	while ((opt = getopt(argc, argv, "n:m:a:V:l:d:D:o:r:P:S:j:M:B:h")) > 0) {
 		switch (opt) {
+		case 'n':
+			sim.num_stations = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			if (sim_parse_mac(optarg, base))
+				usage(appname);
+			break;
+		case 'a':
+			sim.avln_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'V':
+			version = optarg;
+			break;
+		case 'l':
+			if (sim_parse_option(&def, "latency", optarg))
+				usage(appname);
+			break;
+		case 'd':
+			if (sim_parse_option(&def, "drop", optarg))
+				usage(appname);
+			break;
+		case 'D':
+			if (sim_parse_option(&def, "dup", optarg))
+				usage(appname);
+			break;
+		case 'o':
+			if (sim_parse_option(&def, "reorder", optarg))
+				usage(appname);
+			break;
+		case 'r':
+			if (sim_parse_option(&def, "rate", optarg))
+				usage(appname);
+			break;
+		case 'P':
+			profiles = optarg;
+			break;
+		case 'S':
+			sim.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'j':
+			sim.workers = strtoul(optarg, NULL, 0);
+			break;
+		case 'M':
+			sim.sdram_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'B':
+			sim.reboot_ms = strtoul(optarg, NULL, 0);
+			break;
 		case 'h':
 		default:
 			usage(appname);
@@ -267,18 +1784,71 @@ int main(int argc, char **argv)
 	argv += optind;
 	argc -= optind;
 
-	ctx.iface = argv[0];
-	if (!ctx.iface)
+	iface = argv[0];
+	if (!iface || !sim.num_stations || sim.num_stations > SIM_MAX_STATIONS ||
+	    !sim.avln_size || sim.avln_size > SIM_MAX_AVLN ||
+	    !sim.workers || sim.workers > SIM_MAX_WORKERS || !sim.sdram_size)
 		usage(appname);
 
-	ret = sim_init_ctx(&ctx);
-	if (ret) {
-		fprintf(stderr, "failed to initialize context\n");
-		return ret;
+	sim.profiles = malloc(sizeof(*sim.profiles));
+	if (!sim.profiles)
+		return 1;
+	sim.profiles[0] = def;
+	sim.num_profiles = 1;
+
+	ret = sim_init_stations(&sim, base, version);
+	if (ret)
+		return 1;
+
+	if (profiles && sim_load_profiles(&sim, profiles))
+		return 1;
+
+	sim.devices = calloc(sim.num_stations, sizeof(*sim.devices));
+	sim.ready = calloc(sim.num_stations, sizeof(*sim.ready));
+	if (!sim.devices || !sim.ready)
+		return 1;
+
+	/* Workers are stopped from the monitor thread */
+	if (evthread_use_pthreads()) {
+		fprintf(stderr, "failed to enable libevent threading\n");
+		return 1;
 	}
 
-	ret = sim_event_loop(&ctx);
+	ctxs = calloc(sim.workers, sizeof(*ctxs));
+	if (!ctxs)
+		return 1;
+
+	for (i = 0; i < sim.workers; i++) {
+		ctxs[i].sim = &sim;
+		ctxs[i].iface = iface;
+		ctxs[i].id = i;
+		ret = sim_init_ctx(&ctxs[i]);
+		if (ret) {
+			fprintf(stderr, "failed to initialize context\n");
+			while (i--)
+				sim_deinit_ctx(&ctxs[i]);
+			free(ctxs);
+			return ret;
+		}
+	}
+
+	fprintf(stdout, "simulating %u stations in %u AVLNs with %u workers, seed %" PRIu64 "\n",
+		sim.num_stations, (sim.num_stations + sim.avln_size - 1) / sim.avln_size,
+		sim.workers, sim.seed);
+	fflush(stdout);
+
+	ret = sim_run(&sim, ctxs);
 
-	sim_deinit_ctx(&ctx);
+	for (i = 0; i < sim.workers; i++)
+		sim_deinit_ctx(&ctxs[i]);
+	free(ctxs);
+	for (i = 0; i < sim.num_stations; i++)
+		if (sim.devices[i])
+			sim_free_device(&sim, sim.devices[i]);
+	free(sim.devices);
+	free(sim.ready);
+	free(sim.stations);
+	free(sim.slots);
+	free(sim.profiles);
 	return ret;
 }
@@ -0,0 +1,342 @@
+/*
+ *  Sniffer indication decoding and ring file
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sniffer.h"
+
+/* Offsets in the SNIFFER_IND payload, see struct sniffer_indicate */
+#define SNIFF_IND_TYPE		0
+#define SNIFF_IND_DIRECTION	1
+#define SNIFF_IND_SYSTIME	2
+#define SNIFF_IND_BEACONTIME	10
+#define SNIFF_IND_FC		14
+#define SNIFF_IND_BCN		30
+#define SNIFF_IND_LEN		46
+
+struct sniff_ring {
+	struct sniff_ring_header	*hdr;
+	struct sniff_record		*records;
+	size_t				len;
+};
+
+/*
+ * The frame control and beacon fields are little-endian bit fields; decode
+ * them with explicit shifts and masks instead of relying on the compiler
+ * bit field layout.
+ */
+static inline u_int16_t get_le16(const u_int8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline u_int32_t get_le32(const u_int8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u_int32_t)p[3] << 24);
+}
+
+static inline u_int64_t get_le64(const u_int8_t *p)
+{
+	return get_le32(p) | ((u_int64_t)get_le32(p + 4) << 32);
+}
+
+static inline u_int8_t bits(u_int8_t v, int shift, int width)
+{
+	return (v >> shift) & ((1 << width) - 1);
+}
+
+static void sniff_decode_fc(struct sniff_record *rec, const u_int8_t *fc)
+{
+	u_int16_t flags = 0;
+
+	rec->del_type = bits(fc[0], 0, 3);
+	if (fc[0] & 0x08)
+		flags |= SNIFF_F_ACCESS;
+	rec->snid = bits(fc[0], 4, 4);
+	rec->stei = fc[1];
+	rec->dtei = fc[2];
+	rec->lid = fc[3];
+	if (fc[4] & 0x01)
+		flags |= SNIFF_F_CFS;
+	if (fc[4] & 0x02)
+		flags |= SNIFF_F_BDF;
+	if (fc[4] & 0x04)
+		flags |= SNIFF_F_HP10DF;
+	if (fc[4] & 0x08)
+		flags |= SNIFF_F_HP11DF;
+	rec->eks = bits(fc[4], 4, 4);
+	rec->ppb = fc[5];
+	rec->ble = fc[6];
+	if (fc[7] & 0x01)
+		flags |= SNIFF_F_PBSZ;
+	rec->num_sym = bits(fc[7], 1, 2);
+	rec->tmi_av = bits(fc[7], 3, 5);
+	rec->fl_av = get_le16(fc + 8) & 0x0fff;
+	rec->mpdu_cnt = bits(fc[9], 4, 2);
+	rec->burst_cnt = bits(fc[9], 6, 2);
+	rec->clst = bits(fc[10], 0, 3);
+	rec->rg_len = bits(fc[10], 3, 5) | (bits(fc[11], 0, 1) << 5);
+	rec->mfs_cmd_mgmt = bits(fc[11], 1, 3);
+	rec->mfs_cmd_data = bits(fc[11], 4, 3);
+	if (fc[11] & 0x80)
+		flags |= SNIFF_F_RSR;
+	if (fc[12] & 0x01)
+		flags |= SNIFF_F_MCF;
+	if (fc[12] & 0x02)
+		flags |= SNIFF_F_DCCPCF;
+	if (fc[12] & 0x04)
+		flags |= SNIFF_F_MNBF;
+	memcpy(rec->fccs, fc + 13, sizeof(rec->fccs));
+
+	rec->flags |= flags;
+}
+
+static void sniff_decode_bcn(struct sniff_record *rec, const u_int8_t *bcn)
+{
+	int i;
+
+	rec->bcn_del_type = bits(bcn[0], 0, 3);
+	if (bcn[0] & 0x08)
+		rec->flags |= SNIFF_F_BCN_ACCESS;
+	rec->bcn_snid = bits(bcn[0], 4, 4);
+	rec->bts = get_le32(bcn + 1);
+	for (i = 0; i < 4; i++)
+		rec->bto[i] = get_le16(bcn + 5 + 2 * i);
+	memcpy(rec->bcn_fccs, bcn + 13, sizeof(rec->bcn_fccs));
+}
+
+int sniff_decode(struct sniff_record *rec, const u_int8_t *buf, int len)
+{
+	u_int64_t host_time = rec->host_time;
+
+	if (len < SNIFF_IND_LEN)
+		return -1;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->host_time = host_time;
+	rec->type = buf[SNIFF_IND_TYPE];
+	rec->direction = buf[SNIFF_IND_DIRECTION];
+	rec->systime = get_le64(buf + SNIFF_IND_SYSTIME);
+	rec->beacontime = get_le32(buf + SNIFF_IND_BEACONTIME);
+	sniff_decode_fc(rec, buf + SNIFF_IND_FC);
+	sniff_decode_bcn(rec, buf + SNIFF_IND_BCN);
+
+	return 0;
+}
+
+static sniff_ring_t *sniff_ring_mmap(int fd, size_t len, int prot)
+{
+	sniff_ring_t *ring;
+	void *map;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	map = mmap(NULL, len, prot, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		free(ring);
+		return NULL;
+	}
+
+	ring->hdr = map;
+	ring->records = (struct sniff_record *)(ring->hdr + 1);
+	ring->len = len;
+
+	return ring;
+}
+
+sniff_ring_t *sniff_ring_create(const char *path, u_int32_t capacity)
+{
+	sniff_ring_t *ring;
+	struct timespec ts;
+	size_t len;
+	int fd, err;
+
+	if (!capacity) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	len = sizeof(struct sniff_ring_header) + (size_t)capacity * sizeof(struct sniff_record);
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return NULL;
+
+	if (ftruncate(fd, len) < 0)
+		goto out_error;
+
+	ring = sniff_ring_mmap(fd, len, PROT_READ | PROT_WRITE);
+	if (!ring)
+		goto out_error;
+	close(fd);
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ring->hdr->version = SNIFF_RING_VERSION;
+	ring->hdr->record_size = sizeof(struct sniff_record);
+	ring->hdr->capacity = capacity;
+	ring->hdr->start = (u_int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	/* Readers only trust the file once the magic is there */
+	__sync_synchronize();
+	ring->hdr->magic = SNIFF_RING_MAGIC;
+
+	return ring;
+
+out_error:
+	err = errno;
+	close(fd);
+	errno = err;
+	return NULL;
+}
+
+sniff_ring_t *sniff_ring_map(const char *path)
+{
+	struct sniff_ring_header *hdr;
+	sniff_ring_t *ring;
+	struct stat st;
+	int fd, err;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0)
+		goto out_error;
+
+	if ((size_t)st.st_size < sizeof(*hdr)) {
+		errno = EINVAL;
+		goto out_error;
+	}
+
+	ring = sniff_ring_mmap(fd, st.st_size, PROT_READ);
+	if (!ring)
+		goto out_error;
+	close(fd);
+
+	hdr = ring->hdr;
+	if (hdr->magic != SNIFF_RING_MAGIC || hdr->version != SNIFF_RING_VERSION ||
+	    hdr->record_size != sizeof(struct sniff_record) ||
+	    sizeof(*hdr) + (size_t)hdr->capacity * hdr->record_size > ring->len) {
+		sniff_ring_close(ring);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return ring;
+
+out_error:
+	err = errno;
+	close(fd);
+	errno = err;
+	return NULL;
+}
+
+void sniff_ring_close(sniff_ring_t *ring)
+{
+	if (!ring)
+		return;
+
+	munmap(ring->hdr, ring->len);
+	free(ring);
+}
+
+void sniff_ring_put(sniff_ring_t *ring, const struct sniff_record *rec)
+{
+	u_int64_t head = ring->hdr->head;
+
+	ring->records[head % ring->hdr->capacity] = *rec;
+	/* Publish the record only once it is completely written */
+	__sync_synchronize();
+	ring->hdr->head = head + 1;
+}
+
+void sniff_ring_set_dropped(sniff_ring_t *ring, u_int64_t dropped)
+{
+	ring->hdr->dropped = dropped;
+}
+
+int sniff_ring_get(sniff_ring_t *ring, u_int64_t seq, struct sniff_record *rec)
+{
+	volatile struct sniff_ring_header *hdr = ring->hdr;
+	u_int64_t capacity = hdr->capacity;
+
+	if (seq >= hdr->head)
+		return 0;
+	if (hdr->head - seq >= capacity)
+		return -1;
+
+	__sync_synchronize();
+	*rec = ring->records[seq % capacity];
+	__sync_synchronize();
+
+	/* The writer may have wrapped around while the record was copied */
+	if (hdr->head - seq >= capacity)
+		return -1;
+
+	return 1;
+}
+
+const struct sniff_ring_header *sniff_ring_info(sniff_ring_t *ring)
+{
+	return ring->hdr;
+}
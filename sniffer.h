@@ -0,0 +1,248 @@
+/*
+ *  Sniffer indication capture to a memory-mapped ring file
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+
+#ifndef __SNIFFER_H__
+#define __SNIFFER_H__
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A sniffer ring file is a header followed by a fixed number of
+ * fixed-size records, all in host byte order. The writer stores record
+ * number n in slot n % capacity and then publishes it by incrementing
+ * the head counter, so the file always holds the last <capacity>
+ * indications and readers may follow it while the capture runs.
+ */
+
+#define SNIFF_RING_MAGIC	0x464e5346	/* "FSNF" */
+#define SNIFF_RING_VERSION	1
+#define SNIFF_RING_RECORDS	(1 << 18)	/* default capacity, 16 MiB */
+
+/* Record flags */
+#define SNIFF_F_ACCESS		0x0001	/* frame control access network */
+#define SNIFF_F_CFS		0x0002	/* contention free session */
+#define SNIFF_F_BDF		0x0004	/* beacon detect flag */
+#define SNIFF_F_HP10DF		0x0008	/* HomePlug 1.0.1 detect flag */
+#define SNIFF_F_HP11DF		0x0010	/* HomePlug 1.1 detect flag */
+#define SNIFF_F_PBSZ		0x0020	/* PHY block size */
+#define SNIFF_F_RSR		0x0040	/* request SACK retransmission */
+#define SNIFF_F_MCF		0x0080	/* multicast */
+#define SNIFF_F_DCCPCF		0x0100	/* different CP PHY clock */
+#define SNIFF_F_MNBF		0x0200	/* multinetwork broadcast */
+#define SNIFF_F_BCN_ACCESS	0x0400	/* beacon access network */
+
+/**
+ * sniff_ring_header - header of a ring file
+ * @magic:	SNIFF_RING_MAGIC
+ * @version:	SNIFF_RING_VERSION
+ * @record_size: size of a record
+ * @capacity:	number of record slots
+ * @head:	number of records written since the capture started
+ * @dropped:	frames dropped by the capture interface
+ * @start:	capture start time (microseconds since the Epoch)
+ */
+struct sniff_ring_header {
+	u_int32_t	magic;
+	u_int16_t	version;
+	u_int16_t	record_size;
+	u_int32_t	capacity;
+	u_int32_t	reserved1;
+	u_int64_t	head;
+	u_int64_t	dropped;
+	u_int64_t	start;
+	u_int8_t	reserved2[24];
+} __attribute__((__packed__));
+
+/**
+ * sniff_record - one decoded sniffer indication
+ * @host_time:	host reception time (microseconds since the Epoch)
+ * @systime:	device system time
+ * @beacontime:	device beacon time
+ * @bts:	beacon timestamp
+ * @bto:	beacon transmission offsets
+ * @fl_av:	HomePlug AV frame length
+ * @flags:	SNIFF_F_* flags
+ * @type:	indication type
+ * @direction:	0 for Tx, 1 for Rx
+ * @del_type:	frame control delimiter type
+ * @snid:	frame control short network ID
+ * @stei:	source TEI
+ * @dtei:	destination TEI
+ * @lid:	link ID
+ * @eks:	encryption key select
+ * @ppb:	pending PHY blocks
+ * @ble:	bit loading estimate
+ * @num_sym:	number of symbols
+ * @tmi_av:	tone map index
+ * @mpdu_cnt:	MPDU count
+ * @burst_cnt:	burst count
+ * @clst:	convergence layer SAP type
+ * @rg_len:	reverse grant length
+ * @mfs_cmd_mgmt: management MAC frame stream command
+ * @mfs_cmd_data: data MAC frame stream command
+ * @bcn_del_type: beacon delimiter type
+ * @bcn_snid:	beacon short network ID
+ * @fccs:	frame control check sequence
+ * @bcn_fccs:	beacon frame control check sequence
+ */
+struct sniff_record {
+	u_int64_t	host_time;
+	u_int64_t	systime;
+	u_int32_t	beacontime;
+	u_int32_t	bts;
+	u_int16_t	bto[4];
+	u_int16_t	fl_av;
+	u_int16_t	flags;
+	u_int8_t	type;
+	u_int8_t	direction;
+	u_int8_t	del_type;
+	u_int8_t	snid;
+	u_int8_t	stei;
+	u_int8_t	dtei;
+	u_int8_t	lid;
+	u_int8_t	eks;
+	u_int8_t	ppb;
+	u_int8_t	ble;
+	u_int8_t	num_sym;
+	u_int8_t	tmi_av;
+	u_int8_t	mpdu_cnt;
+	u_int8_t	burst_cnt;
+	u_int8_t	clst;
+	u_int8_t	rg_len;
+	u_int8_t	mfs_cmd_mgmt;
+	u_int8_t	mfs_cmd_data;
+	u_int8_t	bcn_del_type;
+	u_int8_t	bcn_snid;
+	u_int8_t	fccs[3];
+	u_int8_t	bcn_fccs[3];
+	u_int8_t	reserved[2];
+} __attribute__((__packed__));
+
+/**
+ * sniff_ring_t - ring file handle, either for writing or for reading
+ */
+typedef struct sniff_ring sniff_ring_t;
+
+/**
+ * sniff_decode - decode a sniffer indication payload
+ * @rec:	record to fill, host_time is left untouched
+ * @buf:	SNIFFER_IND payload
+ * @len:	payload length
+ * @return
+ *	0 on success, -1 if the payload is too short
+ */
+extern int sniff_decode(struct sniff_record *rec, const u_int8_t *buf, int len);
+
+/**
+ * sniff_ring_create - create (or truncate) a ring file for writing
+ * @path:	ring file path
+ * @capacity:	number of record slots
+ * @return
+ *	handle on success, NULL on error (errno is set)
+ */
+extern sniff_ring_t *sniff_ring_create(const char *path, u_int32_t capacity);
+
+/**
+ * sniff_ring_map - map an existing ring file for reading
+ * @path:	ring file path
+ * @return
+ *	handle on success, NULL on error (errno is set)
+ */
+extern sniff_ring_t *sniff_ring_map(const char *path);
+
+/**
+ * sniff_ring_close - unmap a ring file
+ * @ring:	handle returned by sniff_ring_create or sniff_ring_map
+ */
+extern void sniff_ring_close(sniff_ring_t *ring);
+
+/**
+ * sniff_ring_put - append a record, overwriting the oldest one when full
+ * @ring:	handle returned by sniff_ring_create
+ * @rec:	record to append
+ */
+extern void sniff_ring_put(sniff_ring_t *ring, const struct sniff_record *rec);
+
+/**
+ * sniff_ring_set_dropped - record the number of frames the capture dropped
+ * @ring:	handle returned by sniff_ring_create
+ * @dropped:	number of dropped frames
+ */
+extern void sniff_ring_set_dropped(sniff_ring_t *ring, u_int64_t dropped);
+
+/**
+ * sniff_ring_get - read a record
+ * @ring:	handle returned by sniff_ring_map
+ * @seq:	record sequence number
+ * @rec:	record to fill
+ * @return
+ *	1 on success, 0 if the record was not written yet,
+ *	-1 if it was already overwritten
+ */
+extern int sniff_ring_get(sniff_ring_t *ring, u_int64_t seq, struct sniff_record *rec);
+
+/**
+ * sniff_ring_info - return the header of a mapped ring file
+ * @ring:	handle returned by sniff_ring_create or sniff_ring_map
+ */
+extern const struct sniff_ring_header *sniff_ring_info(sniff_ring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SNIFFER_H__ */
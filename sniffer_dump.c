@@ -0,0 +1,218 @@
+/*
+ *  Sniffer ring file formatter
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "sniffer.h"
+#include "beacon.h"
+
+/* Seconds between two beacon reports when following a capture */
+#define REPORT_INTERVAL	60
+
+static void print_time(u_int64_t us)
+{
+	time_t t = us / 1000000;
+	char buf[32];
+	struct tm tm;
+
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm));
+	fprintf(stdout, "%s.%06u", buf, (unsigned int)(us % 1000000));
+}
+
+static void print_record(u_int64_t seq, const struct sniff_record *rec)
+{
+	fprintf(stdout, "%llu ", (unsigned long long)seq);
+	print_time(rec->host_time);
+	fprintf(stdout, " %s type %u systime %llu beacontime %u\n",
+		rec->direction ? "Rx" : "Tx", rec->type,
+		(unsigned long long)rec->systime, rec->beacontime);
+	fprintf(stdout, "  FC del %u snid %x stei %02x dtei %02x lid %02x eks %x "
+			"tmi %u fl %u sym %u ppb %u ble %u mpdu %u burst %u clst %u rg %u "
+			"mfs %u/%u%s%s%s%s%s%s%s%s%s%s fccs %02x%02x%02x\n",
+		rec->del_type, rec->snid, rec->stei, rec->dtei, rec->lid, rec->eks,
+		rec->tmi_av, rec->fl_av, rec->num_sym, rec->ppb, rec->ble,
+		rec->mpdu_cnt, rec->burst_cnt, rec->clst, rec->rg_len,
+		rec->mfs_cmd_mgmt, rec->mfs_cmd_data,
+		rec->flags & SNIFF_F_ACCESS ? " access" : "",
+		rec->flags & SNIFF_F_CFS ? " cfs" : "",
+		rec->flags & SNIFF_F_BDF ? " bdf" : "",
+		rec->flags & SNIFF_F_HP10DF ? " hp10" : "",
+		rec->flags & SNIFF_F_HP11DF ? " hp11" : "",
+		rec->flags & SNIFF_F_PBSZ ? " pbsz" : "",
+		rec->flags & SNIFF_F_RSR ? " rsr" : "",
+		rec->flags & SNIFF_F_MCF ? " mcf" : "",
+		rec->flags & SNIFF_F_DCCPCF ? " dccpcf" : "",
+		rec->flags & SNIFF_F_MNBF ? " mnbf" : "",
+		rec->fccs[0], rec->fccs[1], rec->fccs[2]);
+	fprintf(stdout, "  BCN del %u snid %x%s bts %u bto %u %u %u %u fccs %02x%02x%02x\n",
+		rec->bcn_del_type, rec->bcn_snid,
+		rec->flags & SNIFF_F_BCN_ACCESS ? " access" : "",
+		rec->bts, rec->bto[0], rec->bto[1], rec->bto[2], rec->bto[3],
+		rec->bcn_fccs[0], rec->bcn_fccs[1], rec->bcn_fccs[2]);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: sniffer_dump [options] file\n"
+			"-n:	only show the last <count> records\n"
+			"-f:	keep waiting for new records\n"
+			"-b:	analyze beacon timing and the device clock instead of printing records\n"
+			"-h:	this help\n");
+}
+
+int main(int argc, char **argv)
+{
+	const struct sniff_ring_header *hdr;
+	struct sniff_record rec;
+	struct bcn_analyzer *bcn = NULL;
+	sniff_ring_t *ring;
+	u_int64_t seq, head, count = 0;
+	time_t next_report = 0;
+	int follow = 0, analyze = 0;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "n:fbh")) > 0) {
+		switch (opt) {
+		case 'n':
+			count = strtoull(optarg, NULL, 0);
+			break;
+		case 'f':
+			follow = 1;
+			break;
+		case 'b':
+			analyze = 1;
+			break;
+		case 'h':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		usage();
+		return 1;
+	}
+
+	ring = sniff_ring_map(argv[0]);
+	if (!ring) {
+		fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+		return 1;
+	}
+	hdr = sniff_ring_info(ring);
+
+	if (analyze) {
+		bcn = malloc(sizeof(*bcn));
+		if (!bcn) {
+			fprintf(stderr, "%s\n", strerror(errno));
+			sniff_ring_close(ring);
+			return 1;
+		}
+		bcn_analyzer_init(bcn);
+		next_report = time(NULL) + REPORT_INTERVAL;
+	}
+
+	/* Start with the oldest record still in the ring */
+	head = hdr->head;
+	seq = head >= hdr->capacity ? head - hdr->capacity + 1 : 0;
+	if (count && head - seq > count)
+		seq = head - count;
+
+	for (;;) {
+		ret = sniff_ring_get(ring, seq, &rec);
+		if (ret > 0) {
+			if (bcn)
+				bcn_analyzer_add(bcn, &rec);
+			else
+				print_record(seq, &rec);
+			seq++;
+			continue;
+		}
+		if (ret < 0) {
+			/* Overwritten while we were reading, skip ahead */
+			head = hdr->head;
+			fprintf(stdout, "%llu records lost\n",
+				(unsigned long long)(head - hdr->capacity + 1 - seq));
+			seq = head - hdr->capacity + 1;
+			continue;
+		}
+		if (!follow)
+			break;
+		if (bcn && time(NULL) >= next_report) {
+			bcn_analyzer_report(bcn, stdout);
+			next_report += REPORT_INTERVAL;
+		}
+		fflush(stdout);
+		usleep(100000);
+	}
+
+	if (bcn) {
+		bcn_analyzer_report(bcn, stdout);
+		free(bcn);
+	}
+
+	fprintf(stdout, "%llu records written, %llu frames dropped by the capture\n",
+		(unsigned long long)hdr->head, (unsigned long long)hdr->dropped);
+
+	sniff_ring_close(ring);
+	return 0;
+}
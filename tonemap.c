@@ -0,0 +1,673 @@
+/*
+ *  Tone map history store
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tonemap.h"
+
+/* Worst case size of an encoded delta */
+#define TM_HIST_DELTA_MAX(len)	((len) + (len) / 128 + 4)
+
+/**
+ * tm_stream - block being built for a (peer, slot) stream
+ * @peer:	peer MAC address
+ * @slot:	tone map slot
+ * @count:	number of records in the block
+ * @num_carriers: number of carriers of the block records
+ * @t_first:	timestamp of the keyframe
+ * @t_last:	timestamp of the last record
+ * @prev:	last tone map appended, reference for the next delta
+ * @buf:	encoded records
+ * @len:	number of bytes used in @buf
+ * @size:	allocated size of @buf
+ */
+struct tm_stream {
+	u_int8_t	peer[6];
+	u_int8_t	slot;
+	u_int8_t	count;
+	u_int16_t	num_carriers;
+	u_int64_t	t_first;
+	u_int64_t	t_last;
+	u_int8_t	prev[TM_HIST_MAX_BYTES];
+	u_int8_t	*buf;
+	size_t		len;
+	size_t		size;
+};
+
+struct tm_hist {
+	/* Writer side */
+	int			fd;
+	int			idx_fd;
+	pthread_mutex_t		lock;
+	struct tm_stream	*streams;
+	int			num_streams;
+	int			max_streams;
+
+	/* Reader side */
+	u_int8_t		*data;
+	size_t			data_len;
+	u_int8_t		*idx;
+	size_t			idx_len;
+};
+
+static char *tm_hist_idx_path(const char *path)
+{
+	char *idx_path;
+
+	idx_path = malloc(strlen(path) + sizeof(".idx"));
+	if (idx_path)
+		sprintf(idx_path, "%s.idx", path);
+
+	return idx_path;
+}
+
+/**
+ * tm_hist_open_file - open a history file for appending and check its header
+ * @path:	file path
+ * @magic:	expected magic
+ * @unit:	the file body must be a multiple of this size (0 for none)
+ */
+static int tm_hist_open_file(const char *path, u_int32_t magic, size_t unit)
+{
+	struct tm_hist_file_header fh;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0)
+		goto out_close;
+
+	if (st.st_size == 0) {
+		memset(&fh, 0, sizeof(fh));
+		fh.magic = magic;
+		fh.version = TM_HIST_VERSION;
+		fh.block_records = TM_HIST_BLOCK_RECORDS;
+		if (write(fd, &fh, sizeof(fh)) != sizeof(fh))
+			goto out_close;
+		return fd;
+	}
+
+	if (pread(fd, &fh, sizeof(fh), 0) != sizeof(fh) ||
+	    fh.magic != magic || fh.version != TM_HIST_VERSION) {
+		errno = EINVAL;
+		goto out_close;
+	}
+
+	/* Drop a partially written trailing entry */
+	if (unit && (st.st_size - sizeof(fh)) % unit)
+		if (ftruncate(fd, st.st_size - (st.st_size - sizeof(fh)) % unit) < 0)
+			goto out_close;
+
+	return fd;
+
+out_close:
+	close(fd);
+	return -1;
+}
+
+tm_hist_t *tm_hist_open(const char *path)
+{
+	tm_hist_t *h;
+	char *idx_path;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return NULL;
+
+	idx_path = tm_hist_idx_path(path);
+	if (!idx_path)
+		goto out_free;
+
+	h->fd = tm_hist_open_file(path, TM_HIST_MAGIC, 0);
+	if (h->fd < 0)
+		goto out_free_path;
+
+	h->idx_fd = tm_hist_open_file(idx_path, TM_HIST_IDX_MAGIC,
+					sizeof(struct tm_hist_index_entry));
+	if (h->idx_fd < 0)
+		goto out_close;
+
+	pthread_mutex_init(&h->lock, NULL);
+	free(idx_path);
+
+	return h;
+
+out_close:
+	close(h->fd);
+out_free_path:
+	free(idx_path);
+out_free:
+	free(h);
+	return NULL;
+}
+
+/**
+ * tm_hist_encode_delta - run-length encode the XOR of two tone maps
+ * @cur:	new tone map
+ * @prev:	reference tone map
+ * @len:	tone map length in bytes
+ * @out:	output buffer, at least TM_HIST_DELTA_MAX(len) bytes
+ *
+ * The encoded stream is a sequence of tokens; a token byte below 0x80
+ * stands for (token + 1) unchanged bytes, otherwise it is followed by
+ * (token & 0x7f) + 1 literal XOR bytes.
+ */
+static int tm_hist_encode_delta(const u_int8_t *cur, const u_int8_t *prev, int len, u_int8_t *out)
+{
+	u_int8_t *p = out;
+	int i = 0, n;
+
+	while (i < len) {
+		for (n = 0; i + n < len && n < 128 && cur[i + n] == prev[i + n]; n++)
+			;
+		if (n) {
+			*p++ = n - 1;
+			i += n;
+			continue;
+		}
+
+		/* A literal run stops at the first pair of unchanged bytes */
+		for (n = 0; i + n < len && n < 128; n++) {
+			if (cur[i + n] == prev[i + n] &&
+			    (i + n + 1 == len || cur[i + n + 1] == prev[i + n + 1]))
+				break;
+		}
+		*p++ = 0x80 | (n - 1);
+		while (n--) {
+			*p++ = cur[i] ^ prev[i];
+			i++;
+		}
+	}
+
+	return (p - out);
+}
+
+/**
+ * tm_hist_apply_delta - apply an encoded delta to a tone map
+ * @map:	tone map to update
+ * @len:	tone map length in bytes
+ * @in:		encoded delta
+ * @in_len:	encoded delta length
+ * @return
+ *	0 on success, -1 on a malformed delta
+ */
+static int tm_hist_apply_delta(u_int8_t *map, int len, const u_int8_t *in, int in_len)
+{
+	const u_int8_t *end = in + in_len;
+	int i = 0, n;
+
+	while (in < end) {
+		n = (*in & 0x7f) + 1;
+		if (i + n > len)
+			return -1;
+		if (*in++ & 0x80) {
+			if (in + n > end)
+				return -1;
+			while (n--)
+				map[i++] ^= *in++;
+		} else {
+			i += n;
+		}
+	}
+
+	return 0;
+}
+
+static int tm_hist_write_block(tm_hist_t *h, struct tm_stream *s)
+{
+	struct tm_hist_block_header bh;
+	struct tm_hist_index_entry ie;
+	struct iovec iov[2];
+	off_t offset;
+	ssize_t total = sizeof(bh) + s->len;
+
+	if (!s->count)
+		return 0;
+
+	memset(&bh, 0, sizeof(bh));
+	bh.magic = TM_HIST_BLOCK_MAGIC;
+	bh.length = s->len;
+	bh.t_first = s->t_first;
+	bh.t_last = s->t_last;
+	memcpy(bh.peer, s->peer, sizeof(bh.peer));
+	bh.slot = s->slot;
+	bh.count = s->count;
+
+	offset = lseek(h->fd, 0, SEEK_END);
+	if (offset < 0)
+		return -1;
+
+	iov[0].iov_base = &bh;
+	iov[0].iov_len = sizeof(bh);
+	iov[1].iov_base = s->buf;
+	iov[1].iov_len = s->len;
+	if (writev(h->fd, iov, 2) != total)
+		return -1;
+
+	/* The index entry goes last so that readers never see a dangling one */
+	memset(&ie, 0, sizeof(ie));
+	ie.t_first = s->t_first;
+	ie.t_last = s->t_last;
+	ie.offset = offset;
+	memcpy(ie.peer, s->peer, sizeof(ie.peer));
+	ie.slot = s->slot;
+	ie.count = s->count;
+	if (write(h->idx_fd, &ie, sizeof(ie)) != sizeof(ie))
+		return -1;
+
+	s->count = 0;
+	s->len = 0;
+
+	return 0;
+}
+
+static struct tm_stream *tm_hist_get_stream(tm_hist_t *h, const u_int8_t *peer, u_int8_t slot)
+{
+	struct tm_stream *s;
+	int i;
+
+	for (i = 0; i < h->num_streams; i++) {
+		s = &h->streams[i];
+		if (s->slot == slot && !memcmp(s->peer, peer, sizeof(s->peer)))
+			return s;
+	}
+
+	if (h->num_streams == h->max_streams) {
+		int max = h->max_streams ? h->max_streams * 2 : 16;
+
+		s = realloc(h->streams, max * sizeof(*s));
+		if (!s)
+			return NULL;
+		h->streams = s;
+		h->max_streams = max;
+	}
+
+	s = &h->streams[h->num_streams++];
+	memset(s, 0, sizeof(*s));
+	memcpy(s->peer, peer, sizeof(s->peer));
+	s->slot = slot;
+
+	return s;
+}
+
+static int tm_hist_reserve(struct tm_stream *s, size_t len)
+{
+	u_int8_t *buf;
+	size_t size;
+
+	if (s->len + len <= s->size)
+		return 0;
+
+	size = s->size ? s->size : 1024;
+	while (size < s->len + len)
+		size *= 2;
+
+	buf = realloc(s->buf, size);
+	if (!buf)
+		return -1;
+	s->buf = buf;
+	s->size = size;
+
+	return 0;
+}
+
+int tm_hist_append(tm_hist_t *h, const u_int8_t *peer, u_int8_t slot,
+		   time_t t, const u_int8_t *carriers, int num_carriers)
+{
+	struct tm_stream *s;
+	struct tm_hist_record *rec;
+	int len = (num_carriers + 1) / 2;
+	int ret = -1;
+
+	if (num_carriers <= 0 || num_carriers > TM_HIST_MAX_CARRIERS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&h->lock);
+
+	s = tm_hist_get_stream(h, peer, slot);
+	if (!s)
+		goto out;
+
+	/* Start a new block with a keyframe when needed */
+	if (s->count && (s->count >= TM_HIST_BLOCK_RECORDS ||
+			 s->num_carriers != num_carriers ||
+			 (u_int64_t)t < s->t_first ||
+			 (u_int64_t)t - s->t_first >= TM_HIST_BLOCK_SPAN)) {
+		if (tm_hist_write_block(h, s))
+			goto out;
+	}
+
+	if (tm_hist_reserve(s, sizeof(*rec) + TM_HIST_DELTA_MAX(len)))
+		goto out;
+
+	rec = (struct tm_hist_record *)(s->buf + s->len);
+	rec->num_carriers = num_carriers;
+	if (!s->count) {
+		s->t_first = t;
+		s->num_carriers = num_carriers;
+		rec->dt = 0;
+		rec->length = len;
+		memcpy(rec->data, carriers, len);
+	} else {
+		rec->dt = (u_int64_t)t - s->t_first;
+		rec->length = tm_hist_encode_delta(carriers, s->prev, len, rec->data);
+	}
+	s->len += sizeof(*rec) + rec->length;
+	s->t_last = t;
+	s->count++;
+	memcpy(s->prev, carriers, len);
+	ret = 0;
+out:
+	pthread_mutex_unlock(&h->lock);
+	return ret;
+}
+
+int tm_hist_flush(tm_hist_t *h)
+{
+	int i, ret = 0;
+
+	pthread_mutex_lock(&h->lock);
+	for (i = 0; i < h->num_streams; i++) {
+		if (tm_hist_write_block(h, &h->streams[i]))
+			ret = -1;
+	}
+	pthread_mutex_unlock(&h->lock);
+
+	return ret;
+}
+
+void tm_hist_close(tm_hist_t *h)
+{
+	int i;
+
+	if (!h)
+		return;
+
+	tm_hist_flush(h);
+	for (i = 0; i < h->num_streams; i++)
+		free(h->streams[i].buf);
+	free(h->streams);
+	close(h->idx_fd);
+	close(h->fd);
+	pthread_mutex_destroy(&h->lock);
+	free(h);
+}
+
+static void *tm_hist_map_file(const char *path, u_int32_t magic, size_t *len)
+{
+	struct tm_hist_file_header *fh;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	if ((size_t)st.st_size < sizeof(*fh)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	fh = map;
+	if (fh->magic != magic || fh->version != TM_HIST_VERSION) {
+		munmap(map, st.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	*len = st.st_size;
+
+	return map;
+}
+
+tm_hist_t *tm_hist_map(const char *path)
+{
+	tm_hist_t *h;
+	char *idx_path;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return NULL;
+	h->fd = h->idx_fd = -1;
+
+	idx_path = tm_hist_idx_path(path);
+	if (!idx_path)
+		goto out_free;
+
+	h->data = tm_hist_map_file(path, TM_HIST_MAGIC, &h->data_len);
+	if (!h->data)
+		goto out_free_path;
+
+	h->idx = tm_hist_map_file(idx_path, TM_HIST_IDX_MAGIC, &h->idx_len);
+	if (!h->idx)
+		goto out_unmap;
+
+	free(idx_path);
+
+	return h;
+
+out_unmap:
+	munmap(h->data, h->data_len);
+out_free_path:
+	free(idx_path);
+out_free:
+	free(h);
+	return NULL;
+}
+
+void tm_hist_unmap(tm_hist_t *h)
+{
+	if (!h)
+		return;
+
+	munmap(h->idx, h->idx_len);
+	munmap(h->data, h->data_len);
+	free(h);
+}
+
+const struct tm_hist_index_entry *tm_hist_index(tm_hist_t *h, int *count)
+{
+	size_t len = h->idx_len - sizeof(struct tm_hist_file_header);
+
+	*count = len / sizeof(struct tm_hist_index_entry);
+
+	return (struct tm_hist_index_entry *)(h->idx + sizeof(struct tm_hist_file_header));
+}
+
+static int tm_hist_match(const struct tm_hist_index_entry *ie, const u_int8_t *peer, u_int8_t slot)
+{
+	return ie->slot == slot && !memcmp(ie->peer, peer, sizeof(ie->peer));
+}
+
+/**
+ * tm_hist_decode_block - decode the records of a block up to a given time
+ * @h:		mapped history
+ * @ie:		index entry of the block
+ * @from:	records before this timestamp are decoded but not reported
+ * @to:		decoding stops after the last record not later than @to
+ * @cb:		callback invoked for each reported record (may be NULL)
+ * @user:	user value passed to @cb
+ * @map:	output tone map, holds the last decoded record on return
+ * @t_rec:	timestamp of the last decoded record
+ * @reported:	incremented for each record passed to @cb
+ * @return
+ *	number of carriers of the last decoded record, 0 if none, -1 on error
+ */
+static int tm_hist_decode_block(tm_hist_t *h, const struct tm_hist_index_entry *ie,
+				time_t from, time_t to, tm_hist_cb_t cb, void *user,
+				u_int8_t *map, time_t *t_rec, int *reported)
+{
+	struct tm_hist_block_header *bh;
+	struct tm_hist_record *rec;
+	u_int8_t *p, *end;
+	int i, len, num_carriers = 0;
+	time_t t;
+
+	if (ie->offset + sizeof(*bh) > h->data_len)
+		return -1;
+
+	bh = (struct tm_hist_block_header *)(h->data + ie->offset);
+	if (bh->magic != TM_HIST_BLOCK_MAGIC ||
+	    ie->offset + sizeof(*bh) + bh->length > h->data_len)
+		return -1;
+
+	p = (u_int8_t *)(bh + 1);
+	end = p + bh->length;
+	for (i = 0; i < bh->count; i++) {
+		rec = (struct tm_hist_record *)p;
+		if (p + sizeof(*rec) > end || rec->data + rec->length > end ||
+		    rec->num_carriers > TM_HIST_MAX_CARRIERS)
+			return -1;
+
+		t = bh->t_first + rec->dt;
+		if (t > to)
+			break;
+
+		len = (rec->num_carriers + 1) / 2;
+		if (i == 0) {
+			if (rec->length != len)
+				return -1;
+			memcpy(map, rec->data, len);
+		} else if (tm_hist_apply_delta(map, len, rec->data, rec->length)) {
+			return -1;
+		}
+		num_carriers = rec->num_carriers;
+		*t_rec = t;
+
+		if (cb && t >= from) {
+			cb(t, map, num_carriers, user);
+			(*reported)++;
+		}
+
+		p = rec->data + rec->length;
+	}
+
+	return num_carriers;
+}
+
+int tm_hist_lookup(tm_hist_t *h, const u_int8_t *peer, u_int8_t slot,
+		   time_t t, u_int8_t *carriers, time_t *t_rec)
+{
+	const struct tm_hist_index_entry *ie;
+	time_t t_found = 0;
+	int i, count, reported = 0;
+	int ret;
+
+	ie = tm_hist_index(h, &count);
+
+	/* Blocks of a stream are indexed in time order: the last
+	 * matching block starting before t is the only one to decode */
+	for (i = count - 1; i >= 0; i--) {
+		if (!tm_hist_match(&ie[i], peer, slot) || (time_t)ie[i].t_first > t)
+			continue;
+
+		ret = tm_hist_decode_block(h, &ie[i], t, t, NULL, NULL,
+					   carriers, &t_found, &reported);
+		if (ret > 0 && t_rec)
+			*t_rec = t_found;
+
+		return ret;
+	}
+
+	return 0;
+}
+
+int tm_hist_foreach(tm_hist_t *h, const u_int8_t *peer, u_int8_t slot,
+		    time_t from, time_t to, tm_hist_cb_t cb, void *user)
+{
+	const struct tm_hist_index_entry *ie;
+	u_int8_t map[TM_HIST_MAX_BYTES];
+	time_t t_rec;
+	int i, count, reported = 0;
+
+	ie = tm_hist_index(h, &count);
+
+	for (i = 0; i < count; i++) {
+		if (!tm_hist_match(&ie[i], peer, slot) ||
+		    (time_t)ie[i].t_last < from || (time_t)ie[i].t_first > to)
+			continue;
+
+		if (tm_hist_decode_block(h, &ie[i], from, to, cb, user,
+					 map, &t_rec, &reported) < 0)
+			return -1;
+	}
+
+	return reported;
+}
@@ -0,0 +1,256 @@
+/*
+ *  Tone map history store
+ *
+ *  Copyright (C) 2007-2008 Xavier Carcelle <xavier.carcelle@gmail.com>
+ *		    	    Florian Fainelli <florian@openwrt.org>
+ *			    Nicolas Thill <nico@openwrt.org>
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL.  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so.  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version.  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+
+#ifndef __TONEMAP_H__
+#define __TONEMAP_H__
+
+#include <sys/types.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A tone map history is made of two append-only files:
+ *
+ * <file>	a file header followed by blocks; each block holds the
+ *		records of one (peer, slot) stream: a keyframe with the raw
+ *		carrier nibbles, then up to TM_HIST_BLOCK_RECORDS - 1 deltas
+ *		encoded as a run-length coded XOR against the previous record
+ * <file>.idx	a file header followed by one fixed-size entry per block
+ *
+ * Readers mmap both files, locate the blocks they need from the index
+ * and only decode those.
+ */
+
+#define TM_HIST_MAGIC		0x484d5446	/* "FTMH" */
+#define TM_HIST_IDX_MAGIC	0x584d5446	/* "FTMX" */
+#define TM_HIST_BLOCK_MAGIC	0x4b4c4254	/* "TBLK" */
+#define TM_HIST_VERSION		1
+
+#define TM_HIST_MAX_BYTES	580	/* two carriers per byte */
+#define TM_HIST_MAX_CARRIERS	(TM_HIST_MAX_BYTES * 2)
+#define TM_HIST_BLOCK_RECORDS	64	/* records per block, keyframe included */
+#define TM_HIST_BLOCK_SPAN	3600	/* max seconds covered by an open block */
+
+/**
+ * tm_hist_file_header - header of both the data and the index file
+ * @magic:	TM_HIST_MAGIC or TM_HIST_IDX_MAGIC
+ * @version:	TM_HIST_VERSION
+ * @block_records: maximum number of records per block
+ */
+struct tm_hist_file_header {
+	u_int32_t	magic;
+	u_int16_t	version;
+	u_int16_t	block_records;
+	u_int8_t	reserved[8];
+} __attribute__((__packed__));
+
+/**
+ * tm_hist_block_header - header of a block in the data file
+ * @magic:	TM_HIST_BLOCK_MAGIC
+ * @length:	number of bytes of records following this header
+ * @t_first:	timestamp of the keyframe
+ * @t_last:	timestamp of the last record
+ * @peer:	peer MAC address
+ * @slot:	tone map slot
+ * @count:	number of records in the block
+ */
+struct tm_hist_block_header {
+	u_int32_t	magic;
+	u_int32_t	length;
+	u_int64_t	t_first;
+	u_int64_t	t_last;
+	u_int8_t	peer[6];
+	u_int8_t	slot;
+	u_int8_t	count;
+} __attribute__((__packed__));
+
+/**
+ * tm_hist_record - header of a record inside a block
+ * @dt:		seconds since the block keyframe
+ * @num_carriers: number of carriers of this tone map
+ * @length:	number of encoded bytes following this header
+ */
+struct tm_hist_record {
+	u_int32_t	dt;
+	u_int16_t	num_carriers;
+	u_int16_t	length;
+	u_int8_t	data[0];
+} __attribute__((__packed__));
+
+/**
+ * tm_hist_index_entry - index file entry, one per block
+ * @t_first:	timestamp of the block keyframe
+ * @t_last:	timestamp of the last record of the block
+ * @offset:	offset of the block header in the data file
+ * @peer:	peer MAC address
+ * @slot:	tone map slot
+ * @count:	number of records in the block
+ */
+struct tm_hist_index_entry {
+	u_int64_t	t_first;
+	u_int64_t	t_last;
+	u_int64_t	offset;
+	u_int8_t	peer[6];
+	u_int8_t	slot;
+	u_int8_t	count;
+} __attribute__((__packed__));
+
+/**
+ * tm_hist_t - history handle, either for writing or for reading
+ */
+typedef struct tm_hist tm_hist_t;
+
+/**
+ * tm_hist_cb_t - record callback used by tm_hist_foreach
+ * @t:		record timestamp
+ * @carriers:	reconstructed carrier nibbles, two carriers per byte
+ * @num_carriers: number of carriers
+ * @user:	user value passed to tm_hist_foreach
+ */
+typedef void (*tm_hist_cb_t)(time_t t, const u_int8_t *carriers, int num_carriers, void *user);
+
+/**
+ * tm_hist_open - open (or create) a history for appending
+ * @path:	data file path, the index is stored at <path>.idx
+ * @return
+ *	handle on success, NULL on error (errno is set)
+ */
+extern tm_hist_t *tm_hist_open(const char *path);
+
+/**
+ * tm_hist_append - append a tone map to a history
+ * @h:		handle returned by tm_hist_open
+ * @peer:	peer MAC address
+ * @slot:	tone map slot
+ * @t:		timestamp of the tone map
+ * @carriers:	carrier nibbles, two carriers per byte (struct carrier)
+ * @num_carriers: number of carriers
+ * @return
+ *	0 on success, -1 on error
+ */
+extern int tm_hist_append(tm_hist_t *h, const u_int8_t *peer, u_int8_t slot,
+			  time_t t, const u_int8_t *carriers, int num_carriers);
+
+/**
+ * tm_hist_flush - write out all pending blocks
+ * @h:		handle returned by tm_hist_open
+ * @return
+ *	0 on success, -1 on error
+ */
+extern int tm_hist_flush(tm_hist_t *h);
+
+/**
+ * tm_hist_close - flush and close a history opened for writing
+ * @h:		handle returned by tm_hist_open
+ */
+extern void tm_hist_close(tm_hist_t *h);
+
+/**
+ * tm_hist_map - map a history read-only
+ * @path:	data file path
+ * @return
+ *	handle on success, NULL on error (errno is set)
+ */
+extern tm_hist_t *tm_hist_map(const char *path);
+
+/**
+ * tm_hist_unmap - release a handle returned by tm_hist_map
+ * @h:		history handle
+ */
+extern void tm_hist_unmap(tm_hist_t *h);
+
+/**
+ * tm_hist_lookup - reconstruct the tone map in effect at a given time
+ * @h:		handle returned by tm_hist_map
+ * @peer:	peer MAC address
+ * @slot:	tone map slot
+ * @t:		timestamp
+ * @carriers:	output buffer, at least TM_HIST_MAX_BYTES bytes
+ * @t_rec:	timestamp of the record found (may be NULL)
+ * @return
+ *	number of carriers, 0 if no record precedes @t, -1 on a corrupted file
+ */
+extern int tm_hist_lookup(tm_hist_t *h, const u_int8_t *peer, u_int8_t slot,
+			  time_t t, u_int8_t *carriers, time_t *t_rec);
+
+/**
+ * tm_hist_foreach - decode all the records of a stream in a time range
+ * @h:		handle returned by tm_hist_map
+ * @peer:	peer MAC address
+ * @slot:	tone map slot
+ * @from:	first timestamp (inclusive)
+ * @to:		last timestamp (inclusive)
+ * @cb:		callback invoked for each record, in time order
+ * @user:	user value passed to @cb
+ * @return
+ *	number of records reported, -1 on a corrupted file
+ */
+extern int tm_hist_foreach(tm_hist_t *h, const u_int8_t *peer, u_int8_t slot,
+			   time_t from, time_t to, tm_hist_cb_t cb, void *user);
+
+/**
+ * tm_hist_index - return the block index of a mapped history
+ * @h:		handle returned by tm_hist_map
+ * @count:	number of index entries
+ * @return
+ *	pointer to the first index entry
+ */
+extern const struct tm_hist_index_entry *tm_hist_index(tm_hist_t *h, int *count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TONEMAP_H__ */
@@ -0,0 +1,265 @@
+/*
+ * Tone map history reader
+ *
+ * Reconstructs the tone maps recorded by faifa -T at any point in time
+ *
+ *  The BSD License
+ *  ===============
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *  3. Neither the name of OpenLink Software Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL OPENLINK OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "tonemap.h"
+
+static const char *mod_str[] = {
+	"No", "BPSK", "QPSK", "QAM-8", "QAM-16", "QAM-64", "QAM-256", "QAM-1024",
+};
+
+static inline int carrier_mod(const u_int8_t *carriers, int i)
+{
+	return (i & 1) ? carriers[i / 2] >> 4 : carriers[i / 2] & 0x0f;
+}
+
+static const char *carrier_mod_str(int mod)
+{
+	if (mod < (int)(sizeof(mod_str) / sizeof(mod_str[0])))
+		return mod_str[mod];
+
+	return "Unknown";
+}
+
+static void print_time(time_t t)
+{
+	char buf[32];
+	struct tm tm;
+
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm));
+	fprintf(stdout, "%s (%lld)", buf, (long long)t);
+}
+
+static void print_mac(const u_int8_t *mac)
+{
+	fprintf(stdout, "%02x:%02x:%02x:%02x:%02x:%02x",
+		mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+static void dump_tone_map(const u_int8_t *carriers, int num_carriers)
+{
+	unsigned stats[9];
+	int i, mod;
+
+	memset(stats, 0, sizeof(stats));
+	for (i = 0; i < num_carriers; i++) {
+		mod = carrier_mod(carriers, i);
+		fprintf(stdout, "Modulation for carrier: %d : %s\n", i, carrier_mod_str(mod));
+		stats[mod < 8 ? mod : 8]++;
+	}
+
+	fprintf(stdout, "Modulation statistics\n");
+	for (i = 0; i < 9; i++)
+		fprintf(stdout, "Number of carriers with %s modulation: %u (%.2f %%)\n",
+			i < 8 ? mod_str[i] : "Unknown/unused", stats[i],
+			(double)stats[i] * 100 / num_carriers);
+	fprintf(stdout, "Number of modulation: %d\n", num_carriers);
+}
+
+struct range_ctx {
+	u_int8_t	prev[TM_HIST_MAX_BYTES];
+	int		prev_carriers;
+};
+
+static void range_cb(time_t t, const u_int8_t *carriers, int num_carriers, void *user)
+{
+	struct range_ctx *ctx = user;
+	int i, changed = 0, bits = 0;
+
+	for (i = 0; i < num_carriers; i++) {
+		if (i >= ctx->prev_carriers ||
+		    carrier_mod(carriers, i) != carrier_mod(ctx->prev, i))
+			changed++;
+		bits += carrier_mod(carriers, i);
+	}
+
+	print_time(t);
+	fprintf(stdout, " carriers: %d changed: %d bits/symbol: %d\n",
+		num_carriers, changed, bits);
+
+	memcpy(ctx->prev, carriers, (num_carriers + 1) / 2);
+	ctx->prev_carriers = num_carriers;
+}
+
+static void list_blocks(tm_hist_t *h)
+{
+	const struct tm_hist_index_entry *ie;
+	int i, count;
+
+	ie = tm_hist_index(h, &count);
+	fprintf(stdout, "Peer              Slot Records First / last\n");
+	for (i = 0; i < count; i++) {
+		print_mac(ie[i].peer);
+		fprintf(stdout, " %4d %7d ", ie[i].slot, ie[i].count);
+		print_time(ie[i].t_first);
+		fprintf(stdout, " / ");
+		print_time(ie[i].t_last);
+		fprintf(stdout, "\n");
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: tonemap_hist [options] file\n"
+			"-l:	list the recorded blocks\n"
+			"-a:	peer MAC address\n"
+			"-s:	tone map slot (default: 0)\n"
+			"-t:	show the tone map in effect at this time (seconds since the Epoch, default: now)\n"
+			"-f:	first time of a range to summarize\n"
+			"-e:	last time of a range to summarize (default: now)\n"
+			"-h:	this help\n");
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	int ret;
+	const char *mac_address = NULL;
+	unsigned int list = 0;
+	unsigned int range = 0;
+	u_int8_t slot = 0;
+	u_int8_t mac[6];
+	time_t t = time(NULL), from = 0, to = time(NULL), t_rec;
+	u_int8_t carriers[TM_HIST_MAX_BYTES];
+	struct range_ctx ctx;
+	tm_hist_t *h;
+
+	while ((opt = getopt(argc, argv, "la:s:t:f:e:h")) > 0) {
+		switch (opt) {
+		case 'l':
+			list = 1;
+			break;
+		case 'a':
+			mac_address = optarg;
+			break;
+		case 's':
+			slot = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			t = strtoll(optarg, NULL, 0);
+			break;
+		case 'f':
+			from = strtoll(optarg, NULL, 0);
+			range = 1;
+			break;
+		case 'e':
+			to = strtoll(optarg, NULL, 0);
+			range = 1;
+			break;
+		case 'h':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		usage();
+		return 1;
+	}
+
+	h = tm_hist_map(argv[0]);
+	if (!h) {
+		fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+		return 1;
+	}
+
+	if (list) {
+		list_blocks(h);
+		goto out;
+	}
+
+	if (!mac_address) {
+		fprintf(stderr, "missing peer MAC address\n");
+		ret = 1;
+		goto out_unmap;
+	}
+
+	ret = sscanf(mac_address,
+		"%"SCNx8":%"SCNx8":%"SCNx8":%"SCNx8":%"SCNx8":%"SCNx8"",
+		&mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]);
+	if (ret != 6) {
+		fprintf(stderr, "invalid MAC address\n");
+		ret = 1;
+		goto out_unmap;
+	}
+
+	if (range) {
+		memset(&ctx, 0, sizeof(ctx));
+		ret = tm_hist_foreach(h, mac, slot, from, to, range_cb, &ctx);
+		if (ret < 0) {
+			fprintf(stderr, "corrupted history file\n");
+			ret = 1;
+			goto out_unmap;
+		}
+		fprintf(stdout, "%d tone maps\n", ret);
+		goto out;
+	}
+
+	ret = tm_hist_lookup(h, mac, slot, t, carriers, &t_rec);
+	if (ret < 0) {
+		fprintf(stderr, "corrupted history file\n");
+		ret = 1;
+		goto out_unmap;
+	}
+	if (ret == 0) {
+		fprintf(stderr, "no tone map recorded before this time\n");
+		ret = 1;
+		goto out_unmap;
+	}
+
+	fprintf(stdout, "Peer: ");
+	print_mac(mac);
+	fprintf(stdout, "\nTone map slot: %d\nRecorded: ", slot);
+	print_time(t_rec);
+	fprintf(stdout, "\n");
+	dump_tone_map(carriers, ret);
+
+out:
+	ret = 0;
+out_unmap:
+	tm_hist_unmap(h);
+	return ret;
+}